@@ -0,0 +1,221 @@
+#include <string.h>
+
+#include "blake3.h"
+
+#define CHUNK_START (1 << 0)
+#define CHUNK_END   (1 << 1)
+#define PARENT      (1 << 2)
+#define ROOT        (1 << 3)
+
+static const uint32_t IV[8] = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+    0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19,
+};
+
+// The message word order for each round: the identity, then the
+// permutation {2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8}
+// applied once more per round.
+static const uint8_t MSG_SCHEDULE[7][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8},
+    {3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1},
+    {10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6},
+    {12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4},
+    {9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7},
+    {11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13},
+};
+
+static inline uint32_t rotr32(uint32_t x, int r) {
+    return (x >> r) | (x << (32 - r));
+}
+
+static inline void g(uint32_t *s, int a, int b, int c, int d,
+        uint32_t mx, uint32_t my) {
+    s[a] = s[a] + s[b] + mx;
+    s[d] = rotr32(s[d] ^ s[a], 16);
+    s[c] = s[c] + s[d];
+    s[b] = rotr32(s[b] ^ s[c], 12);
+    s[a] = s[a] + s[b] + my;
+    s[d] = rotr32(s[d] ^ s[a], 8);
+    s[c] = s[c] + s[d];
+    s[b] = rotr32(s[b] ^ s[c], 7);
+}
+
+static inline void round_fn(uint32_t *s, const uint32_t *m, int r) {
+    const uint8_t *sched = MSG_SCHEDULE[r];
+    // Columns, then diagonals
+    g(s, 0, 4, 8, 12, m[sched[0]], m[sched[1]]);
+    g(s, 1, 5, 9, 13, m[sched[2]], m[sched[3]]);
+    g(s, 2, 6, 10, 14, m[sched[4]], m[sched[5]]);
+    g(s, 3, 7, 11, 15, m[sched[6]], m[sched[7]]);
+    g(s, 0, 5, 10, 15, m[sched[8]], m[sched[9]]);
+    g(s, 1, 6, 11, 12, m[sched[10]], m[sched[11]]);
+    g(s, 2, 7, 8, 13, m[sched[12]], m[sched[13]]);
+    g(s, 3, 4, 9, 14, m[sched[14]], m[sched[15]]);
+}
+
+static inline uint32_t load32(const uint8_t *p) {
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8)
+         | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+// The compression function, keeping only the 8-word chaining value.
+static void compress(const uint32_t cv[8], const uint8_t block[BLAKE3_BLOCK_LEN],
+        uint64_t counter, uint32_t blockLen, uint32_t flags, uint32_t out[8]) {
+    uint32_t m[16];
+    for (int i = 0; i < 16; i++) {
+        m[i] = load32(block + 4 * i);
+    }
+    uint32_t s[16] = {
+        cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+        IV[0], IV[1], IV[2], IV[3],
+        (uint32_t) counter, (uint32_t) (counter >> 32), blockLen, flags,
+    };
+    for (int r = 0; r < 7; r++) {
+        round_fn(s, m, r);
+    }
+    for (int i = 0; i < 8; i++) {
+        out[i] = s[i] ^ s[i + 8];
+    }
+}
+
+static void chunk_init(struct blake3_chunk *c, const uint32_t key[8], uint64_t counter) {
+    memcpy(c->cv, key, sizeof(c->cv));
+    c->counter = counter;
+    c->blockLen = 0;
+    c->blocksCompressed = 0;
+}
+
+static size_t chunk_len(const struct blake3_chunk *c) {
+    return BLAKE3_BLOCK_LEN * (size_t) c->blocksCompressed + c->blockLen;
+}
+
+static uint32_t chunk_start_flag(const struct blake3_chunk *c) {
+    return c->blocksCompressed == 0 ? CHUNK_START : 0;
+}
+
+static void chunk_update(struct blake3_chunk *c, const uint8_t *in, size_t len) {
+    while (len > 0) {
+        // Whole blocks with more input after them are compressed in
+        // place; the last block is held back for chunk_output.
+        if (c->blockLen == 0 && len > BLAKE3_BLOCK_LEN) {
+            compress(c->cv, in, c->counter, BLAKE3_BLOCK_LEN,
+                     chunk_start_flag(c), c->cv);
+            c->blocksCompressed++;
+            in += BLAKE3_BLOCK_LEN;
+            len -= BLAKE3_BLOCK_LEN;
+            continue;
+        }
+        if (c->blockLen == BLAKE3_BLOCK_LEN) {
+            compress(c->cv, c->block, c->counter, BLAKE3_BLOCK_LEN,
+                     chunk_start_flag(c), c->cv);
+            c->blocksCompressed++;
+            c->blockLen = 0;
+        }
+        size_t take = BLAKE3_BLOCK_LEN - c->blockLen;
+        if (take > len) {
+            take = len;
+        }
+        memcpy(c->block + c->blockLen, in, take);
+        c->blockLen += take;
+        in += take;
+        len -= take;
+    }
+}
+
+/**
+ * A node's inputs to its final compression, which differs for the
+ * root.
+ */
+struct output {
+    uint32_t cv[8];
+    uint8_t block[BLAKE3_BLOCK_LEN];
+    uint64_t counter;
+    uint32_t blockLen;
+    uint32_t flags;
+};
+
+static void chunk_output(const struct blake3_chunk *c, struct output *o) {
+    memcpy(o->cv, c->cv, sizeof(o->cv));
+    memset(o->block, 0, sizeof(o->block));
+    memcpy(o->block, c->block, c->blockLen);
+    o->counter = c->counter;
+    o->blockLen = c->blockLen;
+    o->flags = chunk_start_flag(c) | CHUNK_END;
+}
+
+static void parent_output(const uint32_t left[8], const uint32_t right[8],
+        struct output *o) {
+    memcpy(o->cv, IV, sizeof(o->cv));
+    for (int i = 0; i < 8; i++) {
+        o->block[4 * i] = left[i];
+        o->block[4 * i + 1] = left[i] >> 8;
+        o->block[4 * i + 2] = left[i] >> 16;
+        o->block[4 * i + 3] = left[i] >> 24;
+        o->block[32 + 4 * i] = right[i];
+        o->block[32 + 4 * i + 1] = right[i] >> 8;
+        o->block[32 + 4 * i + 2] = right[i] >> 16;
+        o->block[32 + 4 * i + 3] = right[i] >> 24;
+    }
+    o->counter = 0;
+    o->blockLen = BLAKE3_BLOCK_LEN;
+    o->flags = PARENT;
+}
+
+static void output_cv(const struct output *o, uint32_t cv[8]) {
+    compress(o->cv, o->block, o->counter, o->blockLen, o->flags, cv);
+}
+
+void blake3_init(struct blake3_hasher *h) {
+    chunk_init(&h->chunk, IV, 0);
+    h->cvStackLen = 0;
+}
+
+void blake3_update(struct blake3_hasher *h, const void *data, size_t len) {
+    const uint8_t *in = data;
+    while (len > 0) {
+        // A full chunk is only finished once more input arrives, since
+        // the last chunk is finalized differently.
+        if (chunk_len(&h->chunk) == BLAKE3_CHUNK_LEN) {
+            struct output o;
+            uint32_t cv[8];
+            chunk_output(&h->chunk, &o);
+            output_cv(&o, cv);
+            uint64_t totalChunks = h->chunk.counter + 1;
+            // Merge each completed subtree with its left sibling
+            while ((totalChunks & 1) == 0) {
+                h->cvStackLen--;
+                parent_output(h->cvStack[h->cvStackLen], cv, &o);
+                output_cv(&o, cv);
+                totalChunks >>= 1;
+            }
+            memcpy(h->cvStack[h->cvStackLen++], cv, sizeof(cv));
+            chunk_init(&h->chunk, IV, h->chunk.counter + 1);
+        }
+        size_t take = BLAKE3_CHUNK_LEN - chunk_len(&h->chunk);
+        if (take > len) {
+            take = len;
+        }
+        chunk_update(&h->chunk, in, take);
+        in += take;
+        len -= take;
+    }
+}
+
+void blake3_final(const struct blake3_hasher *h, uint8_t out[BLAKE3_OUT_LEN]) {
+    struct output o;
+    chunk_output(&h->chunk, &o);
+    for (int i = h->cvStackLen - 1; i >= 0; i--) {
+        uint32_t cv[8];
+        output_cv(&o, cv);
+        parent_output(h->cvStack[i], cv, &o);
+    }
+    uint32_t words[8];
+    compress(o.cv, o.block, o.counter, o.blockLen, o.flags | ROOT, words);
+    for (int i = 0; i < 8; i++) {
+        out[4 * i] = words[i];
+        out[4 * i + 1] = words[i] >> 8;
+        out[4 * i + 2] = words[i] >> 16;
+        out[4 * i + 3] = words[i] >> 24;
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef _BLAKE3_H_
+#define _BLAKE3_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * BLAKE3 (unkeyed, 32-byte output), computed incrementally.  A plain
+ * portable implementation of the reference algorithm; the results
+ * match the reference b3sum.
+ */
+
+#define BLAKE3_OUT_LEN 32
+#define BLAKE3_BLOCK_LEN 64
+#define BLAKE3_CHUNK_LEN 1024
+// Enough chaining values for 2^54 chunks, more than any file here
+#define BLAKE3_MAX_DEPTH 54
+
+struct blake3_chunk {
+    uint32_t cv[8];
+    uint64_t counter;           // Index of this chunk in the input
+    uint8_t block[BLAKE3_BLOCK_LEN];
+    uint8_t blockLen;
+    uint8_t blocksCompressed;
+};
+
+struct blake3_hasher {
+    struct blake3_chunk chunk;
+    uint32_t cvStack[BLAKE3_MAX_DEPTH][8];  // Subtrees awaiting a sibling
+    uint8_t cvStackLen;
+};
+
+void blake3_init(struct blake3_hasher *h);
+
+/**
+ * Adds len bytes at data to the hash.
+ */
+void blake3_update(struct blake3_hasher *h, const void *data, size_t len);
+
+/**
+ * Stores the hash of everything added so far at out.  The hasher is
+ * left unchanged.
+ */
+void blake3_final(const struct blake3_hasher *h, uint8_t out[BLAKE3_OUT_LEN]);
+
+#endif // _BLAKE3_H_
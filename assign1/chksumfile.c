@@ -11,68 +11,180 @@
 #include "directory.h"
 #include "pathname.h"
 #include "chksumfile.h"
+#include "xxh3.h"
+#include "blake3.h"
 #include <openssl/sha.h>
 
+static const char *const algNames[] = {
+    [CHKSUMFILE_SHA1] = "sha1",
+    [CHKSUMFILE_XXH3] = "xxh3",
+    [CHKSUMFILE_BLAKE3] = "blake3",
+};
+
+static const int algLengths[] = {
+    [CHKSUMFILE_SHA1] = SHA_DIGEST_LENGTH,
+    [CHKSUMFILE_XXH3] = 8,
+    [CHKSUMFILE_BLAKE3] = BLAKE3_OUT_LEN,
+};
+
+#define NUM_ALGS ((int) (sizeof(algNames) / sizeof(algNames[0])))
+
+// State of a hash in progress, whichever the algorithm.
+struct hasher {
+    enum chksumfile_alg alg;
+    union {
+        SHA_CTX sha;
+        struct xxh3_state xxh3;
+        struct blake3_hasher blake3;
+    } u;
+};
+
+static int hasher_init(struct hasher *h, enum chksumfile_alg alg) {
+    h->alg = alg;
+    switch (alg) {
+    case CHKSUMFILE_SHA1:
+        return SHA1_Init(&h->u.sha) ? 0 : -1;
+    case CHKSUMFILE_XXH3:
+        xxh3_init(&h->u.xxh3);
+        return 0;
+    case CHKSUMFILE_BLAKE3:
+        blake3_init(&h->u.blake3);
+        return 0;
+    }
+    return -1;
+}
+
+static int hasher_update(struct hasher *h, const void *data, size_t len) {
+    switch (h->alg) {
+    case CHKSUMFILE_SHA1:
+        return SHA1_Update(&h->u.sha, data, len) ? 0 : -1;
+    case CHKSUMFILE_XXH3:
+        xxh3_update(&h->u.xxh3, data, len);
+        return 0;
+    case CHKSUMFILE_BLAKE3:
+        blake3_update(&h->u.blake3, data, len);
+        return 0;
+    }
+    return -1;
+}
+
+static int hasher_final(struct hasher *h, uint8_t *out) {
+    switch (h->alg) {
+    case CHKSUMFILE_SHA1:
+        return SHA1_Final(out, &h->u.sha) ? 0 : -1;
+    case CHKSUMFILE_XXH3: {
+        // Most significant byte first, so the string is the usual one
+        uint64_t v = xxh3_digest(&h->u.xxh3);
+        for (int i = 7; i >= 0; i--, v >>= 8) {
+            out[i] = v;
+        }
+        return 0;
+    }
+    case CHKSUMFILE_BLAKE3:
+        blake3_final(&h->u.blake3, out);
+        return 0;
+    }
+    return -1;
+}
+
 int chksumfile_byinumber(struct unixfilesystem *fs, int inumber, void *chksum) {
-    SHA_CTX shactx;
-    if (!SHA1_Init(&shactx)) {
-        // An error occurred initializing the SHA1 context.
+    return chksumfile_byinumber_alg(fs, inumber, CHKSUMFILE_SHA1, chksum);
+}
+
+int chksumfile_byinumber_alg(struct unixfilesystem *fs, int inumber,
+        enum chksumfile_alg alg, void *chksum) {
+    struct hasher h;
+    if (hasher_init(&h, alg) < 0) {
+        // An error occurred initializing the hash context.
         return -1;
     }
 
-    struct inode in;
-    int err = inode_iget(fs, inumber, &in);
+    struct filecursor fc;
+    int err = file_open(fs, inumber, &fc);
     if (err < 0) {
         return err;
     }
 
-    if (!(in.i_mode & IALLOC)) {
+    if (!(fc.in.i_mode & IALLOC)) {
         // The inode isn't allocated, so we can't hash it.
         return -1;
     }
 
-    int size = inode_getsize(&in);
-    for (int offset = 0; offset < size; offset += DISKIMG_SECTOR_SIZE) {
-        char buf[DISKIMG_SECTOR_SIZE];
-        int bno = offset/DISKIMG_SECTOR_SIZE;
-
-        int bytesMoved = file_getblock(fs, inumber, bno, buf);
+    // Read the file in order, several blocks at a time when they are
+    // contiguous on disk, and hash them in place when the image is
+    // mapped.
+    for (;;) {
+        const void *buf;
+        int bytesMoved = file_nextblocks(&fc, &buf);
         if (bytesMoved < 0)
             return -1;
+        if (bytesMoved == 0)
+            break;
 
-        if (!SHA1_Update(&shactx, buf, bytesMoved))
+        if (hasher_update(&h, buf, bytesMoved) < 0)
             return -1;
     }
 
-    if (!SHA1_Final(chksum, &shactx))
+    if (hasher_final(&h, chksum) < 0)
         return -1;
 
-    return SHA_DIGEST_LENGTH;
+    return algLengths[alg];
 }
 
 int chksumfile_bypathname(struct unixfilesystem *fs, const char *pathname,
         void *chksum) {
+    return chksumfile_bypathname_alg(fs, pathname, CHKSUMFILE_SHA1, chksum);
+}
+
+int chksumfile_bypathname_alg(struct unixfilesystem *fs, const char *pathname,
+        enum chksumfile_alg alg, void *chksum) {
     int inumber = pathname_lookup(fs, pathname);
     if (inumber < 0) {
         return inumber;
     }
 
-    return chksumfile_byinumber(fs, inumber, chksum);
+    return chksumfile_byinumber_alg(fs, inumber, alg, chksum);
+}
+
+int chksumfile_length(enum chksumfile_alg alg) {
+    return algLengths[alg];
+}
+
+const char *chksumfile_algname(enum chksumfile_alg alg) {
+    return algNames[alg];
+}
+
+int chksumfile_parsealg(const char *name, enum chksumfile_alg *alg) {
+    for (int i = 0; i < NUM_ALGS; i++) {
+        if (strcmp(name, algNames[i]) == 0) {
+            *alg = i;
+            return 0;
+        }
+    }
+    return -1;
 }
 
 void chksumfile_cvt2string(void *chksum, char *outstring) {
-    uint8_t *c = (uint8_t *) chksum;
+    chksumfile_cvt2string_len(chksum, SHA_DIGEST_LENGTH, outstring);
+}
 
-    for (int i = 0; i < SHA_DIGEST_LENGTH; i++) {
+void chksumfile_cvt2string_len(const void *chksum, int len, char *outstring) {
+    const uint8_t *c = chksum;
+
+    for (int i = 0; i < len; i++) {
         sprintf(outstring + 2 * i, "%02x", c[i]);
     }
 }
 
 int chksumfile_compare(void *chksum1, void *chksum2) {
-    uint8_t *c1 = (uint8_t *) chksum1;
-    uint8_t *c2 = (uint8_t *) chksum2;
+    return chksumfile_compare_len(chksum1, chksum2, SHA_DIGEST_LENGTH);
+}
+
+int chksumfile_compare_len(const void *chksum1, const void *chksum2, int len) {
+    const uint8_t *c1 = chksum1;
+    const uint8_t *c2 = chksum2;
 
-    for (int i = 0; i < SHA_DIGEST_LENGTH; i++) {
+    for (int i = 0; i < len; i++) {
         if (c1[i] != c2[i]) return 0;
     }
     return 1;
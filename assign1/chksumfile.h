@@ -3,18 +3,31 @@
 
 #include "unixfilesystem.h"
 
-#define CHKSUMFILE_SIZE 20   
+// Big enough for the checksum of any algorithm below.
+#define CHKSUMFILE_SIZE 32
 #define CHKSUMFILE_STRINGSIZE ((2*CHKSUMFILE_SIZE)+1)
 
 /**
- * Computes the checksum of a inumber.  Assumes chksum arguments points to a
+ * The hash functions a checksum can be computed with.  SHA-1 is the
+ * default and the only one the plain chksumfile_ functions use; XXH3
+ * (64-bit, not cryptographic) and BLAKE3 are much faster when only
+ * comparing contents.
+ */
+enum chksumfile_alg {
+    CHKSUMFILE_SHA1,            // 20 bytes
+    CHKSUMFILE_XXH3,            // 8 bytes, most significant first
+    CHKSUMFILE_BLAKE3,          // 32 bytes
+};
+
+/**
+ * Computes the SHA-1 checksum of a inumber.  Assumes chksum arguments points to a
  * CHKSUMFILE_SIZE byte array.  Returns the length of the checksum, or -1 if
  * it encounters an error.
  */
 int chksumfile_byinumber(struct unixfilesystem *fs, int inumber, void *chksum);
 
 /**
- * Compute the checksum of the specified pathname.  Assumes chksum points to a
+ * Compute the SHA-1 checksum of the specified pathname.  Assumes chksum points to a
  * CHKSUMFILE_SIZE byte array. Returns the length of the checksum or -1 if
  * it encounters an error.
  */
@@ -22,14 +35,51 @@ int chksumfile_bypathname(struct unixfilesystem *fs, const char *pathname,
 	void *chksum);
 
 /**
- * Converts a checksum into a string that can be printed.  Assumes
+ * Like chksumfile_byinumber and chksumfile_bypathname, but hash with
+ * alg.  Return the length of the checksum, chksumfile_length(alg), or
+ * -1 on error.
+ */
+int chksumfile_byinumber_alg(struct unixfilesystem *fs, int inumber,
+        enum chksumfile_alg alg, void *chksum);
+int chksumfile_bypathname_alg(struct unixfilesystem *fs, const char *pathname,
+        enum chksumfile_alg alg, void *chksum);
+
+/**
+ * Returns the length in bytes of a checksum computed with alg.
+ */
+int chksumfile_length(enum chksumfile_alg alg);
+
+/**
+ * Returns the name of alg ("sha1", "xxh3" or "blake3").
+ */
+const char *chksumfile_algname(enum chksumfile_alg alg);
+
+/**
+ * Looks up an algorithm by the name chksumfile_algname gives it.
+ * Returns 0 and stores it at *alg, or -1 if there is no such
+ * algorithm.
+ */
+int chksumfile_parsealg(const char *name, enum chksumfile_alg *alg);
+
+/**
+ * Converts a SHA-1 checksum into a string that can be printed.  Assumes
  * that outstring is CHKSUMFILE_STRINGSIZE in size.
  */
 void chksumfile_cvt2string(void *chksum, char *outstring);
 
 /**
- * Compares two checksums, returning 1 if they're the same and 0 otherwise.
+ * Like chksumfile_cvt2string, for a checksum of len bytes.
+ */
+void chksumfile_cvt2string_len(const void *chksum, int len, char *outstring);
+
+/**
+ * Compares two SHA-1 checksums, returning 1 if they're the same and 0 otherwise.
  */
 int chksumfile_compare(void *chksum1, void *chksum2);
 
+/**
+ * Like chksumfile_compare, for checksums of len bytes.
+ */
+int chksumfile_compare_len(const void *chksum1, const void *chksum2, int len);
+
 #endif // _CHKSUMFILE_H_
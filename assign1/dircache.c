@@ -0,0 +1,298 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dircache.h"
+
+#define NONE (-1)
+
+// A directory's entries with an open-addressed name index over them.
+struct dirindex {
+    int inumber;
+    int nentries;
+    struct direntv6 *entries;
+    int nbuckets;               // A power of two, at least 2 * nentries
+    int *buckets;               // Entry index, or NONE
+    struct dirindex *hnext;     // Next directory in the same bucket
+};
+
+struct pathent {
+    char *path;                 // Not NUL-terminated
+    int len;
+    int inumber;
+    struct pathent *hnext;      // Next path in the same bucket
+};
+
+// mu guards everything.  Both tables chain and double when they hold
+// more entries than buckets.
+struct dircache {
+    pthread_mutex_t mu;
+    int ndirs;
+    int ndirBuckets;            // A power of two
+    struct dirindex **dirs;
+    int npaths;
+    int npathBuckets;           // A power of two
+    struct pathent **paths;
+    struct dircache_stats stats;
+};
+
+// Length of name as directory_findname compares it
+static int namelen(const char *name) {
+    return strnlen(name, MAX_COMPONENT_LENGTH);
+}
+
+// FNV-1a
+static unsigned hash_bytes(const char *s, int len) {
+    unsigned h = 2166136261u;
+    for (int i = 0; i < len; i++) {
+        h = (h ^ (uint8_t) s[i]) * 16777619u;
+    }
+    return h;
+}
+
+static unsigned hash_inumber(int inumber) {
+    return (unsigned) inumber * 2654435761u;
+}
+
+struct dircache *dircache_create(void) {
+    struct dircache *dc = calloc(1, sizeof(struct dircache));
+    if (dc == NULL) {
+        return NULL;
+    }
+    pthread_mutex_init(&dc->mu, NULL);
+    dc->ndirBuckets = 64;
+    dc->npathBuckets = 256;
+    dc->dirs = calloc(dc->ndirBuckets, sizeof(struct dirindex *));
+    dc->paths = calloc(dc->npathBuckets, sizeof(struct pathent *));
+    if (dc->dirs == NULL || dc->paths == NULL) {
+        dircache_free(dc);
+        return NULL;
+    }
+    return dc;
+}
+
+static void free_dir(struct dirindex *d) {
+    free(d->entries);
+    free(d->buckets);
+    free(d);
+}
+
+void dircache_free(struct dircache *dc) {
+    if (dc == NULL) {
+        return;
+    }
+    for (int b = 0; dc->dirs && b < dc->ndirBuckets; b++) {
+        for (struct dirindex *d = dc->dirs[b], *next; d != NULL; d = next) {
+            next = d->hnext;
+            free_dir(d);
+        }
+    }
+    for (int b = 0; dc->paths && b < dc->npathBuckets; b++) {
+        for (struct pathent *p = dc->paths[b], *next; p != NULL; p = next) {
+            next = p->hnext;
+            free(p->path);
+            free(p);
+        }
+    }
+    pthread_mutex_destroy(&dc->mu);
+    free(dc->dirs);
+    free(dc->paths);
+    free(dc);
+}
+
+// Caller holds mu.
+static struct dirindex *find_dir(const struct dircache *dc, int inumber) {
+    struct dirindex *d = dc->dirs[hash_inumber(inumber) & (dc->ndirBuckets - 1)];
+    while (d != NULL && d->inumber != inumber) {
+        d = d->hnext;
+    }
+    return d;
+}
+
+// Index of the first entry of d named name (len characters), or NONE.
+static int find_entry(const struct dirindex *d, const char *name, int len) {
+    int mask = d->nbuckets - 1;
+    for (int b = hash_bytes(name, len) & mask; d->buckets[b] != NONE;
+         b = (b + 1) & mask) {
+        const char *entname = d->entries[d->buckets[b]].d_name;
+        if (namelen(entname) == len && memcmp(entname, name, len) == 0) {
+            return d->buckets[b];
+        }
+    }
+    return NONE;
+}
+
+int dircache_findname(struct dircache *dc, int dirinumber, const char *name,
+        struct direntv6 *dirEnt) {
+    pthread_mutex_lock(&dc->mu);
+    struct dirindex *d = find_dir(dc, dirinumber);
+    if (d == NULL) {
+        pthread_mutex_unlock(&dc->mu);
+        return -1;
+    }
+    dc->stats.dirHits++;
+    int i = find_entry(d, name, namelen(name));
+    if (i != NONE) {
+        *dirEnt = d->entries[i];
+    }
+    pthread_mutex_unlock(&dc->mu);
+    return i != NONE;
+}
+
+// Caller holds mu.
+static void grow_dirs(struct dircache *dc) {
+    int n = 2 * dc->ndirBuckets;
+    struct dirindex **dirs = calloc(n, sizeof(struct dirindex *));
+    if (dirs == NULL) {
+        return;                 // Keep the longer chains
+    }
+    for (int b = 0; b < dc->ndirBuckets; b++) {
+        for (struct dirindex *d = dc->dirs[b], *next; d != NULL; d = next) {
+            next = d->hnext;
+            int nb = hash_inumber(d->inumber) & (n - 1);
+            d->hnext = dirs[nb];
+            dirs[nb] = d;
+        }
+    }
+    free(dc->dirs);
+    dc->dirs = dirs;
+    dc->ndirBuckets = n;
+}
+
+int dircache_adddir(struct dircache *dc, int dirinumber,
+        const struct direntv6 *entries, int n) {
+    // Build the index before taking the lock
+    struct dirindex *d = calloc(1, sizeof(struct dirindex));
+    if (d == NULL) {
+        return -1;
+    }
+    d->inumber = dirinumber;
+    d->nentries = n;
+    d->nbuckets = 1;
+    while (d->nbuckets < 2 * n) {
+        d->nbuckets <<= 1;
+    }
+    // One spare entry, so an empty directory doesn't ask for zero bytes
+    d->entries = malloc((n + 1) * sizeof(struct direntv6));
+    d->buckets = malloc(d->nbuckets * sizeof(int));
+    if (d->entries == NULL || d->buckets == NULL) {
+        free_dir(d);
+        return -1;
+    }
+    memcpy(d->entries, entries, n * sizeof(struct direntv6));
+    for (int b = 0; b < d->nbuckets; b++) {
+        d->buckets[b] = NONE;
+    }
+    int mask = d->nbuckets - 1;
+    for (int i = 0; i < n; i++) {
+        const char *name = entries[i].d_name;
+        int len = namelen(name);
+        if (find_entry(d, name, len) != NONE) {
+            continue;           // Lookups find the first of duplicates
+        }
+        int b = hash_bytes(name, len) & mask;
+        while (d->buckets[b] != NONE) {
+            b = (b + 1) & mask;
+        }
+        d->buckets[b] = i;
+    }
+
+    pthread_mutex_lock(&dc->mu);
+    dc->stats.dirMisses++;
+    // Another thread may have indexed it meanwhile
+    if (find_dir(dc, dirinumber) != NULL) {
+        pthread_mutex_unlock(&dc->mu);
+        free_dir(d);
+        return 0;
+    }
+    if (dc->ndirs >= dc->ndirBuckets) {
+        grow_dirs(dc);
+    }
+    int b = hash_inumber(dirinumber) & (dc->ndirBuckets - 1);
+    d->hnext = dc->dirs[b];
+    dc->dirs[b] = d;
+    dc->ndirs++;
+    pthread_mutex_unlock(&dc->mu);
+    return 0;
+}
+
+// Caller holds mu.
+static struct pathent *find_path(const struct dircache *dc, const char *path,
+        int len) {
+    struct pathent *p =
+        dc->paths[hash_bytes(path, len) & (dc->npathBuckets - 1)];
+    while (p != NULL && !(p->len == len && memcmp(p->path, path, len) == 0)) {
+        p = p->hnext;
+    }
+    return p;
+}
+
+int dircache_getpath(struct dircache *dc, const char *path, int len) {
+    pthread_mutex_lock(&dc->mu);
+    struct pathent *p = find_path(dc, path, len);
+    if (p != NULL) {
+        dc->stats.pathHits++;
+    }
+    int inumber = p != NULL ? p->inumber : -1;
+    pthread_mutex_unlock(&dc->mu);
+    return inumber;
+}
+
+// Caller holds mu.
+static void grow_paths(struct dircache *dc) {
+    int n = 2 * dc->npathBuckets;
+    struct pathent **paths = calloc(n, sizeof(struct pathent *));
+    if (paths == NULL) {
+        return;                 // Keep the longer chains
+    }
+    for (int b = 0; b < dc->npathBuckets; b++) {
+        for (struct pathent *p = dc->paths[b], *next; p != NULL; p = next) {
+            next = p->hnext;
+            int nb = hash_bytes(p->path, p->len) & (n - 1);
+            p->hnext = paths[nb];
+            paths[nb] = p;
+        }
+    }
+    free(dc->paths);
+    dc->paths = paths;
+    dc->npathBuckets = n;
+}
+
+void dircache_addpath(struct dircache *dc, const char *path, int len,
+        int inumber) {
+    struct pathent *p = malloc(sizeof(struct pathent));
+    char *copy = malloc(len + 1);
+    if (p == NULL || copy == NULL) {
+        free(p);
+        free(copy);
+        return;                 // Just not remembered
+    }
+    memcpy(copy, path, len);
+    p->path = copy;
+    p->len = len;
+    p->inumber = inumber;
+
+    pthread_mutex_lock(&dc->mu);
+    dc->stats.pathMisses++;
+    if (find_path(dc, path, len) != NULL) {
+        pthread_mutex_unlock(&dc->mu);
+        free(copy);
+        free(p);
+        return;
+    }
+    if (dc->npaths >= dc->npathBuckets) {
+        grow_paths(dc);
+    }
+    int b = hash_bytes(path, len) & (dc->npathBuckets - 1);
+    p->hnext = dc->paths[b];
+    dc->paths[b] = p;
+    dc->npaths++;
+    pthread_mutex_unlock(&dc->mu);
+}
+
+struct dircache_stats dircache_getstats(struct dircache *dc) {
+    pthread_mutex_lock(&dc->mu);
+    struct dircache_stats st = dc->stats;
+    pthread_mutex_unlock(&dc->mu);
+    return st;
+}
@@ -0,0 +1,68 @@
+#ifndef _DIRCACHE_H_
+#define _DIRCACHE_H_
+
+#include "direntv6.h"
+
+/**
+ * Caches of directory contents and of resolved pathnames, kept for the
+ * life of a struct unixfilesystem.  Each directory is indexed by name
+ * the first time it is searched, and each pathname that resolves is
+ * remembered, so repeated lookups don't rescan the directories.  Like
+ * the sector cache this assumes the image never changes.  All calls
+ * may be made from several threads at once.
+ */
+struct dircache;
+
+struct dircache_stats {
+    long dirHits;       // Names looked up in an indexed directory
+    long dirMisses;     // Directories scanned to build an index
+    long pathHits;      // Pathnames (or prefixes) found resolved
+    long pathMisses;    // Pathnames (or prefixes) resolved and added
+};
+
+/**
+ * Allocates an empty cache.  Returns NULL if out of memory.
+ */
+struct dircache *dircache_create(void);
+
+/**
+ * Frees the cache and everything in it.
+ */
+void dircache_free(struct dircache *dc);
+
+/**
+ * Looks up name in directory dirinumber, matching the way
+ * directory_findname does (the first entry whose name equals name in
+ * its first MAX_COMPONENT_LENGTH characters).  Returns 1 and stores
+ * the entry at *dirEnt if found, 0 if not, or -1 if the directory
+ * hasn't been indexed yet.
+ */
+int dircache_findname(struct dircache *dc, int dirinumber, const char *name,
+        struct direntv6 *dirEnt);
+
+/**
+ * Indexes the n entries of directory dirinumber, in directory order.
+ * Does nothing if the directory is already indexed.  Returns 0, or -1
+ * if out of memory.
+ */
+int dircache_adddir(struct dircache *dc, int dirinumber,
+        const struct direntv6 *entries, int n);
+
+/**
+ * Returns the inumber remembered for the first len characters of
+ * path, or -1 if there is none.
+ */
+int dircache_getpath(struct dircache *dc, const char *path, int len);
+
+/**
+ * Remembers that the first len characters of path resolve to inumber.
+ */
+void dircache_addpath(struct dircache *dc, const char *path, int len,
+        int inumber);
+
+/**
+ * Returns the hit and miss counts since the cache was created.
+ */
+struct dircache_stats dircache_getstats(struct dircache *dc);
+
+#endif // _DIRCACHE_H_
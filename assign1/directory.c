@@ -2,29 +2,31 @@
 #include "inode.h"
 #include "diskimg.h"
 #include "file.h"
+#include "dircache.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
-
-int directory_findname(const struct unixfilesystem *fs, const char *name,
-                       int dirinumber, struct direntv6 *dirEnt) {
-    // Remove the following placeholder implementation and replace
-    // with your own implementation.
-
-    struct inode node;
-    int sign = inode_iget(fs, dirinumber, &node);
-    if (sign == -1) {
+// Searches the directory entry by entry, without the cache.
+static int scan_directory(const struct unixfilesystem *fs, const char *name,
+                          int dirinumber, struct direntv6 *dirEnt) {
+    // Scan the directory a run of blocks at a time, in place when the
+    // image is mapped.
+    struct filecursor fc;
+    if (file_open(fs, dirinumber, &fc) == -1) {
             return -1;
     }
-    int sz = inode_getsize(&node);
-    int max_index = (sz - 1) / DISKIMG_SECTOR_SIZE;
 
-    struct direntv6 tempEnt[DISKIMG_SECTOR_SIZE / sizeof(struct direntv6)];
-    for (int i = 0; i < max_index + 1; i++) {
-        int blksz = file_getblock(fs, dirinumber, i, tempEnt);
+    for (;;) {
+        const void *data;
+        int blksz = file_nextblocks(&fc, &data);
         if (blksz == -1) {
             return -1;
         }
+        if (blksz == 0) {
+            break;
+        }
+        const struct direntv6 *tempEnt = data;
         int num = blksz / sizeof(struct direntv6);
         for (int j = 0; j < num; j++) {
             if (!strncmp(tempEnt[j].d_name, name, MAX_COMPONENT_LENGTH)) {
@@ -35,3 +37,52 @@ int directory_findname(const struct unixfilesystem *fs, const char *name,
     }
     return -1;
 }
+
+// Reads every entry of the directory and hands them to the directory
+// cache to index.  Returns 0, or -1 on a disk error, if out of memory
+// or if dirinumber isn't a directory (searching a file's data as
+// entries still works, by scanning, but isn't worth caching).
+static int index_directory(const struct unixfilesystem *fs, int dirinumber) {
+    struct filecursor fc;
+    if (file_open(fs, dirinumber, &fc) == -1 ||
+        (fc.in.i_mode & IFMT) != IFDIR) {
+        return -1;
+    }
+    int max = fc.size / sizeof(struct direntv6);
+    struct direntv6 *entries = malloc((max + 1) * sizeof(struct direntv6));
+    if (entries == NULL) {
+        return -1;
+    }
+    int n = 0;
+    for (;;) {
+        const void *data;
+        int blksz = file_nextblocks(&fc, &data);
+        if (blksz == -1) {
+            free(entries);
+            return -1;
+        }
+        if (blksz == 0) {
+            break;
+        }
+        int num = blksz / sizeof(struct direntv6);
+        memcpy(entries + n, data, num * sizeof(struct direntv6));
+        n += num;
+    }
+    int err = dircache_adddir(fs->dircache, dirinumber, entries, n);
+    free(entries);
+    return err;
+}
+
+int directory_findname(const struct unixfilesystem *fs, const char *name,
+                       int dirinumber, struct direntv6 *dirEnt) {
+    // The first search of a directory indexes it; later ones are a
+    // hash lookup.
+    int found = dircache_findname(fs->dircache, dirinumber, name, dirEnt);
+    if (found == -1) {
+        if (index_directory(fs, dirinumber) == -1) {
+            return scan_directory(fs, name, dirinumber, dirEnt);
+        }
+        found = dircache_findname(fs->dircache, dirinumber, name, dirEnt);
+    }
+    return found == 1 ? 0 : -1;
+}
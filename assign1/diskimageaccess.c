@@ -5,6 +5,7 @@
 #include <string.h>
 #include <getopt.h>
 #include <stdbool.h>
+#include <pthread.h>
 
 #include "diskimg.h"
 #include "unixfilesystem.h"
@@ -13,6 +14,8 @@
 #include "directory.h"
 #include "pathname.h"
 #include "chksumfile.h"
+#include "sectorcache.h"
+#include "dircache.h"
 
 #define min(a, b) (((a) < (b)) ? (a) : (b))
 #define max(a, b) (((a) > (b)) ? (a) : (b))
@@ -24,10 +27,18 @@ int mdumpFlag = 0; // m is shadowed by both b and i
 int pdumpFlag = 0;
 int ddumpFlag = 0;
 int ldumpFlag = 0;
+int statsFlag = 0;
+int mmapFlag = 0;
+int numThreads = 1;
+enum chksumfile_alg hashAlg = CHKSUMFILE_SHA1;
+int cacheSectors = UNIXFILESYSTEM_CACHE_SECTORS;
 
 static void PrintDirectory(struct unixfilesystem *fs,  char *pathname);
 static void DumpInodeChecksum(struct unixfilesystem *fs, FILE *f, bool incMappings, bool incHashes);
+static void DumpInode(struct unixfilesystem *fs, FILE *f, int inumber, struct inode in, bool incMappings, bool incHashes);
 static void DumpPathnameChecksum(struct unixfilesystem *fs, FILE *f);
+static void DumpInodeChecksumParallel(struct unixfilesystem *fs, FILE *f);
+static void DumpPathnameChecksumParallel(struct unixfilesystem *fs, FILE *f);
 static void TestDeletedFilenames(struct unixfilesystem *fs, FILE *f);
 static void TestLongFilenames(struct unixfilesystem *fs, FILE *f);
 static void PrintUsageAndExit(char *progname);
@@ -35,7 +46,7 @@ static int GetDirEntries(struct unixfilesystem *fs, int inumber, struct direntv6
 
 int main(int argc, char *argv[]) {
   int opt;
-  while ((opt = getopt(argc, argv, "imqpbhdl")) != -1) {
+  while ((opt = getopt(argc, argv, "imqpbhdlc:sMt:H:")) != -1) {
     switch (opt) {
     case 'q':
       quietFlag = 1;
@@ -58,6 +69,23 @@ int main(int argc, char *argv[]) {
     case 'l':
       ldumpFlag = 1;
       break;
+    case 'c':
+      cacheSectors = atoi(optarg);
+      if (cacheSectors < 0) PrintUsageAndExit(argv[0]);
+      break;
+    case 's':
+      statsFlag = 1;
+      break;
+    case 'M':
+      mmapFlag = 1;
+      break;
+    case 't':
+      numThreads = atoi(optarg);
+      if (numThreads < 1) PrintUsageAndExit(argv[0]);
+      break;
+    case 'H':
+      if (chksumfile_parsealg(optarg, &hashAlg) < 0) PrintUsageAndExit(argv[0]);
+      break;
     case 'h':
       PrintUsageAndExit(argv[0]);
     default: 
@@ -77,7 +105,8 @@ int main(int argc, char *argv[]) {
     exit(EXIT_FAILURE);
   }
 
-  struct unixfilesystem *fs = unixfilesystem_init(fd);
+  struct unixfilesystem *fs = mmapFlag ? unixfilesystem_init_mmap(fd)
+                                       : unixfilesystem_init_cache(fd, cacheSectors);
   if (!fs) {
     fprintf(stderr, "Failed to initialize unix filesystem\n");
     exit(EXIT_FAILURE);
@@ -90,7 +119,7 @@ int main(int argc, char *argv[]) {
       // Cast the result of diskimg_close to void so the compiler doesn't
       // complain that we're ignoring its return value.
       (void) diskimg_close(fd);
-      free(fs);
+      unixfilesystem_free(fs);
       exit(EXIT_FAILURE);
     }
     printf("Disk %s is %d bytes (%d KB)\n", argv[1],  disksize, disksize/1024);
@@ -100,16 +129,33 @@ int main(int argc, char *argv[]) {
     printf("Superblock s_ninode %d\n",(int)fs->superblock.s_ninode);
   }
 
-  if (idumpFlag) DumpInodeChecksum(fs, stdout, false, true);
+  if (idumpFlag && numThreads > 1) DumpInodeChecksumParallel(fs, stdout);
+  else if (idumpFlag) DumpInodeChecksum(fs, stdout, false, true);
   else if (mdumpFlag) DumpInodeChecksum(fs, stdout, true, false);
   else if (bdumpFlag) DumpInodeChecksum(fs, stdout, false, false);
-  if (pdumpFlag) DumpPathnameChecksum(fs, stdout);
+  if (pdumpFlag && numThreads > 1) DumpPathnameChecksumParallel(fs, stdout);
+  else if (pdumpFlag) DumpPathnameChecksum(fs, stdout);
   if (ddumpFlag) TestDeletedFilenames(fs, stdout);
   if (ldumpFlag) TestLongFilenames(fs, stdout);
+
+  if (statsFlag) {
+    // stderr, so the output checked by the grading script is unchanged
+    struct sectorcache_stats st = sectorcache_getstats(fs->cache);
+    if (mmapFlag)
+      fprintf(stderr, "Disk image mapped (%zu bytes); no sector reads\n",
+              fs->mapsize);
+    else fprintf(stderr, "Sector cache (%d sectors): %ld hits, %ld misses (disk reads)\n",
+            cacheSectors, st.hits, st.misses);
+    struct dircache_stats ds = dircache_getstats(fs->dircache);
+    fprintf(stderr, "Directory cache: %ld name lookups, %ld directories indexed\n",
+            ds.dirHits, ds.dirMisses);
+    fprintf(stderr, "Path cache: %ld hits, %ld paths added\n",
+            ds.pathHits, ds.pathMisses);
+  }
   
   int err = diskimg_close(fd);
   if (err < 0) fprintf(stderr, "Error closing %s\n", argv[1]);
-  free(fs);
+  unixfilesystem_free(fs);
   exit(EXIT_SUCCESS);
   return 0;
 }
@@ -121,88 +167,102 @@ int main(int argc, char *argv[]) {
  * format.
  */
 static void DumpInodeChecksum(struct unixfilesystem *fs, FILE *f, bool incMappings, bool incHashes) {
-  for (int inumber = 1; inumber <= fs->superblock.s_isize*16; inumber++) {
-    struct inode in;
-    if (inode_iget(fs, inumber, &in) < 0) {
-      fprintf(stderr,"Can't read inode %d \n", inumber);
+  if (!incMappings && !incHashes) {
+    // -b tests inode_iget itself, so fetch the inodes one at a time
+    for (int inumber = 1; inumber <= fs->superblock.s_isize*16; inumber++) {
+      struct inode in;
+      if (inode_iget(fs, inumber, &in) < 0) {
+        fprintf(stderr,"Can't read inode %d \n", inumber);
+        return;
+      }
+      if ((in.i_mode & IALLOC) == 0) {
+        // Skip this inode if it's not allocated.
+        continue;
+      }
+      DumpInode(fs, f, inumber, in, incMappings, incHashes);
+    }
+    return;
+  }
+
+  // One pass over the inode area, allocated inodes only
+  struct inodescan scan;
+  inode_scan_start(fs, &scan, 1);
+  for (;;) {
+    int inumbers[INODE_SCAN_BATCH];
+    struct inode inodes[INODE_SCAN_BATCH];
+    int n = inode_scan_next(&scan, inumbers, inodes);
+    if (n < 0) {
+      fprintf(stderr,"Can't read inode %d \n", scan.next);
       return;
     }
-    if ((in.i_mode & IALLOC) == 0) {
-      // Skip this inode if it's not allocated.
-      continue;
+    if (n == 0) return;
+    for (int i = 0; i < n; i++) {
+      DumpInode(fs, f, inumbers[i], inodes[i], incMappings, incHashes);
+    }
+  }
+}
+
+/**
+ * Output one allocated inode for DumpInodeChecksum.
+ */
+static void DumpInode(struct unixfilesystem *fs, FILE *f, int inumber, struct inode in, bool incMappings, bool incHashes) {
+  int size = inode_getsize(&in);
+  fprintf(f, "Inode %d mode 0x%x size %d", inumber, in.i_mode, size);
+  if (incHashes) {
+    char chksum[CHKSUMFILE_SIZE];
+    if (chksumfile_byinumber_alg(fs, inumber, hashAlg, chksum) < 0) {
+      fprintf(stderr, "Inode %d can't compute chksum\n", inumber);
+      return;
     }
     
-    int size = inode_getsize(&in);
-    fprintf(f, "Inode %d mode 0x%x size %d", inumber, in.i_mode, size);
-    if (incHashes) {
-      char chksum[CHKSUMFILE_SIZE];
-      if (chksumfile_byinumber(fs, inumber, chksum) < 0) {
-        fprintf(stderr, "Inode %d can't compute chksum\n", inumber);
-        continue;
-      }
-      
-      char chksumstring[CHKSUMFILE_STRINGSIZE];
-      chksumfile_cvt2string(chksum, chksumstring);
-      fprintf(f, " checksum %s", chksumstring);
+    char chksumstring[CHKSUMFILE_STRINGSIZE];
+    chksumfile_cvt2string_len(chksum, chksumfile_length(hashAlg), chksumstring);
+    fprintf(f, " checksum %s", chksumstring);
+  }
+  fprintf(f, "\n");
+  if (incMappings && size > 0) {
+    int numMappings = (size + DISKIMG_SECTOR_SIZE - 1)/DISKIMG_SECTOR_SIZE;
+    fprintf(f, "Inode %d: Leading block index to physical block number mappings:\n", inumber);
+    for (int blockIndex = 0; blockIndex < min(10, numMappings); blockIndex++) {
+      fprintf(f, "  %d -> %d\n", blockIndex, inode_indexlookup(fs, &in, blockIndex));
     }
-    fprintf(f, "\n");
-    if (incMappings && size > 0) {
-      int numMappings = (size + DISKIMG_SECTOR_SIZE - 1)/DISKIMG_SECTOR_SIZE;
-      fprintf(f, "Inode %d: Leading block index to physical block number mappings:\n", inumber);
-      for (int blockIndex = 0; blockIndex < min(10, numMappings); blockIndex++) {
-        fprintf(f, "  %d -> %d\n", blockIndex, inode_indexlookup(fs, &in, blockIndex));
-      }
-      if (numMappings > 10 && numMappings <= 20) {
-        fprintf(f, "Inode %d: Remaining block index to physical block number mappings:\n", inumber);
-      } else if (numMappings > 20) {
-        fprintf(f, "Inode %d: Final 10 block index to physical block number mappings:\n", inumber);
-      } else {
-        fprintf(f, "Inode %d: That's everything! It's a relatively small file!\n", inumber);
-      }
-      for (int blockIndex = max(10, numMappings - 10); blockIndex < numMappings; blockIndex++) {
-        fprintf(f, "  %d -> %d\n", blockIndex, inode_indexlookup(fs, &in, blockIndex));
-      }
+    if (numMappings > 10 && numMappings <= 20) {
+      fprintf(f, "Inode %d: Remaining block index to physical block number mappings:\n", inumber);
+    } else if (numMappings > 20) {
+      fprintf(f, "Inode %d: Final 10 block index to physical block number mappings:\n", inumber);
+    } else {
+      fprintf(f, "Inode %d: That's everything! It's a relatively small file!\n", inumber);
+    }
+    for (int blockIndex = max(10, numMappings - 10); blockIndex < numMappings; blockIndex++) {
+      fprintf(f, "  %d -> %d\n", blockIndex, inode_indexlookup(fs, &in, blockIndex));
     }
-    
   }
 }
 
 /**
- * Output to the specified file the checksum of the specified pathname and
- * inode as well as all its children if it is a directory.
- *
- * This is used by the grading script, so be careful not to change its output
- * format.
+ * Called by WalkPathAndChildren for each path, with in NULL if its inode
+ * can't be read.  Returns the parent to pass to the path's children, or
+ * -1 to skip them.
  */
-static void DumpPathAndChildren(struct unixfilesystem *fs, const char *pathname, int inumber, FILE *f) {
+typedef int (*PathVisitor)(struct unixfilesystem *fs, const char *pathname,
+                           int inumber, struct inode *in, int parent,
+                           void *arg);
+
+/**
+ * Visits pathname and, if it is a directory, everything under it, in
+ * directory order.
+ */
+static void WalkPathAndChildren(struct unixfilesystem *fs, const char *pathname,
+                                int inumber, int parent, PathVisitor visit,
+                                void *arg) {
   struct inode in;
   if (inode_iget(fs, inumber, &in) < 0) {
-    fprintf(stderr,"Can't read inode %d \n", inumber);
+    visit(fs, pathname, inumber, NULL, parent, arg);
     return;
   }
   assert(in.i_mode & IALLOC);
-
-  char chksum1[CHKSUMFILE_SIZE];
-  if (chksumfile_byinumber(fs, inumber, chksum1) < 0) {
-    fprintf(stderr,"Can't checksum inode %d path %s\n", inumber, pathname);
-    return;
-  }
-
-  char chksum2[CHKSUMFILE_SIZE];
-  if (chksumfile_bypathname(fs, pathname, chksum2) < 0) {
-    fprintf(stderr,"Can't checksum inode %d path %s\n", inumber, pathname);
-    return;
-  }
-
-  if (!chksumfile_compare(chksum1, chksum2)) {
-    fprintf(stderr,"Pathname checksum of %s differs from inode %d\n", pathname, inumber);
-    return;
-  }
-
-  char chksumstring[CHKSUMFILE_STRINGSIZE];
-  chksumfile_cvt2string(chksum2, chksumstring);
-  int size = inode_getsize(&in);
-  fprintf(f, "Path %s %d mode 0x%x size %d checksum %s\n",pathname,inumber,in.i_mode, size, chksumstring);
+  int self = visit(fs, pathname, inumber, &in, parent, arg);
+  if (self < 0) return;
 
   if (pathname[1] == 0) {
     /* pathame == "/" */
@@ -233,18 +293,259 @@ static void DumpPathAndChildren(struct unixfilesystem *fs, const char *pathname,
 
         char nextpath[MAXPATH];
         sprintf(nextpath, "%s/%s",pathname, d_name);
-        DumpPathAndChildren(fs, nextpath,  direntries[i].d_inumber, f);
+        WalkPathAndChildren(fs, nextpath, direntries[i].d_inumber, self,
+                            visit, arg);
       }
   }
 }
 
+/**
+ * Output to the specified file (arg) the checksum of the specified
+ * pathname and inode.  Its children are skipped if that fails.
+ *
+ * This is used by the grading script, so be careful not to change its output
+ * format.
+ */
+static int DumpPath(struct unixfilesystem *fs, const char *pathname, int inumber,
+                    struct inode *in, int parent, void *arg) {
+  FILE *f = arg;
+  if (in == NULL) {
+    fprintf(stderr,"Can't read inode %d \n", inumber);
+    return -1;
+  }
+
+  char chksum1[CHKSUMFILE_SIZE];
+  if (chksumfile_byinumber_alg(fs, inumber, hashAlg, chksum1) < 0) {
+    fprintf(stderr,"Can't checksum inode %d path %s\n", inumber, pathname);
+    return -1;
+  }
+
+  char chksum2[CHKSUMFILE_SIZE];
+  if (chksumfile_bypathname_alg(fs, pathname, hashAlg, chksum2) < 0) {
+    fprintf(stderr,"Can't checksum inode %d path %s\n", inumber, pathname);
+    return -1;
+  }
+
+  if (!chksumfile_compare_len(chksum1, chksum2, chksumfile_length(hashAlg))) {
+    fprintf(stderr,"Pathname checksum of %s differs from inode %d\n", pathname, inumber);
+    return -1;
+  }
+
+  char chksumstring[CHKSUMFILE_STRINGSIZE];
+  chksumfile_cvt2string_len(chksum2, chksumfile_length(hashAlg), chksumstring);
+  int size = inode_getsize(in);
+  fprintf(f, "Path %s %d mode 0x%x size %d checksum %s\n",pathname,inumber,in->i_mode, size, chksumstring);
+  return 0;
+}
+
 /**
  * Output to the specified file the checksum of files on the disk by
  * tranversing the naming hierarcy. 
  * Note this is used by the grading script so don't alter output format. 
  */
 static void DumpPathnameChecksum(struct unixfilesystem *fs, FILE *f) {
-  DumpPathAndChildren(fs, "/", ROOT_INUMBER, f);
+  WalkPathAndChildren(fs, "/", ROOT_INUMBER, -1, DumpPath, f);
+}
+
+/**
+ * The parallel dumps below first list the inodes to hash, serially,
+ * then hash them on numThreads threads, then print the results in list
+ * order, so the output is exactly that of the serial dumps.
+ */
+
+enum { HASH_OK, HASH_NOINODE, HASH_FAILED, HASH_MISMATCH };
+
+struct hashjob {
+  char *pathname;               // NULL for the inode dump
+  int inumber;
+  int parent;                   // Index of the parent directory's job, or -1
+  struct inode in;
+  int result;                   // HASH_*
+  char chksum[CHKSUMFILE_SIZE];
+};
+
+struct hashpool {
+  struct unixfilesystem *fs;
+  struct hashjob *jobs;
+  int njobs;
+  int next;                     // Next job to hand out
+  pthread_mutex_t lock;
+};
+
+static void HashJob(struct unixfilesystem *fs, struct hashjob *job) {
+  if (job->result != HASH_OK) return;
+  if (chksumfile_byinumber_alg(fs, job->inumber, hashAlg, job->chksum) < 0) {
+    job->result = HASH_FAILED;
+    return;
+  }
+  if (job->pathname) {
+    char chksum2[CHKSUMFILE_SIZE];
+    if (chksumfile_bypathname_alg(fs, job->pathname, hashAlg, chksum2) < 0) {
+      job->result = HASH_FAILED;
+    } else if (!chksumfile_compare_len(job->chksum, chksum2, chksumfile_length(hashAlg))) {
+      job->result = HASH_MISMATCH;
+    }
+  }
+}
+
+static void *HashWorker(void *arg) {
+  struct hashpool *pool = arg;
+  for (;;) {
+    pthread_mutex_lock(&pool->lock);
+    int i = pool->next++;
+    pthread_mutex_unlock(&pool->lock);
+    if (i >= pool->njobs) return NULL;
+    HashJob(pool->fs, &pool->jobs[i]);
+  }
+}
+
+/**
+ * Runs HashJob on every job, using numThreads threads (the calling
+ * thread among them).
+ */
+static void HashJobs(struct unixfilesystem *fs, struct hashjob *jobs, int njobs) {
+  struct hashpool pool = { fs, jobs, njobs, 0, PTHREAD_MUTEX_INITIALIZER };
+  int nworkers = min(numThreads, njobs) - 1;
+  pthread_t tids[nworkers > 0 ? nworkers : 1];
+  int started = 0;
+  for (; started < nworkers; started++) {
+    if (pthread_create(&tids[started], NULL, HashWorker, &pool) != 0) break;
+  }
+  HashWorker(&pool);
+  for (int i = 0; i < started; i++) {
+    pthread_join(tids[i], NULL);
+  }
+}
+
+/**
+ * Appends a job to *jobs, growing it as needed.  Returns its index.
+ */
+static int AddHashJob(struct hashjob **jobs, int *njobs, int *cap,
+                      const char *pathname, int inumber, int parent) {
+  if (*njobs == *cap) {
+    *cap = *cap ? 2 * *cap : 256;
+    *jobs = realloc(*jobs, *cap * sizeof(struct hashjob));
+    if (*jobs == NULL) {
+      fprintf(stderr, "Out of memory\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  struct hashjob *job = &(*jobs)[*njobs];
+  job->pathname = pathname ? strdup(pathname) : NULL;
+  job->inumber = inumber;
+  job->parent = parent;
+  job->result = HASH_OK;
+  return (*njobs)++;
+}
+
+static void FreeHashJobs(struct hashjob *jobs, int njobs) {
+  for (int i = 0; i < njobs; i++) {
+    free(jobs[i].pathname);
+  }
+  free(jobs);
+}
+
+/**
+ * Same output as DumpInodeChecksum(fs, f, false, true).
+ */
+static void DumpInodeChecksumParallel(struct unixfilesystem *fs, FILE *f) {
+  struct hashjob *jobs = NULL;
+  int njobs = 0, cap = 0;
+  int badInumber = 0;
+  struct inodescan scan;
+  inode_scan_start(fs, &scan, 1);
+  for (;;) {
+    int inumbers[INODE_SCAN_BATCH];
+    struct inode inodes[INODE_SCAN_BATCH];
+    int n = inode_scan_next(&scan, inumbers, inodes);
+    if (n < 0) badInumber = scan.next;
+    if (n <= 0) break;
+    for (int k = 0; k < n; k++) {
+      int i = AddHashJob(&jobs, &njobs, &cap, NULL, inumbers[k], -1);
+      jobs[i].in = inodes[k];
+    }
+  }
+
+  HashJobs(fs, jobs, njobs);
+
+  for (int i = 0; i < njobs; i++) {
+    struct hashjob *job = &jobs[i];
+    fprintf(f, "Inode %d mode 0x%x size %d", job->inumber, job->in.i_mode,
+            inode_getsize(&job->in));
+    if (job->result != HASH_OK) {
+      fprintf(stderr, "Inode %d can't compute chksum\n", job->inumber);
+      continue;
+    }
+    char chksumstring[CHKSUMFILE_STRINGSIZE];
+    chksumfile_cvt2string_len(job->chksum, chksumfile_length(hashAlg), chksumstring);
+    fprintf(f, " checksum %s\n", chksumstring);
+  }
+  if (badInumber) fprintf(stderr,"Can't read inode %d \n", badInumber);
+  FreeHashJobs(jobs, njobs);
+}
+
+struct hashjoblist {
+  struct hashjob *jobs;
+  int njobs, cap;
+};
+
+/**
+ * Adds a job for pathname to the hashjoblist arg, with the job's index
+ * as the parent of its children.
+ */
+static int ListPath(struct unixfilesystem *fs, const char *pathname, int inumber,
+                    struct inode *in, int parent, void *arg) {
+  struct hashjoblist *list = arg;
+  int self = AddHashJob(&list->jobs, &list->njobs, &list->cap, pathname,
+                        inumber, parent);
+  if (in == NULL) {
+    list->jobs[self].result = HASH_NOINODE;
+    return -1;
+  }
+  list->jobs[self].in = *in;
+  return self;
+}
+
+/**
+ * Same output as DumpPathnameChecksum.  A directory whose checksum
+ * fails hides everything under it, as in the serial walk.
+ */
+static void DumpPathnameChecksumParallel(struct unixfilesystem *fs, FILE *f) {
+  struct hashjoblist list = { NULL, 0, 0 };
+  WalkPathAndChildren(fs, "/", ROOT_INUMBER, -1, ListPath, &list);
+  struct hashjob *jobs = list.jobs;
+  int njobs = list.njobs;
+
+  HashJobs(fs, jobs, njobs);
+
+  // Parents come before their children, so one pass settles which
+  // jobs are hidden.
+  bool *hidden = calloc(njobs, sizeof(bool));
+  for (int i = 0; i < njobs; i++) {
+    struct hashjob *job = &jobs[i];
+    if (job->parent >= 0 &&
+        (hidden[job->parent] || jobs[job->parent].result != HASH_OK)) {
+      hidden[i] = true;
+      continue;
+    }
+    switch (job->result) {
+    case HASH_NOINODE:
+      fprintf(stderr,"Can't read inode %d \n", job->inumber);
+      continue;
+    case HASH_FAILED:
+      fprintf(stderr,"Can't checksum inode %d path %s\n", job->inumber, job->pathname);
+      continue;
+    case HASH_MISMATCH:
+      fprintf(stderr,"Pathname checksum of %s differs from inode %d\n", job->pathname, job->inumber);
+      continue;
+    }
+    char chksumstring[CHKSUMFILE_STRINGSIZE];
+    chksumfile_cvt2string_len(job->chksum, chksumfile_length(hashAlg), chksumstring);
+    fprintf(f, "Path %s %d mode 0x%x size %d checksum %s\n", job->pathname,
+            job->inumber, job->in.i_mode, inode_getsize(&job->in), chksumstring);
+  }
+  free(hidden);
+  FreeHashJobs(jobs, njobs);
 }
 
 static void TestDeletedFilenames(struct unixfilesystem *fs, FILE *f) {
@@ -341,5 +642,10 @@ static void PrintUsageAndExit(char *progname) {
   fprintf(stderr, "-d     tests directory_findname to ensure no reading of invalid dirents when dir is only partly filled\n");
   fprintf(stderr, "-l     tests directory_findname to ensure names of length 14 work\n");
   fprintf(stderr, "-p     print all pathname checksums (test the directory and pathname layers)\n");  
+  fprintf(stderr, "-c N   cache N disk sectors (default %d, 0 for none)\n", UNIXFILESYSTEM_CACHE_SECTORS);
+  fprintf(stderr, "-s     print sector, directory and path cache statistics to stderr\n");
+  fprintf(stderr, "-M     map the disk image instead of reading it (ignores -c)\n");
+  fprintf(stderr, "-t N   hash on N threads for -i and -p (same output)\n");
+  fprintf(stderr, "-H alg hash with alg: sha1 (default), xxh3 or blake3\n");
   exit(EXIT_FAILURE);
 }
@@ -1,30 +1,88 @@
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
 
 #include "diskimg.h"
 
+// All reads and writes give pread/pwrite an explicit offset, so they
+// never move the descriptor's shared file position and can be issued
+// from several threads at once.
+
 int diskimg_open(char *pathname, int readOnly) {
     return open(pathname, readOnly ? O_RDONLY : O_RDWR);
 }
 
 int diskimg_getsize(int fd) {
-    return lseek(fd, 0, SEEK_END);
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        return -1;
+    }
+    return st.st_size;
+}
+
+// pread until len bytes arrive or the image ends.  Returns the number
+// of bytes read, or -1 on error.
+static int pread_full(int fd, void *buf, int len, off_t off) {
+    int done = 0;
+    while (done < len) {
+        ssize_t n = pread(fd, (char *) buf + done, len - done, off + done);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n == -1) {
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        done += n;
+    }
+    return done;
 }
 
 int diskimg_readsector(int fd, int sectorNum, void *buf) {
-    if (lseek(fd, sectorNum * DISKIMG_SECTOR_SIZE, SEEK_SET) == (off_t) -1) {
-        return -1;
+    return pread_full(fd, buf, DISKIMG_SECTOR_SIZE,
+                      (off_t) sectorNum * DISKIMG_SECTOR_SIZE);
+}
+
+int diskimg_readsectors(int fd, int sectorNum, int nsectors, void *buf) {
+    return pread_full(fd, buf, nsectors * DISKIMG_SECTOR_SIZE,
+                      (off_t) sectorNum * DISKIMG_SECTOR_SIZE);
+}
+
+int diskimg_readsectorlist(int fd, const int *sectors, int nsectors,
+                           void *buf) {
+    int total = 0;
+    for (int i = 0; i < nsectors;) {
+        // Each run of consecutive sectors is one pread
+        int run = 1;
+        while (i + run < nsectors && sectors[i + run] == sectors[i] + run) {
+            run++;
+        }
+        int want = run * DISKIMG_SECTOR_SIZE;
+        int n = diskimg_readsectors(fd, sectors[i], run,
+                                    (char *) buf + total);
+        if (n == -1) {
+            return -1;
+        }
+        total += n;
+        if (n < want) {
+            break;
+        }
+        i += run;
     }
-    return read(fd, buf, DISKIMG_SECTOR_SIZE);
+    return total;
 }
 
 int diskimg_writesector(int fd, int sectorNum, void *buf) {
-    if (lseek(fd, sectorNum * DISKIMG_SECTOR_SIZE, SEEK_SET) == (off_t) -1) {
-      return -1;
-    }
-    return write(fd, buf, DISKIMG_SECTOR_SIZE);
+    ssize_t n;
+    do {
+        n = pwrite(fd, buf, DISKIMG_SECTOR_SIZE,
+                   (off_t) sectorNum * DISKIMG_SECTOR_SIZE);
+    } while (n == -1 && errno == EINTR);
+    return n;
 }
 
 int diskimg_close(int fd) {
@@ -6,6 +6,11 @@
 // Size of a disk sector (e.g. block) in bytes.
 #define DISKIMG_SECTOR_SIZE 512
 
+/**
+ * The read and write calls below use an explicit file offset, so
+ * several threads may use the same descriptor at once.
+ */
+
 /**
  * Opens a disk image for I/O. Returns an open file descriptor, or -1 if
  * unsuccessful.  
@@ -23,6 +28,21 @@ int diskimg_getsize(int fd);
  */
 int diskimg_readsector(int fd, int sectorNum, void *buf); 
 
+/**
+ * Reads nsectors consecutive sectors starting at sectorNum into buf,
+ * in one request.  Returns the number of bytes read, or -1 on error.
+ */
+int diskimg_readsectors(int fd, int sectorNum, int nsectors, void *buf);
+
+/**
+ * Reads the nsectors sectors listed in sectors, in that order, into
+ * consecutive slots of buf.  Runs of consecutive sector numbers are
+ * each read with a single request.  Returns the number of bytes read
+ * (short only if the image ends first), or -1 on error.
+ */
+int diskimg_readsectorlist(int fd, const int *sectors, int nsectors,
+                           void *buf);
+
 /**
  * Writes the information at buf to the specified sector on disk.
  * Returns the number of bytes written, or -1 on error.
@@ -16,7 +16,7 @@ int file_getblock(const struct unixfilesystem *fs, int inumber,
         if (blkNum == -1) {
                 return -1;
         }
-        int read_block = diskimg_readsector(fs->dfd, blkNum, buf);
+        int read_block = unixfilesystem_readsector(fs, blkNum, buf);
         if (read_block == -1) {
                 return -1;
         }
@@ -27,3 +27,135 @@ int file_getblock(const struct unixfilesystem *fs, int inumber,
         }
         return DISKIMG_SECTOR_SIZE;
 }
+
+#define NUM_INDIRECT_PER_BLOCK (DISKIMG_SECTOR_SIZE / sizeof(uint16_t))
+#define DOUBLY_INDIRECT_INDEX 7
+// Most blocks file_readblocks looks up for one gather read
+#define FILE_MAX_GATHER 64
+
+int file_open(const struct unixfilesystem *fs, int inumber,
+              struct filecursor *fc) {
+        fc->fs = fs;
+        if (inode_iget(fs, inumber, &fc->in) == -1) {
+                return -1;
+        }
+        fc->size = inode_getsize(&fc->in);
+        fc->nblocks = (fc->size + DISKIMG_SECTOR_SIZE - 1) / DISKIMG_SECTOR_SIZE;
+        fc->next = 0;
+        fc->indirSector = fc->dindirSector = -1;
+        fc->indir = fc->dindir = NULL;
+        return 0;
+}
+
+// Points *table at sector unless it is already there: into the image
+// if it is mapped, else at buf after reading the sector into it.
+static int load_table(const struct unixfilesystem *fs, int sector,
+                      int *have, const uint16_t **table, uint16_t *buf) {
+        if (*have == sector) {
+                return 0;
+        }
+        const uint16_t *mapped = unixfilesystem_mapsector(fs, sector);
+        if (mapped) {
+                *table = mapped;
+        } else if (unixfilesystem_readsector(fs, sector, buf)
+                        != DISKIMG_SECTOR_SIZE) {
+                *have = -1;
+                return -1;
+        } else {
+                *table = buf;
+        }
+        *have = sector;
+        return 0;
+}
+
+// Same result as inode_indexlookup, but reusing the cursor's tables.
+static int cursor_lookup(struct filecursor *fc, int fileBlockIndex) {
+        if ((fc->in.i_mode & ILARG) == 0) {
+                return fc->in.i_addr[fileBlockIndex];
+        }
+        int blkIndex = fileBlockIndex / NUM_INDIRECT_PER_BLOCK;
+        int index = fileBlockIndex % NUM_INDIRECT_PER_BLOCK;
+        int sector;
+        if (blkIndex < DOUBLY_INDIRECT_INDEX) {
+                sector = fc->in.i_addr[blkIndex];
+        } else {
+                if (load_table(fc->fs, fc->in.i_addr[DOUBLY_INDIRECT_INDEX],
+                               &fc->dindirSector, &fc->dindir,
+                               fc->dindirBuf) == -1) {
+                        return -1;
+                }
+                sector = fc->dindir[blkIndex - DOUBLY_INDIRECT_INDEX];
+        }
+        if (load_table(fc->fs, sector, &fc->indirSector, &fc->indir,
+                       fc->indirBuf) == -1) {
+                return -1;
+        }
+        return fc->indir[index];
+}
+
+int file_readblocks(struct filecursor *fc, void *buf, int maxBlocks) {
+        if (fc->next >= fc->nblocks) {
+                return 0;
+        }
+        int n = fc->nblocks - fc->next;
+        if (n > maxBlocks) {
+                n = maxBlocks;
+        }
+        if (n > FILE_MAX_GATHER) {
+                n = FILE_MAX_GATHER;
+        }
+        int sectors[FILE_MAX_GATHER];
+        for (int i = 0; i < n; i++) {
+                sectors[i] = cursor_lookup(fc, fc->next + i);
+                if (sectors[i] == -1) {
+                        return -1;
+                }
+        }
+        // One read per run of blocks that are adjacent on disk
+        if (unixfilesystem_readsectorlist(fc->fs, sectors, n, buf)
+                        != n * DISKIMG_SECTOR_SIZE) {
+                return -1;
+        }
+        int start = fc->next * DISKIMG_SECTOR_SIZE;
+        fc->next += n;
+        if (fc->next == fc->nblocks) {
+                return fc->size - start;
+        }
+        return n * DISKIMG_SECTOR_SIZE;
+}
+
+int file_nextblocks(struct filecursor *fc, const void **data) {
+        if (fc->next >= fc->nblocks) {
+                return 0;
+        }
+        int first = cursor_lookup(fc, fc->next);
+        if (first == -1) {
+                return -1;
+        }
+        const char *mapped = unixfilesystem_mapsector(fc->fs, first);
+        if (mapped == NULL) {
+                // Not mapped (or out of range, which reading reports)
+                *data = fc->buf;
+                return file_readblocks(fc, fc->buf, FILE_CURSOR_SECTORS);
+        }
+        // Extend the run while the blocks stay adjacent in the image
+        int n = 1;
+        while (fc->next + n < fc->nblocks && n < FILE_MAX_GATHER) {
+                int sector = cursor_lookup(fc, fc->next + n);
+                if (sector == -1) {
+                        return -1;
+                }
+                if (sector != first + n ||
+                    unixfilesystem_mapsector(fc->fs, sector) == NULL) {
+                        break;
+                }
+                n++;
+        }
+        *data = mapped;
+        int start = fc->next * DISKIMG_SECTOR_SIZE;
+        fc->next += n;
+        if (fc->next == fc->nblocks) {
+                return fc->size - start;
+        }
+        return n * DISKIMG_SECTOR_SIZE;
+}
@@ -2,6 +2,7 @@
 #define _FILE_H_
 
 #include "unixfilesystem.h"
+#include "diskimg.h"
 
 /**
  * Fetches the specified file block from the specified inode and
@@ -16,4 +17,59 @@
 int file_getblock(const struct unixfilesystem *fs, int inumber, 
                   int fileBlockIndex, void *buf); 
 
+// Most blocks file_nextblocks reads into the cursor at once
+#define FILE_CURSOR_SECTORS 16
+
+/**
+ * A cursor for reading a file's blocks in order.  The inode is read
+ * once, and the current indirect (and doubly-indirect) sector is kept
+ * in the cursor, so reading a whole file costs one read per indirect
+ * sector rather than several per data block.  On a mapped file system
+ * the tables point into the image instead of being copied.  Fields are
+ * private to file.c.
+ */
+struct filecursor {
+    const struct unixfilesystem *fs;
+    struct inode in;
+    int size;                   // File size in bytes
+    int nblocks;                // Blocks in the file
+    int next;                   // Index of the next block to read
+    int indirSector;            // Sector indir points at, or -1
+    int dindirSector;           // Sector dindir points at, or -1
+    const uint16_t *indir;      // Into the image, or indirBuf
+    const uint16_t *dindir;     // Into the image, or dindirBuf
+    uint16_t indirBuf[DISKIMG_SECTOR_SIZE / sizeof(uint16_t)];
+    uint16_t dindirBuf[DISKIMG_SECTOR_SIZE / sizeof(uint16_t)];
+    char buf[FILE_CURSOR_SECTORS * DISKIMG_SECTOR_SIZE];
+};
+
+/**
+ * Starts a cursor at the first block of file inumber.  Returns 0 on
+ * success, or -1 if the inode can't be read.  fc->in holds the inode
+ * afterwards, for callers that want the mode.
+ */
+int file_open(const struct unixfilesystem *fs, int inumber,
+              struct filecursor *fc);
+
+/**
+ * Reads the file's next blocks into buf, which must hold maxBlocks
+ * sectors.  The blocks are fetched with one gather read, which makes
+ * a single disk request per run of blocks that are adjacent on disk.
+ * Returns the number of valid bytes stored (less than a full sector
+ * only at the end of the file), 0 at the end of the file, or -1 on
+ * error.
+ */
+int file_readblocks(struct filecursor *fc, void *buf, int maxBlocks);
+
+/**
+ * Like file_readblocks, but sets *data to the bytes rather than
+ * copying them to a caller's buffer.  On a mapped file system *data
+ * points into the image, at a run of blocks that are adjacent on disk;
+ * otherwise up to FILE_CURSOR_SECTORS blocks are read into the cursor.
+ * Either way *data stays valid until the next call on the cursor.
+ * Returns the number of valid bytes, 0 at the end of the file, or -1
+ * on error.
+ */
+int file_nextblocks(struct filecursor *fc, const void **data);
+
 #endif // _FILE_H_
@@ -280,6 +280,6 @@ int main(int argc, char *argv[]) {
   // Close the disk image when we're done
   int err = diskimg_close(fd);
   if (err < 0) fprintf(stderr, "Error closing %s\n", argv[1]);
-  free(fs);
+  unixfilesystem_free(fs);
   return 0;
 }
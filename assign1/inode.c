@@ -8,14 +8,29 @@
 #define NUM_INDIRECT_PER_BLOCK (DISKIMG_SECTOR_SIZE / sizeof(uint16_t))
 #define MAX_ADDR_INDEX 7
 
+// Returns sector's contents: in place if the image is mapped, else
+// read into buf.  Returns NULL on an error or a short read (a sector
+// past the end of the image), which would leave buf stale.
+static const void *get_sector(const struct unixfilesystem *fs, int sectorNum,
+        void *buf) {
+    const void *mapped = unixfilesystem_mapsector(fs, sectorNum);
+    if (mapped) {
+        return mapped;
+    }
+    if (unixfilesystem_readsector(fs, sectorNum, buf) != DISKIMG_SECTOR_SIZE) {
+        return NULL;
+    }
+    return buf;
+}
+
 int inode_iget(const struct unixfilesystem *fs, int inumber,
         struct inode *inp) {
     // Remove the placeholder code below and add your implementation.
     int sectorNum = (inumber - 1) / INODE_PER_BLOCK + INODE_START_SECTOR;
-    struct inode inodes[INODE_PER_BLOCK];
+    struct inode buf[INODE_PER_BLOCK];
     int indexNum = (inumber - 1) % INODE_PER_BLOCK;
-    int sign = diskimg_readsector(fs->dfd, sectorNum, inodes);
-    if (sign == -1) {
+    const struct inode *inodes = get_sector(fs, sectorNum, buf);
+    if (inodes == NULL) {
         return -1;
     }
     *inp = inodes[indexNum];
@@ -32,12 +47,13 @@ int inode_indexlookup(const struct unixfilesystem *fs, struct inode *inp,
     if ((inp->i_mode & ILARG) == 0) { // direct block
         return inp->i_addr[fileBlockIndex];
     }
-    uint16_t inodes1[NUM_INDIRECT_PER_BLOCK];
+    uint16_t buf1[NUM_INDIRECT_PER_BLOCK];
+    const uint16_t *inodes1;
     int blkIndex = fileBlockIndex / NUM_INDIRECT_PER_BLOCK;
     int index = fileBlockIndex % NUM_INDIRECT_PER_BLOCK;
     if (blkIndex < MAX_ADDR_INDEX) { // singly indirect
         int sectorNum = inp->i_addr[blkIndex];
-        if (diskimg_readsector(fs->dfd, sectorNum, inodes1) == -1) {
+        if ((inodes1 = get_sector(fs, sectorNum, buf1)) == NULL) {
             return -1;
         }
         return inodes1[index];
@@ -45,12 +61,13 @@ int inode_indexlookup(const struct unixfilesystem *fs, struct inode *inp,
     else { // double indirect
         int tableIdx = blkIndex - MAX_ADDR_INDEX;
         int sectorNum = inp->i_addr[MAX_ADDR_INDEX];
-        if (diskimg_readsector(fs->dfd, sectorNum, inodes1) == -1) {
+        if ((inodes1 = get_sector(fs, sectorNum, buf1)) == NULL) {
             return -1;
         }
         sectorNum = inodes1[tableIdx];
-        uint16_t inodes2[NUM_INDIRECT_PER_BLOCK];
-        if (diskimg_readsector(fs->dfd, sectorNum, inodes2) == -1) {
+        uint16_t buf2[NUM_INDIRECT_PER_BLOCK];
+        const uint16_t *inodes2 = get_sector(fs, sectorNum, buf2);
+        if (inodes2 == NULL) {
             return -1;
         }
         return inodes2[index];
@@ -60,3 +77,67 @@ int inode_indexlookup(const struct unixfilesystem *fs, struct inode *inp,
 int inode_getsize(struct inode *inp) {
     return ((inp->i_size0 << 16) | inp->i_size1);
 }
+
+void inode_scan_start(const struct unixfilesystem *fs, struct inodescan *scan,
+        int allocatedOnly) {
+    scan->fs = fs;
+    scan->next = 1;
+    scan->end = fs->superblock.s_isize * INODE_PER_BLOCK + 1;
+    scan->allocatedOnly = allocatedOnly;
+}
+
+// Bit i is set if inode i of the sector is allocated.  Branch-free, so
+// the compiler can test the mode words of a whole sector at once.
+static unsigned alloc_mask(const struct inode *inodes) {
+    unsigned mask = 0;
+    for (int i = 0; i < INODE_PER_BLOCK; i++) {
+        mask |= (unsigned) ((inodes[i].i_mode & IALLOC) != 0) << i;
+    }
+    return mask;
+}
+
+int inode_scan_next(struct inodescan *scan, int *inumbers, struct inode *inodes) {
+    while (scan->next < scan->end) {
+        int first = scan->next;
+        int nsectors = (scan->end - first) / INODE_PER_BLOCK;
+        if (nsectors > INODE_SCAN_SECTORS) {
+            nsectors = INODE_SCAN_SECTORS;
+        }
+        int sector = (first - 1) / INODE_PER_BLOCK + INODE_START_SECTOR;
+
+        // The batch's sectors, in place if the image is mapped
+        const struct inode *src = unixfilesystem_mapsector(scan->fs, sector);
+        if (src == NULL ||
+            unixfilesystem_mapsector(scan->fs, sector + nsectors - 1) == NULL) {
+            int sectors[INODE_SCAN_SECTORS];
+            for (int i = 0; i < nsectors; i++) {
+                sectors[i] = sector + i;
+            }
+            if (unixfilesystem_readsectorlist(scan->fs, sectors, nsectors, inodes)
+                    != nsectors * DISKIMG_SECTOR_SIZE) {
+                return -1;
+            }
+            src = inodes;
+        }
+        scan->next += nsectors * INODE_PER_BLOCK;
+
+        int n = 0;
+        for (int s = 0; s < nsectors; s++) {
+            const struct inode *in = src + s * INODE_PER_BLOCK;
+            unsigned mask = scan->allocatedOnly ? alloc_mask(in)
+                                                : (1u << INODE_PER_BLOCK) - 1;
+            // Compacting in place is safe: n never passes the source index
+            while (mask) {
+                int i = __builtin_ctz(mask);
+                mask &= mask - 1;
+                inodes[n] = in[i];
+                inumbers[n] = first + s * INODE_PER_BLOCK + i;
+                n++;
+            }
+        }
+        if (n > 0) {
+            return n;
+        }
+    }
+    return 0;
+}
@@ -31,4 +31,38 @@ int inode_indexlookup(const struct unixfilesystem *fs, struct inode *inp,
  */
 int inode_getsize(struct inode *inp);
 
+// Inode sectors read per inode_scan_next call, and the most inodes one
+// call can return.
+#define INODE_SCAN_SECTORS 16
+#define INODE_SCAN_BATCH (INODE_SCAN_SECTORS * 16)
+
+/**
+ * A scan over the whole inode area in large sequential reads, for
+ * enumerations that want every (allocated) inode rather than calling
+ * inode_iget once per inumber.  Fields are private to inode.c, except
+ * that next is the first inumber of the batch that failed after
+ * inode_scan_next returns -1.
+ */
+struct inodescan {
+    const struct unixfilesystem *fs;
+    int next;                   // First inumber of the next batch
+    int end;                    // One past the last inumber
+    int allocatedOnly;
+};
+
+/**
+ * Starts a scan at inumber 1.  If allocatedOnly is set, only inodes
+ * with IALLOC set are returned.
+ */
+void inode_scan_start(const struct unixfilesystem *fs, struct inodescan *scan,
+        int allocatedOnly);
+
+/**
+ * Stores the next batch of inodes, in inumber order, at inodes and
+ * their inumbers at inumbers; both must hold INODE_SCAN_BATCH entries.
+ * Returns the number stored, 0 once the inode area is exhausted, or -1
+ * if a disk error occurs.
+ */
+int inode_scan_next(struct inodescan *scan, int *inumbers, struct inode *inodes);
+
 #endif // _INODE_
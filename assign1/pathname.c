@@ -1,8 +1,8 @@
-
 #include "pathname.h"
 #include "directory.h"
 #include "inode.h"
 #include "diskimg.h"
+#include "dircache.h"
 #include <stdio.h>
 #include <string.h>
 
@@ -12,14 +12,38 @@ int pathname_lookup(const struct unixfilesystem *fs, const char *pathname) {
         return ROOT_INUMBER;
     }
 
-    char path_copy[strlen(pathname) + 1];
-    strcpy(path_copy, pathname);
-    char *cpy = path_copy;
+    // Whatever precedes the first "/" is skipped, as it always was
+    const char *first = strchr(pathname, '/');
+    if (first == NULL) {
+        return ROOT_INUMBER;
+    }
+    int skip = first - pathname;
+
+    // Start after the longest prefix already resolved: the whole path,
+    // or the path up to one of its slashes.
     int inum = ROOT_INUMBER;
-    char* temp = strsep(&cpy, "/"); 
+    const char *next = first;   // The "/" before the next component
+    for (int end = strlen(pathname); end > skip; ) {
+        int cached = dircache_getpath(fs->dircache, pathname, end);
+        if (cached != -1) {
+            inum = cached;
+            next = pathname + end;
+            break;
+        }
+        do {
+            end--;
+        } while (end > skip && pathname[end] != '/');
+    }
+
     struct direntv6 dirEnt;
+    while (*next == '/') {
+        const char *comp = next + 1;
+        const char *slash = strchr(comp, '/');
+        int len = slash ? slash - comp : (int) strlen(comp);
+        char temp[len + 1];
+        memcpy(temp, comp, len);
+        temp[len] = '\0';
 
-    while ((temp = strsep(&cpy, "/")) != NULL) {
         int sign = directory_findname(fs, temp, inum, &dirEnt);
         if (sign == -1) {
             fprintf(stderr, "pathname_lookup(pathname=\"%s\") presented a "
@@ -28,6 +52,8 @@ int pathname_lookup(const struct unixfilesystem *fs, const char *pathname) {
             return -1;
         }
         inum = dirEnt.d_inumber;
+        next = comp + len;
+        dircache_addpath(fs->dircache, pathname, next - pathname, inum);
     }
     return inum;
 }
@@ -0,0 +1,182 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sectorcache.h"
+#include "diskimg.h"
+
+#define NONE (-1)
+
+struct entry {
+    int sector;
+    int prev, next;             // LRU list, most recent at the head
+    int hnext;                  // Next entry in the same hash bucket
+    uint8_t data[DISKIMG_SECTOR_SIZE];
+};
+
+// mu guards everything but the fields set at creation (dfd, nentries,
+// nbuckets and the array pointers).
+struct sectorcache {
+    pthread_mutex_t mu;
+    int dfd;
+    int nentries;
+    int nused;                  // Slots handed out so far
+    int head, tail;
+    int nbuckets;               // A power of two
+    int *buckets;
+    struct entry *entries;
+    struct sectorcache_stats stats;
+};
+
+static int hash(const struct sectorcache *cache, int sectorNum) {
+    return ((unsigned) sectorNum * 2654435761u) & (cache->nbuckets - 1);
+}
+
+static void lru_unlink(struct sectorcache *cache, int i) {
+    struct entry *e = &cache->entries[i];
+    if (e->prev != NONE) {
+        cache->entries[e->prev].next = e->next;
+    } else {
+        cache->head = e->next;
+    }
+    if (e->next != NONE) {
+        cache->entries[e->next].prev = e->prev;
+    } else {
+        cache->tail = e->prev;
+    }
+}
+
+static void lru_push_front(struct sectorcache *cache, int i) {
+    struct entry *e = &cache->entries[i];
+    e->prev = NONE;
+    e->next = cache->head;
+    if (cache->head != NONE) {
+        cache->entries[cache->head].prev = i;
+    } else {
+        cache->tail = i;
+    }
+    cache->head = i;
+}
+
+static void hash_remove(struct sectorcache *cache, int i) {
+    int *p = &cache->buckets[hash(cache, cache->entries[i].sector)];
+    while (*p != i) {
+        p = &cache->entries[*p].hnext;
+    }
+    *p = cache->entries[i].hnext;
+}
+
+struct sectorcache *sectorcache_create(int dfd, int nsectors) {
+    struct sectorcache *cache = calloc(1, sizeof(struct sectorcache));
+    if (cache == NULL) {
+        return NULL;
+    }
+    pthread_mutex_init(&cache->mu, NULL);
+    cache->dfd = dfd;
+    cache->nentries = nsectors > 0 ? nsectors : 0;
+    cache->head = cache->tail = NONE;
+    cache->nbuckets = 1;
+    while (cache->nbuckets < 2 * cache->nentries) {
+        cache->nbuckets <<= 1;
+    }
+    cache->buckets = malloc(cache->nbuckets * sizeof(int));
+    // One spare, so a zero-sector cache doesn't ask for zero bytes
+    cache->entries = malloc((cache->nentries + 1) * sizeof(struct entry));
+    if (cache->buckets == NULL || cache->entries == NULL) {
+        sectorcache_free(cache);
+        return NULL;
+    }
+    for (int b = 0; b < cache->nbuckets; b++) {
+        cache->buckets[b] = NONE;
+    }
+    return cache;
+}
+
+void sectorcache_free(struct sectorcache *cache) {
+    if (cache == NULL) {
+        return;
+    }
+    pthread_mutex_destroy(&cache->mu);
+    free(cache->buckets);
+    free(cache->entries);
+    free(cache);
+}
+
+// Index of the entry holding sectorNum, or NONE.  Caller holds mu.
+static int find(const struct sectorcache *cache, int sectorNum) {
+    for (int i = cache->buckets[hash(cache, sectorNum)]; i != NONE;
+         i = cache->entries[i].hnext) {
+        if (cache->entries[i].sector == sectorNum) {
+            return i;
+        }
+    }
+    return NONE;
+}
+
+int sectorcache_read(struct sectorcache *cache, int sectorNum, void *buf) {
+    pthread_mutex_lock(&cache->mu);
+    int i = find(cache, sectorNum);
+    if (i != NONE) {
+        cache->stats.hits++;
+        if (cache->head != i) {
+            lru_unlink(cache, i);
+            lru_push_front(cache, i);
+        }
+        memcpy(buf, cache->entries[i].data, DISKIMG_SECTOR_SIZE);
+        pthread_mutex_unlock(&cache->mu);
+        return DISKIMG_SECTOR_SIZE;
+    }
+    cache->stats.misses++;
+    pthread_mutex_unlock(&cache->mu);
+
+    // Read without the lock, so other threads' hits don't wait on the
+    // disk.  Errors and short reads aren't cached.
+    int n = diskimg_readsector(cache->dfd, sectorNum, buf);
+    if (n != DISKIMG_SECTOR_SIZE || cache->nentries == 0) {
+        return n;
+    }
+
+    pthread_mutex_lock(&cache->mu);
+    // Another thread may have loaded it meanwhile
+    if (find(cache, sectorNum) == NONE) {
+        // Take a never-used slot if there is one, else the least
+        // recently used.
+        if (cache->nused < cache->nentries) {
+            i = cache->nused++;
+        } else {
+            i = cache->tail;
+            lru_unlink(cache, i);
+            hash_remove(cache, i);
+        }
+        struct entry *e = &cache->entries[i];
+        memcpy(e->data, buf, DISKIMG_SECTOR_SIZE);
+        e->sector = sectorNum;
+        int b = hash(cache, sectorNum);
+        e->hnext = cache->buckets[b];
+        cache->buckets[b] = i;
+        lru_push_front(cache, i);
+    }
+    pthread_mutex_unlock(&cache->mu);
+    return n;
+}
+
+int sectorcache_readlist(struct sectorcache *cache, const int *sectors,
+        int nsectors, void *buf) {
+    int runs = 0;
+    for (int i = 0; i < nsectors; i++) {
+        if (i == 0 || sectors[i] != sectors[i - 1] + 1) {
+            runs++;
+        }
+    }
+    pthread_mutex_lock(&cache->mu);
+    cache->stats.misses += runs;
+    pthread_mutex_unlock(&cache->mu);
+    return diskimg_readsectorlist(cache->dfd, sectors, nsectors, buf);
+}
+
+struct sectorcache_stats sectorcache_getstats(struct sectorcache *cache) {
+    pthread_mutex_lock(&cache->mu);
+    struct sectorcache_stats st = cache->stats;
+    pthread_mutex_unlock(&cache->mu);
+    return st;
+}
@@ -0,0 +1,53 @@
+#ifndef _SECTORCACHE_H_
+#define _SECTORCACHE_H_
+
+#include <stdint.h>
+
+/**
+ * A least-recently-used cache of disk image sectors.  The image is
+ * assumed not to change underneath it (the file system layers only
+ * ever read).  A cache of zero sectors is allowed; it reads through
+ * to the disk every time but still keeps the statistics.  All calls
+ * may be made from several threads at once.
+ */
+struct sectorcache;
+
+struct sectorcache_stats {
+    long hits;      // Reads satisfied from memory
+    long misses;    // Reads that went to the disk image
+};
+
+/**
+ * Allocates a cache holding up to nsectors sectors of the image open
+ * on dfd.  Returns NULL if out of memory.
+ */
+struct sectorcache *sectorcache_create(int dfd, int nsectors);
+
+/**
+ * Frees the cache and everything in it.  Does not close dfd.
+ */
+void sectorcache_free(struct sectorcache *cache);
+
+/**
+ * Same contract as diskimg_readsector: copies sector sectorNum to buf
+ * and returns the number of bytes read, or -1 on error.  Only full
+ * sectors are cached.
+ */
+int sectorcache_read(struct sectorcache *cache, int sectorNum, void *buf);
+
+/**
+ * Reads the listed sectors into consecutive slots of buf (see
+ * diskimg_readsectorlist), without looking in or filling the cache,
+ * so streaming file data doesn't push out the inode and indirect
+ * sectors.  Each run of consecutive sectors counts as one miss.
+ * Returns the number of bytes read, or -1 on error.
+ */
+int sectorcache_readlist(struct sectorcache *cache, const int *sectors,
+        int nsectors, void *buf);
+
+/**
+ * Returns the hit and miss counts since the cache was created.
+ */
+struct sectorcache_stats sectorcache_getstats(struct sectorcache *cache);
+
+#endif // _SECTORCACHE_H_
@@ -1,7 +1,11 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 #include "unixfilesystem.h"
 #include "diskimg.h"
+#include "sectorcache.h"
+#include "dircache.h"
 
 /**
  * Allocates and initializes a struct unixfilesystem given a filedescriptor to
@@ -10,17 +14,74 @@
  */
 
 struct unixfilesystem *unixfilesystem_init(int dfd) {
+    return unixfilesystem_init_cache(dfd, UNIXFILESYSTEM_CACHE_SECTORS);
+}
+
+// Copies nsectors sectors starting at sectorNum out of the mapping,
+// with the same results as reading them (short at the end of the
+// image, 0 past it).
+static int map_copy(const struct unixfilesystem *fs, int sectorNum,
+        int nsectors, void *buf) {
+    if (sectorNum < 0) {
+        return -1;
+    }
+    size_t off = (size_t) sectorNum * DISKIMG_SECTOR_SIZE;
+    if (off >= fs->mapsize) {
+        return 0;
+    }
+    size_t len = (size_t) nsectors * DISKIMG_SECTOR_SIZE;
+    if (len > fs->mapsize - off) {
+        len = fs->mapsize - off;
+    }
+    memcpy(buf, fs->map + off, len);
+    return len;
+}
+
+static struct unixfilesystem *init(int dfd, int cacheSectors, int useMap) {
+    struct unixfilesystem *fs = calloc(1, sizeof(struct unixfilesystem));
+    if (fs == NULL) {
+        fprintf(stderr,"Out of memory.\n");
+        return NULL;
+    }
+    fs->dfd = dfd;
+
+    if (useMap) {
+        int size = diskimg_getsize(dfd);
+        void *map = size > 0 ?
+            mmap(NULL, size, PROT_READ, MAP_PRIVATE, dfd, 0) : MAP_FAILED;
+        if (map == MAP_FAILED) {
+            perror("Error mapping disk image");
+            free(fs);
+            return NULL;
+        }
+        fs->map = map;
+        fs->mapsize = size;
+        cacheSectors = 0;
+    }
+
+    // Every read goes through the cache object, even when it caches
+    // nothing, so the statistics are always available.
+    fs->cache = sectorcache_create(dfd, cacheSectors);
+    fs->dircache = dircache_create();
+    if (fs->cache == NULL || fs->dircache == NULL) {
+        fprintf(stderr,"Out of memory.\n");
+        unixfilesystem_free(fs);
+        return NULL;
+    }
+
     // Validate the bootblock.  This will catch the situation where something
     // other than a descriptor to a valid diskimg is passed in.
     uint16_t bootblock[256];
-    if (diskimg_readsector(dfd, BOOTBLOCK_SECTOR, bootblock)
+    if (unixfilesystem_readsector(fs, BOOTBLOCK_SECTOR, bootblock)
             != DISKIMG_SECTOR_SIZE) {
         fprintf(stderr, "Error reading bootblock\n");
+        unixfilesystem_free(fs);
         return NULL;
     }
 
     if (bootblock[0] != BOOTBLOCK_MAGIC_NUM) {
         fprintf(stderr, "Bad magic number on disk(0x%x)\n", bootblock[0]);
+        unixfilesystem_free(fs);
         return NULL;
     }
 
@@ -29,19 +90,68 @@ struct unixfilesystem *unixfilesystem_init(int dfd) {
                 sizeof(struct filsys));
     }
 
-    struct unixfilesystem *fs = malloc(sizeof(struct unixfilesystem));
-    if (fs == NULL) {
-        fprintf(stderr,"Out of memory.\n");
-        return NULL;
-    }
-
-    fs->dfd = dfd;
-    if (diskimg_readsector(dfd, SUPERBLOCK_SECTOR, &fs->superblock)
+    if (unixfilesystem_readsector(fs, SUPERBLOCK_SECTOR, &fs->superblock)
             != DISKIMG_SECTOR_SIZE) {
         fprintf(stderr, "Error reading superblock\n");
-        free(fs);
+        unixfilesystem_free(fs);
         return NULL;
     }
 
     return fs;
 }
+
+struct unixfilesystem *unixfilesystem_init_cache(int dfd, int cacheSectors) {
+    return init(dfd, cacheSectors, 0);
+}
+
+struct unixfilesystem *unixfilesystem_init_mmap(int dfd) {
+    return init(dfd, 0, 1);
+}
+
+const void *unixfilesystem_mapsector(const struct unixfilesystem *fs,
+        int sectorNum) {
+    if (fs->map == NULL || sectorNum < 0 ||
+            (size_t) (sectorNum + 1) * DISKIMG_SECTOR_SIZE > fs->mapsize) {
+        return NULL;
+    }
+    return fs->map + (size_t) sectorNum * DISKIMG_SECTOR_SIZE;
+}
+
+int unixfilesystem_readsector(const struct unixfilesystem *fs, int sectorNum,
+        void *buf) {
+    if (fs->map) {
+        return map_copy(fs, sectorNum, 1, buf);
+    }
+    return sectorcache_read(fs->cache, sectorNum, buf);
+}
+
+int unixfilesystem_readsectorlist(const struct unixfilesystem *fs,
+        const int *sectors, int nsectors, void *buf) {
+    if (fs->map) {
+        int total = 0;
+        for (int i = 0; i < nsectors; i++) {
+            int n = map_copy(fs, sectors[i], 1, (char *) buf + total);
+            if (n == -1) {
+                return -1;
+            }
+            total += n;
+            if (n < DISKIMG_SECTOR_SIZE) {
+                break;
+            }
+        }
+        return total;
+    }
+    return sectorcache_readlist(fs->cache, sectors, nsectors, buf);
+}
+
+void unixfilesystem_free(struct unixfilesystem *fs) {
+    if (fs == NULL) {
+        return;
+    }
+    if (fs->map) {
+        munmap((void *) (uintptr_t) fs->map, fs->mapsize);
+    }
+    sectorcache_free(fs->cache);
+    dircache_free(fs->dircache);
+    free(fs);
+}
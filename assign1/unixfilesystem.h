@@ -9,6 +9,8 @@
 #include "ino.h"
 #include "direntv6.h"
 
+#include <stddef.h>
+
 /**
  * The layout of the Unix disk looked as follows:
  * ----------------------------------------------
@@ -26,12 +28,66 @@
 #define ROOT_INUMBER        1
 #define BOOTBLOCK_MAGIC_NUM 0407
 
+// Sectors cached by unixfilesystem_init().  Enough for the inode and
+// indirect blocks of the sample images, and cheap at 512 bytes each.
+#define UNIXFILESYSTEM_CACHE_SECTORS 256
+
+struct sectorcache;
+struct dircache;
+
 struct unixfilesystem {
     int dfd;                     // Handle from the diskimg module to read
                                  // the disk image.
     struct filsys superblock;    // The superblock read from the disk image.
+    struct sectorcache *cache;   // Sectors read through dfd.
+    struct dircache *dircache;   // Indexed directories and resolved paths.
+    const uint8_t *map;          // Whole image, if mapped, else NULL.
+    size_t mapsize;
 };
 
 struct unixfilesystem *unixfilesystem_init(int fd);
 
+/**
+ * Like unixfilesystem_init, but caches up to cacheSectors recently
+ * read sectors.  A cacheSectors of 0 reads every sector from the disk
+ * image (still counting the reads).
+ */
+struct unixfilesystem *unixfilesystem_init_cache(int fd, int cacheSectors);
+
+/**
+ * Like unixfilesystem_init, but maps the whole image read-only instead
+ * of reading it, so sectors can be used in place (see
+ * unixfilesystem_mapsector) and reads are memory copies.
+ */
+struct unixfilesystem *unixfilesystem_init_mmap(int fd);
+
+/**
+ * Returns a pointer to sector sectorNum inside the mapped image, or
+ * NULL if the file system isn't mapped or the sector is out of range.
+ * Callers fall back to unixfilesystem_readsector on NULL.
+ */
+const void *unixfilesystem_mapsector(const struct unixfilesystem *fs,
+        int sectorNum);
+
+/**
+ * Reads a sector through the file system's cache.  Same contract as
+ * diskimg_readsector: returns the number of bytes read, or -1 on error.
+ */
+int unixfilesystem_readsector(const struct unixfilesystem *fs, int sectorNum,
+        void *buf);
+
+/**
+ * Reads the listed sectors into consecutive slots of buf, one disk
+ * read per run of consecutive sectors, bypassing the cache (see
+ * sectorcache_readlist).  Returns the number of bytes read, or -1 on
+ * error.
+ */
+int unixfilesystem_readsectorlist(const struct unixfilesystem *fs,
+        const int *sectors, int nsectors, void *buf);
+
+/**
+ * Frees fs, its caches and any mapping.  Does not close the disk image.
+ */
+void unixfilesystem_free(struct unixfilesystem *fs);
+
 #endif // _UNIXFILESYSTEM_H_
@@ -0,0 +1,427 @@
+/**
+ * v6diff compares two V6 disk images (typically two snapshots of the
+ * same file system) and lists the paths that were added, removed or
+ * changed between them.  Both inode tables are loaded with one scan
+ * each, and the directory trees are walked together by name.  Files
+ * whose size, modification time and block map are all the same in
+ * both images are taken to be unchanged without reading their data,
+ * so comparing mostly-unchanged images costs about as much as reading
+ * their metadata.  The remaining candidates are compared block by
+ * block, stopping at the first difference.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <getopt.h>
+
+#include "diskimg.h"
+#include "unixfilesystem.h"
+#include "inode.h"
+#include "file.h"
+
+#define MAXPATH 1024
+
+/**
+ * One of the two images, with its inode table loaded.
+ */
+struct image {
+  const char *path;
+  int fd;
+  struct unixfilesystem *fs;
+  int ninodes;                  // Inumbers run from 1 to ninodes - 1
+  struct inode *inodes;         // By inumber
+  uint8_t *allocated;           // By inumber: inodes[i] is in use
+  uint8_t *visited;             // Directories already walked, by inumber
+};
+
+static struct image oldImage, newImage;
+static bool contentFlag = false;
+static bool statsFlag = false;
+static int numDifferences = 0;
+static int numErrors = 0;
+
+static struct {
+  long metadataSame;            // Files taken as unchanged from metadata
+  long dataCompared;            // Files whose data was compared
+  long bytesCompared;           // Bytes read from each image to do so
+} stats;
+
+static void OpenImage(struct image *im, char *path, bool mmapFlag);
+static void CloseImage(struct image *im);
+static void CompareTree(int olddir, int newdir, const char *relpath);
+static void PrintUsageAndExit(char *progname);
+
+int main(int argc, char *argv[]) {
+  bool mmapFlag = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "hcMs")) != -1) {
+    switch (opt) {
+    case 'c':
+      contentFlag = true;
+      break;
+    case 'M':
+      mmapFlag = true;
+      break;
+    case 's':
+      statsFlag = true;
+      break;
+    case 'h':
+    default:
+      PrintUsageAndExit(argv[0]);
+    }
+  }
+  if (optind != argc - 2) {
+    PrintUsageAndExit(argv[0]);
+  }
+
+  OpenImage(&oldImage, argv[optind], mmapFlag);
+  OpenImage(&newImage, argv[optind + 1], mmapFlag);
+
+  oldImage.visited[ROOT_INUMBER] = 1;
+  newImage.visited[ROOT_INUMBER] = 1;
+  CompareTree(ROOT_INUMBER, ROOT_INUMBER, "");
+
+  if (statsFlag) {
+    fprintf(stderr, "%ld files unchanged by metadata, %ld compared by data (%ld bytes each side)\n",
+            stats.metadataSame, stats.dataCompared, stats.bytesCompared);
+  }
+
+  CloseImage(&oldImage);
+  CloseImage(&newImage);
+  // The same convention as diff(1)
+  if (numErrors) exit(2);
+  exit(numDifferences ? 1 : 0);
+}
+
+/**
+ * Opens the image at path and loads its allocated inodes.  Exits on
+ * error.
+ */
+static void OpenImage(struct image *im, char *path, bool mmapFlag) {
+  im->path = path;
+  im->fd = diskimg_open(path, 1);
+  if (im->fd < 0) {
+    fprintf(stderr, "Can't open diskimagePath %s\n", path);
+    exit(2);
+  }
+  im->fs = mmapFlag ? unixfilesystem_init_mmap(im->fd)
+                    : unixfilesystem_init(im->fd);
+  if (!im->fs) {
+    fprintf(stderr, "Failed to initialize unix filesystem %s\n", path);
+    exit(2);
+  }
+
+  im->ninodes = im->fs->superblock.s_isize * 16 + 1;
+  im->inodes = malloc(im->ninodes * sizeof(struct inode));
+  im->allocated = calloc(im->ninodes, 1);
+  im->visited = calloc(im->ninodes, 1);
+  if (im->inodes == NULL || im->allocated == NULL || im->visited == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(2);
+  }
+
+  struct inodescan scan;
+  inode_scan_start(im->fs, &scan, 1);
+  int inumbers[INODE_SCAN_BATCH];
+  struct inode inodes[INODE_SCAN_BATCH];
+  int n;
+  while ((n = inode_scan_next(&scan, inumbers, inodes)) > 0) {
+    for (int i = 0; i < n; i++) {
+      im->inodes[inumbers[i]] = inodes[i];
+      im->allocated[inumbers[i]] = 1;
+    }
+  }
+  if (n < 0) {
+    fprintf(stderr, "%s: can't read inodes from %d on\n", path, scan.next);
+    exit(2);
+  }
+}
+
+static void CloseImage(struct image *im) {
+  free(im->inodes);
+  free(im->allocated);
+  free(im->visited);
+  unixfilesystem_free(im->fs);
+  (void) diskimg_close(im->fd);
+}
+
+/**
+ * Returns the inode im holds for inumber, or NULL (with a message) if
+ * there is no such allocated inode.
+ */
+static struct inode *GetInode(struct image *im, int inumber, const char *relpath) {
+  if (inumber <= 0 || inumber >= im->ninodes || !im->allocated[inumber]) {
+    fprintf(stderr, "%s: /%s: bad or free inode %d\n", im->path, relpath, inumber);
+    numErrors++;
+    return NULL;
+  }
+  return &im->inodes[inumber];
+}
+
+static long GetMtime(const struct inode *in) {
+  return ((long) in->i_mtime[0] << 16) | in->i_mtime[1];
+}
+
+static bool IsDir(const struct inode *in) {
+  return (in->i_mode & IFMT) == IFDIR;
+}
+
+static int CompareNames(const void *a, const void *b) {
+  const struct direntv6 *da = a, *db = b;
+  return strncmp(da->d_name, db->d_name, sizeof(da->d_name));
+}
+
+/**
+ * Reads the entries of directory inumber into a new array, which the
+ * caller frees, dropping free slots, "." and "..", and sorts them by
+ * name.  Returns the number of entries, or -1 on error.
+ */
+static int ReadDir(struct image *im, int inumber, struct direntv6 **entries) {
+  struct filecursor fc;
+  if (file_open(im->fs, inumber, &fc) < 0) return -1;
+  int max = fc.size / sizeof(struct direntv6);
+  *entries = malloc((max + 1) * sizeof(struct direntv6));
+  if (*entries == NULL) return -1;
+  int count = 0;
+  for (;;) {
+    const void *data;
+    int n = file_nextblocks(&fc, &data);
+    if (n < 0) {
+      free(*entries);
+      return -1;
+    }
+    if (n == 0) break;
+    const struct direntv6 *d = data;
+    for (int i = 0; i < n / (int) sizeof(struct direntv6); i++) {
+      if (d[i].d_inumber == 0 ||
+          strncmp(d[i].d_name, ".", sizeof(d[i].d_name)) == 0 ||
+          strncmp(d[i].d_name, "..", sizeof(d[i].d_name)) == 0) {
+        continue;
+      }
+      (*entries)[count++] = d[i];
+    }
+  }
+  qsort(*entries, count, sizeof(struct direntv6), CompareNames);
+  return count;
+}
+
+/**
+ * Builds the path of entry name under relpath.  Returns false (with a
+ * message) if it's too long.
+ */
+static bool ChildPath(char *childpath, const char *relpath, const struct direntv6 *d) {
+  if (snprintf(childpath, MAXPATH, "%s%s%.*s", relpath, relpath[0] ? "/" : "",
+               (int) sizeof(d->d_name), d->d_name) >= MAXPATH) {
+    fprintf(stderr, "/%s/%.*s: path too long, skipped\n", relpath,
+            (int) sizeof(d->d_name), d->d_name);
+    numErrors++;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Prints what happened to relpath, and to everything under it if
+ * it's a directory that was added or removed.
+ */
+static void Report(const char *what, struct image *im, int inumber, const char *relpath) {
+  printf("%s /%s\n", what, relpath);
+  numDifferences++;
+  if (what[0] == 'c' || !IsDir(&im->inodes[inumber]) || im->visited[inumber]) return;
+  im->visited[inumber] = 1;
+
+  struct direntv6 *entries;
+  int numentries = ReadDir(im, inumber, &entries);
+  if (numentries < 0) {
+    fprintf(stderr, "%s: can't read directory /%s\n", im->path, relpath);
+    numErrors++;
+    return;
+  }
+  for (int i = 0; i < numentries; i++) {
+    char childpath[MAXPATH];
+    if (!ChildPath(childpath, relpath, &entries[i])) continue;
+    if (GetInode(im, entries[i].d_inumber, childpath) == NULL) continue;
+    Report(what, im, entries[i].d_inumber, childpath);
+  }
+  free(entries);
+}
+
+/**
+ * Returns whether the two inodes, of the same size, map every block of
+ * the file to the same sector.
+ */
+static bool SameBlockMap(struct inode *oldin, struct inode *newin) {
+  int size = inode_getsize(oldin);
+  int nblocks = (size + DISKIMG_SECTOR_SIZE - 1) / DISKIMG_SECTOR_SIZE;
+  if ((oldin->i_mode & ILARG) != (newin->i_mode & ILARG)) return false;
+  for (int i = 0; i < nblocks; i++) {
+    int oldSector = inode_indexlookup(oldImage.fs, oldin, i);
+    if (oldSector < 0 || oldSector != inode_indexlookup(newImage.fs, newin, i)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Compares the data of the two files, which are the same size, a run
+ * of blocks at a time.  Returns 1 if it's the same, 0 if not, or -1 if
+ * either can't be read.
+ */
+static int SameData(int oldinumber, int newinumber) {
+  static struct filecursor oldfc, newfc;
+  if (file_open(oldImage.fs, oldinumber, &oldfc) < 0 ||
+      file_open(newImage.fs, newinumber, &newfc) < 0) {
+    return -1;
+  }
+  stats.dataCompared++;
+  const char *olddata = NULL, *newdata = NULL;
+  int oldlen = 0, newlen = 0;
+  for (;;) {
+    if (oldlen == 0) {
+      const void *data;
+      oldlen = file_nextblocks(&oldfc, &data);
+      olddata = data;
+    }
+    if (newlen == 0) {
+      const void *data;
+      newlen = file_nextblocks(&newfc, &data);
+      newdata = data;
+    }
+    if (oldlen < 0 || newlen < 0) return -1;
+    if (oldlen == 0 || newlen == 0) return oldlen == newlen;
+
+    int n = oldlen < newlen ? oldlen : newlen;
+    if (memcmp(olddata, newdata, n) != 0) return 0;
+    stats.bytesCompared += n;
+    olddata += n;
+    newdata += n;
+    oldlen -= n;
+    newlen -= n;
+  }
+}
+
+/**
+ * Reports relpath as changed if the two files (neither a directory)
+ * differ.
+ */
+static void CompareFile(int oldinumber, int newinumber, const char *relpath) {
+  struct inode *oldin = &oldImage.inodes[oldinumber];
+  struct inode *newin = &newImage.inodes[newinumber];
+  if ((oldin->i_mode & IFMT) != (newin->i_mode & IFMT) ||
+      inode_getsize(oldin) != inode_getsize(newin)) {
+    Report("changed", &newImage, newinumber, relpath);
+    return;
+  }
+  if ((oldin->i_mode & IFMT) == IFCHR || (oldin->i_mode & IFMT) == IFBLK) {
+    // V6 keeps the device number in i_addr[0]
+    if (oldin->i_addr[0] != newin->i_addr[0]) {
+      Report("changed", &newImage, newinumber, relpath);
+    }
+    return;
+  }
+
+  if (!contentFlag && GetMtime(oldin) == GetMtime(newin) &&
+      SameBlockMap(oldin, newin)) {
+    stats.metadataSame++;
+    return;
+  }
+  int same = SameData(oldinumber, newinumber);
+  if (same < 0) {
+    fprintf(stderr, "/%s: can't read inode %d or %d\n", relpath, oldinumber, newinumber);
+    numErrors++;
+  } else if (!same) {
+    Report("changed", &newImage, newinumber, relpath);
+  }
+}
+
+/**
+ * Compares everything under directory olddir of the old image with
+ * directory newdir of the new one, both at relpath ("" for the root).
+ */
+static void CompareTree(int olddir, int newdir, const char *relpath) {
+  struct direntv6 *oldents, *newents;
+  int numold = ReadDir(&oldImage, olddir, &oldents);
+  if (numold < 0) {
+    fprintf(stderr, "%s: can't read directory /%s\n", oldImage.path, relpath);
+    numErrors++;
+    return;
+  }
+  int numnew = ReadDir(&newImage, newdir, &newents);
+  if (numnew < 0) {
+    fprintf(stderr, "%s: can't read directory /%s\n", newImage.path, relpath);
+    numErrors++;
+    free(oldents);
+    return;
+  }
+
+  // Both lists are sorted, so merge them
+  int i = 0, j = 0;
+  while (i < numold || j < numnew) {
+    int cmp = i == numold ? 1 : j == numnew ? -1 :
+              CompareNames(&oldents[i], &newents[j]);
+    const struct direntv6 *d = cmp <= 0 ? &oldents[i] : &newents[j];
+    char childpath[MAXPATH];
+    if (!ChildPath(childpath, relpath, d)) {
+      if (cmp <= 0) i++;
+      if (cmp >= 0) j++;
+      continue;
+    }
+
+    if (cmp < 0) {
+      int inumber = oldents[i++].d_inumber;
+      if (GetInode(&oldImage, inumber, childpath)) {
+        Report("removed", &oldImage, inumber, childpath);
+      }
+      continue;
+    }
+    if (cmp > 0) {
+      int inumber = newents[j++].d_inumber;
+      if (GetInode(&newImage, inumber, childpath)) {
+        Report("added", &newImage, inumber, childpath);
+      }
+      continue;
+    }
+
+    int oldinumber = oldents[i++].d_inumber;
+    int newinumber = newents[j++].d_inumber;
+    struct inode *oldin = GetInode(&oldImage, oldinumber, childpath);
+    struct inode *newin = GetInode(&newImage, newinumber, childpath);
+    if (oldin == NULL || newin == NULL) continue;
+
+    if (IsDir(oldin) && IsDir(newin)) {
+      if (oldImage.visited[oldinumber] || newImage.visited[newinumber]) {
+        fprintf(stderr, "/%s: directory seen before, skipped\n", childpath);
+        numErrors++;
+        continue;
+      }
+      oldImage.visited[oldinumber] = 1;
+      newImage.visited[newinumber] = 1;
+      CompareTree(oldinumber, newinumber, childpath);
+    } else if (IsDir(oldin) || IsDir(newin)) {
+      // A directory replaced by a file or the other way round
+      Report("removed", &oldImage, oldinumber, childpath);
+      Report("added", &newImage, newinumber, childpath);
+    } else {
+      CompareFile(oldinumber, newinumber, childpath);
+    }
+  }
+  free(oldents);
+  free(newents);
+}
+
+static void PrintUsageAndExit(char *progname) {
+  fprintf(stderr, "Usage: %s <options> oldImagePath newImagePath\n", progname);
+  fprintf(stderr, "Prints \"added\", \"removed\" or \"changed\" and the path of each\n");
+  fprintf(stderr, "difference.  Exits 0 if there are none, 1 if there are, 2 on error.\n");
+  fprintf(stderr, "where <options> can be:\n");
+  fprintf(stderr, "-h     display this help message\n");
+  fprintf(stderr, "-c     compare the data of every file of the same size, even when\n");
+  fprintf(stderr, "       its modification time and blocks are unchanged\n");
+  fprintf(stderr, "-M     map the disk images instead of reading them\n");
+  fprintf(stderr, "-s     print how many files were compared by data to stderr\n");
+  exit(2);
+}
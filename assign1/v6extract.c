@@ -0,0 +1,427 @@
+/**
+ * v6extract copies everything in a V6 disk image out in one walk of
+ * its directory tree, either into a host directory or as a POSIX
+ * (ustar) tar stream on stdout.  File data is streamed with the file
+ * cursor and written in large chunks; modes and modification times
+ * are kept.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "diskimg.h"
+#include "unixfilesystem.h"
+#include "inode.h"
+#include "file.h"
+
+#define OUTBUF_SIZE (256 * 1024)
+#define TAR_BLOCK 512
+#define MAXPATH 1024
+
+/**
+ * Output buffered into large writes.  Exits on a write error.
+ */
+struct output {
+  int fd;
+  const char *name;             // For error messages
+  size_t len;
+  char buf[OUTBUF_SIZE];
+};
+
+static struct output out;
+static bool tarFlag = false;
+static const char *destdir;
+static uint8_t *visited;        // Directories already walked, by inumber
+static char **firstPath;        // Where each linked file was first put
+static int numErrors = 0;
+
+static void FlushOut(void);
+static void WriteOut(const void *data, size_t n);
+static void ExtractTree(struct unixfilesystem *fs, int dirinumber, const char *relpath);
+static void PrintUsageAndExit(char *progname);
+
+int main(int argc, char *argv[]) {
+  bool mmapFlag = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "hM")) != -1) {
+    switch (opt) {
+    case 'M':
+      mmapFlag = true;
+      break;
+    case 'h':
+    default:
+      PrintUsageAndExit(argv[0]);
+    }
+  }
+  if (optind != argc - 2) {
+    PrintUsageAndExit(argv[0]);
+  }
+
+  char *diskpath = argv[optind];
+  destdir = argv[optind + 1];
+  tarFlag = strcmp(destdir, "-") == 0;
+
+  int fd = diskimg_open(diskpath, 1);
+  if (fd < 0) {
+    fprintf(stderr, "Can't open diskimagePath %s\n", diskpath);
+    exit(EXIT_FAILURE);
+  }
+  struct unixfilesystem *fs = mmapFlag ? unixfilesystem_init_mmap(fd)
+                                       : unixfilesystem_init(fd);
+  if (!fs) {
+    fprintf(stderr, "Failed to initialize unix filesystem\n");
+    exit(EXIT_FAILURE);
+  }
+
+  int ninodes = fs->superblock.s_isize * 16 + 1;
+  visited = calloc(ninodes, 1);
+  firstPath = calloc(ninodes, sizeof(char *));
+  if (visited == NULL || firstPath == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (tarFlag) {
+    out.fd = STDOUT_FILENO;
+    out.name = "stdout";
+  } else if (mkdir(destdir, 0755) == -1 && errno != EEXIST) {
+    perror(destdir);
+    exit(EXIT_FAILURE);
+  }
+
+  visited[ROOT_INUMBER] = 1;
+  ExtractTree(fs, ROOT_INUMBER, "");
+
+  if (tarFlag) {
+    // Two zero blocks end the archive
+    static const char zeros[2 * TAR_BLOCK];
+    WriteOut(zeros, sizeof(zeros));
+    FlushOut();
+  }
+
+  for (int i = 0; i < ninodes; i++) {
+    free(firstPath[i]);
+  }
+  free(firstPath);
+  free(visited);
+  unixfilesystem_free(fs);
+  (void) diskimg_close(fd);
+  exit(numErrors ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+static void FlushOut(void) {
+  size_t done = 0;
+  while (done < out.len) {
+    ssize_t n = write(out.fd, out.buf + done, out.len - done);
+    if (n == -1 && errno == EINTR) continue;
+    if (n == -1) {
+      perror(out.name);
+      exit(EXIT_FAILURE);
+    }
+    done += n;
+  }
+  out.len = 0;
+}
+
+static void WriteOut(const void *data, size_t n) {
+  const char *p = data;
+  while (n > 0) {
+    size_t chunk = OUTBUF_SIZE - out.len;
+    if (chunk > n) chunk = n;
+    memcpy(out.buf + out.len, p, chunk);
+    out.len += chunk;
+    p += chunk;
+    n -= chunk;
+    if (out.len == OUTBUF_SIZE) FlushOut();
+  }
+}
+
+static long GetMtime(const struct inode *in) {
+  return ((long) in->i_mtime[0] << 16) | in->i_mtime[1];
+}
+
+/**
+ * Streams the data of file inumber to the output.  Returns the number
+ * of bytes written, which is short if a read fails.
+ */
+static int CopyData(struct unixfilesystem *fs, int inumber) {
+  struct filecursor fc;
+  if (file_open(fs, inumber, &fc) < 0) return 0;
+  int total = 0;
+  for (;;) {
+    const void *data;
+    int n = file_nextblocks(&fc, &data);
+    if (n <= 0) break;
+    WriteOut(data, n);
+    total += n;
+  }
+  return total;
+}
+
+/**
+ * Reads the entries of directory inumber into a new array, which the
+ * caller frees.  Returns the number of entries, or -1 on error.
+ */
+static int ReadDir(struct unixfilesystem *fs, int inumber, struct direntv6 **entries) {
+  struct filecursor fc;
+  if (file_open(fs, inumber, &fc) < 0) return -1;
+  int max = fc.size / sizeof(struct direntv6);
+  *entries = malloc((max + 1) * sizeof(struct direntv6));
+  if (*entries == NULL) return -1;
+  int count = 0;
+  for (;;) {
+    const void *data;
+    int n = file_nextblocks(&fc, &data);
+    if (n < 0) {
+      free(*entries);
+      return -1;
+    }
+    if (n == 0) break;
+    int num = n / sizeof(struct direntv6);
+    memcpy(*entries + count, data, num * sizeof(struct direntv6));
+    count += num;
+  }
+  return count;
+}
+
+/**
+ * Writes the ustar header for relpath.  Returns false if the path
+ * can't be stored in a header.
+ */
+static bool TarHeader(const char *relpath, const struct inode *in, char type,
+                      int size, const char *linkname) {
+  char h[TAR_BLOCK];
+  memset(h, 0, sizeof(h));
+
+  // Paths over 100 bytes are split at a "/" into prefix and name
+  size_t len = strlen(relpath);
+  const char *name = relpath;
+  if (len > 100) {
+    const char *slash = strchr(relpath + len - 101, '/');
+    if (slash == NULL || slash - relpath > 155) return false;
+    memcpy(h + 345, relpath, slash - relpath);
+    name = slash + 1;
+  }
+  if (strlen(name) > 100 || (linkname && strlen(linkname) > 100)) return false;
+  memcpy(h, name, strlen(name));
+  sprintf(h + 100, "%07o", in->i_mode & 07777);
+  sprintf(h + 108, "%07o", in->i_uid);
+  sprintf(h + 116, "%07o", in->i_gid);
+  sprintf(h + 124, "%011o", size);
+  sprintf(h + 136, "%011lo", GetMtime(in));
+  h[156] = type;
+  if (linkname) memcpy(h + 157, linkname, strlen(linkname));
+  memcpy(h + 257, "ustar", 6);
+  memcpy(h + 263, "00", 2);
+  if (type == '3' || type == '4') {
+    // V6 keeps the device number in i_addr[0]
+    sprintf(h + 329, "%07o", in->i_addr[0] >> 8);
+    sprintf(h + 337, "%07o", in->i_addr[0] & 0377);
+  }
+
+  // The checksum is computed with its own field as spaces
+  memset(h + 148, ' ', 8);
+  unsigned sum = 0;
+  for (int i = 0; i < TAR_BLOCK; i++) sum += (uint8_t) h[i];
+  sprintf(h + 148, "%06o", sum);
+  h[155] = ' ';
+
+  WriteOut(h, sizeof(h));
+  return true;
+}
+
+/**
+ * Sets the mode and modification time of an extracted file or
+ * directory.
+ */
+static void SetAttributes(const char *hostpath, const struct inode *in) {
+  if (chmod(hostpath, in->i_mode & 07777) == -1) {
+    perror(hostpath);
+    numErrors++;
+  }
+  struct timespec times[2] = {
+    { GetMtime(in), 0 },
+    { GetMtime(in), 0 },
+  };
+  if (utimensat(AT_FDCWD, hostpath, times, 0) == -1) {
+    perror(hostpath);
+    numErrors++;
+  }
+}
+
+static void ExtractFile(struct unixfilesystem *fs, int inumber, struct inode *in,
+                        const char *relpath, const char *hostpath) {
+  int size = inode_getsize(in);
+
+  // Later names of a linked file become hard links to the first
+  if (in->i_nlink > 1 && firstPath[inumber]) {
+    if (tarFlag) {
+      if (!TarHeader(relpath, in, '1', 0, firstPath[inumber])) {
+        fprintf(stderr, "%s: path too long for tar, skipped\n", relpath);
+        numErrors++;
+      }
+    } else {
+      char target[MAXPATH];
+      snprintf(target, sizeof(target), "%s/%s", destdir, firstPath[inumber]);
+      if (link(target, hostpath) == -1) {
+        perror(hostpath);
+        numErrors++;
+      }
+    }
+    return;
+  }
+  if (in->i_nlink > 1) firstPath[inumber] = strdup(relpath);
+
+  if (tarFlag) {
+    if (!TarHeader(relpath, in, '0', size, NULL)) {
+      fprintf(stderr, "%s: path too long for tar, skipped\n", relpath);
+      numErrors++;
+      return;
+    }
+  } else {
+    out.fd = open(hostpath, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    out.name = hostpath;
+    if (out.fd == -1) {
+      perror(hostpath);
+      numErrors++;
+      return;
+    }
+  }
+
+  int copied = CopyData(fs, inumber);
+  if (copied != size) {
+    fprintf(stderr, "%s: can't read inode %d past byte %d\n", relpath, inumber, copied);
+    numErrors++;
+  }
+
+  if (tarFlag) {
+    // Zero-fill what couldn't be read, then pad to a whole block, so the
+    // archive stays well formed
+    static const char zeros[TAR_BLOCK];
+    for (int n = size - copied; n > 0; n -= TAR_BLOCK) {
+      WriteOut(zeros, n < TAR_BLOCK ? n : TAR_BLOCK);
+    }
+    WriteOut(zeros, (TAR_BLOCK - size % TAR_BLOCK) % TAR_BLOCK);
+  } else {
+    FlushOut();
+    if (close(out.fd) == -1) {
+      perror(hostpath);
+      numErrors++;
+    }
+    SetAttributes(hostpath, in);
+  }
+}
+
+static void ExtractDevice(const struct inode *in, const char *relpath) {
+  if (!tarFlag) {
+    fprintf(stderr, "%s: device file skipped (only kept in tar output)\n", relpath);
+    return;
+  }
+  char type = (in->i_mode & IFMT) == IFCHR ? '3' : '4';
+  if (!TarHeader(relpath, in, type, 0, NULL)) {
+    fprintf(stderr, "%s: path too long for tar, skipped\n", relpath);
+    numErrors++;
+  }
+}
+
+/**
+ * Extracts everything under directory dirinumber, whose path relative
+ * to the root of the image is relpath ("" for the root itself).
+ */
+static void ExtractTree(struct unixfilesystem *fs, int dirinumber, const char *relpath) {
+  struct direntv6 *entries;
+  int numentries = ReadDir(fs, dirinumber, &entries);
+  if (numentries < 0) {
+    fprintf(stderr, "Can't read directory /%s\n", relpath);
+    numErrors++;
+    return;
+  }
+
+  for (int i = 0; i < numentries; i++) {
+    // Account for d_name not having null terminator
+    char name[sizeof(entries[i].d_name) + 1];
+    memcpy(name, entries[i].d_name, sizeof(entries[i].d_name));
+    name[sizeof(entries[i].d_name)] = '\0';
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+    int inumber = entries[i].d_inumber;
+    if (inumber == 0) continue;   // Free slot
+    if (name[0] == '\0' || strchr(name, '/') != NULL) {
+      fprintf(stderr, "/%s: entry for inode %d has a bad name, skipped\n", relpath, inumber);
+      numErrors++;
+      continue;
+    }
+
+    char childpath[MAXPATH];
+    char hostpath[MAXPATH];
+    if (snprintf(childpath, sizeof(childpath), "%s%s%s", relpath,
+                 relpath[0] ? "/" : "", name) >= (int) sizeof(childpath) ||
+        snprintf(hostpath, sizeof(hostpath), "%s/%s", destdir,
+                 childpath) >= (int) sizeof(hostpath)) {
+      fprintf(stderr, "/%s/%s: path too long, skipped\n", relpath, name);
+      numErrors++;
+      continue;
+    }
+
+    struct inode in;
+    if (inumber >= fs->superblock.s_isize * 16 + 1 ||
+        inode_iget(fs, inumber, &in) < 0 || !(in.i_mode & IALLOC)) {
+      fprintf(stderr, "/%s: bad or free inode %d, skipped\n", childpath, inumber);
+      numErrors++;
+      continue;
+    }
+
+    switch (in.i_mode & IFMT) {
+    case IFDIR: {
+      if (visited[inumber]) {
+        fprintf(stderr, "/%s: directory inode %d seen before, skipped\n", childpath, inumber);
+        numErrors++;
+        break;
+      }
+      visited[inumber] = 1;
+      if (tarFlag) {
+        char dirpath[MAXPATH + 1];
+        sprintf(dirpath, "%s/", childpath);
+        if (!TarHeader(dirpath, &in, '5', 0, NULL)) {
+          fprintf(stderr, "/%s: path too long for tar, skipped\n", childpath);
+          numErrors++;
+          break;
+        }
+      } else if (mkdir(hostpath, 0700) == -1 && errno != EEXIST) {
+        perror(hostpath);
+        numErrors++;
+        break;
+      }
+      ExtractTree(fs, inumber, childpath);
+      // After the contents, which would change the mtime and might
+      // need write permission
+      if (!tarFlag) SetAttributes(hostpath, &in);
+      break;
+    }
+    case IFCHR:
+    case IFBLK:
+      ExtractDevice(&in, childpath);
+      break;
+    default:
+      ExtractFile(fs, inumber, &in, childpath, hostpath);
+      break;
+    }
+  }
+  free(entries);
+}
+
+static void PrintUsageAndExit(char *progname) {
+  fprintf(stderr, "Usage: %s [-M] diskimagePath (destdir | -)\n", progname);
+  fprintf(stderr, "Copies every file in the image into destdir, or writes them\n");
+  fprintf(stderr, "to stdout as a tar archive if destdir is -.\n");
+  fprintf(stderr, "-h     display this help message\n");
+  fprintf(stderr, "-M     map the disk image instead of reading it\n");
+  exit(EXIT_FAILURE);
+}
@@ -0,0 +1,257 @@
+#include <string.h>
+
+#include "xxh3.h"
+
+#define PRIME32_1 0x9E3779B1U
+#define PRIME32_2 0x85EBCA77U
+#define PRIME32_3 0xC2B2AE3DU
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+#define PRIME_MX1 0x165667919E3779F9ULL
+#define PRIME_MX2 0x9FB21C651E98DF25ULL
+
+#define STRIPE_LEN 64
+#define SECRET_SIZE 192
+#define SECRET_CONSUME_RATE 8
+#define STRIPES_PER_BLOCK ((SECRET_SIZE - STRIPE_LEN) / SECRET_CONSUME_RATE)
+#define SECRET_MERGEACCS_START 11
+#define SECRET_LASTACC_START 7
+#define MIDSIZE_MAX 240
+#define MIDSIZE_STARTOFFSET 3
+#define MIDSIZE_LASTOFFSET 17
+
+static const uint8_t secret[SECRET_SIZE] = {
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+    0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+    0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+    0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+    0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+    0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+    0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+    0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+    0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+// Little-endian loads, which compile to plain moves on x86
+static uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t read64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t mul128_fold64(uint64_t a, uint64_t b) {
+    unsigned __int128 product = (unsigned __int128) a * b;
+    return (uint64_t) product ^ (uint64_t) (product >> 64);
+}
+
+static uint64_t xxh64_avalanche(uint64_t h) {
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    return h ^ (h >> 32);
+}
+
+static uint64_t avalanche(uint64_t h) {
+    h ^= h >> 37;
+    h *= PRIME_MX1;
+    return h ^ (h >> 32);
+}
+
+static uint64_t rrmxmx(uint64_t h, uint64_t len) {
+    h ^= rotl64(h, 49) ^ rotl64(h, 24);
+    h *= PRIME_MX2;
+    h ^= (h >> 35) + len;
+    h *= PRIME_MX2;
+    return h ^ (h >> 28);
+}
+
+static uint64_t mix16B(const uint8_t *in, const uint8_t *sec) {
+    return mul128_fold64(read64(in) ^ read64(sec), read64(in + 8) ^ read64(sec + 8));
+}
+
+// Inputs of up to MIDSIZE_MAX bytes are hashed in one go.
+static uint64_t hash_short(const uint8_t *in, size_t len) {
+    if (len == 0) {
+        return xxh64_avalanche(read64(secret + 56) ^ read64(secret + 64));
+    }
+    if (len <= 3) {
+        uint32_t combined = ((uint32_t) in[0] << 16) | ((uint32_t) in[len >> 1] << 24)
+                          | in[len - 1] | ((uint32_t) len << 8);
+        uint64_t bitflip = read32(secret) ^ read32(secret + 4);
+        return xxh64_avalanche(combined ^ bitflip);
+    }
+    if (len <= 8) {
+        uint64_t bitflip = read64(secret + 8) ^ read64(secret + 16);
+        uint64_t input64 = read32(in + len - 4) + ((uint64_t) read32(in) << 32);
+        return rrmxmx(input64 ^ bitflip, len);
+    }
+    if (len <= 16) {
+        uint64_t lo = read64(in) ^ (read64(secret + 24) ^ read64(secret + 32));
+        uint64_t hi = read64(in + len - 8) ^ (read64(secret + 40) ^ read64(secret + 48));
+        uint64_t acc = len + __builtin_bswap64(lo) + hi + mul128_fold64(lo, hi);
+        return avalanche(acc);
+    }
+    uint64_t acc = len * PRIME64_1;
+    if (len <= 128) {
+        if (len > 32) {
+            if (len > 64) {
+                if (len > 96) {
+                    acc += mix16B(in + 48, secret + 96);
+                    acc += mix16B(in + len - 64, secret + 112);
+                }
+                acc += mix16B(in + 32, secret + 64);
+                acc += mix16B(in + len - 48, secret + 80);
+            }
+            acc += mix16B(in + 16, secret + 32);
+            acc += mix16B(in + len - 32, secret + 48);
+        }
+        acc += mix16B(in, secret);
+        acc += mix16B(in + len - 16, secret + 16);
+        return avalanche(acc);
+    }
+    int nbRounds = len / 16;
+    for (int i = 0; i < 8; i++) {
+        acc += mix16B(in + 16 * i, secret + 16 * i);
+    }
+    acc = avalanche(acc);
+    for (int i = 8; i < nbRounds; i++) {
+        acc += mix16B(in + 16 * i, secret + 16 * (i - 8) + MIDSIZE_STARTOFFSET);
+    }
+    acc += mix16B(in + len - 16, secret + 136 - MIDSIZE_LASTOFFSET);
+    return avalanche(acc);
+}
+
+// The eight lanes are independent, so the compiler turns these loops
+// into vector code.
+static void accumulate_512(uint64_t *acc, const uint8_t *in, const uint8_t *sec) {
+    for (int i = 0; i < 8; i++) {
+        uint64_t data = read64(in + 8 * i);
+        uint64_t key = data ^ read64(sec + 8 * i);
+        acc[i ^ 1] += data;
+        acc[i] += (uint32_t) key * (key >> 32);
+    }
+}
+
+static void scramble(uint64_t *acc, const uint8_t *sec) {
+    for (int i = 0; i < 8; i++) {
+        uint64_t a = acc[i];
+        a ^= a >> 47;
+        a ^= read64(sec + 8 * i);
+        acc[i] = a * PRIME32_1;
+    }
+}
+
+static void accumulate(uint64_t *acc, const uint8_t *in, const uint8_t *sec,
+        size_t nbStripes) {
+    for (size_t n = 0; n < nbStripes; n++) {
+        accumulate_512(acc, in + n * STRIPE_LEN, sec + n * SECRET_CONSUME_RATE);
+    }
+}
+
+// Accumulates nbStripes stripes, scrambling at each block boundary.
+// Returns the new count of stripes into the current block.
+static size_t consume_stripes(uint64_t *acc, size_t soFar, const uint8_t *in,
+        size_t nbStripes) {
+    if (STRIPES_PER_BLOCK - soFar <= nbStripes) {
+        size_t toEnd = STRIPES_PER_BLOCK - soFar;
+        accumulate(acc, in, secret + soFar * SECRET_CONSUME_RATE, toEnd);
+        scramble(acc, secret + SECRET_SIZE - STRIPE_LEN);
+        accumulate(acc, in + toEnd * STRIPE_LEN, secret, nbStripes - toEnd);
+        return nbStripes - toEnd;
+    }
+    accumulate(acc, in, secret + soFar * SECRET_CONSUME_RATE, nbStripes);
+    return soFar + nbStripes;
+}
+
+void xxh3_init(struct xxh3_state *st) {
+    static const uint64_t initAcc[8] = {
+        PRIME32_3, PRIME64_1, PRIME64_2, PRIME64_3,
+        PRIME64_4, PRIME32_2, PRIME64_5, PRIME32_1,
+    };
+    memcpy(st->acc, initAcc, sizeof(initAcc));
+    st->bufferedSize = 0;
+    st->nbStripesSoFar = 0;
+    st->totalLen = 0;
+}
+
+void xxh3_update(struct xxh3_state *st, const void *data, size_t len) {
+    const uint8_t *in = data;
+    const size_t bufferStripes = XXH3_BUFFER_SIZE / STRIPE_LEN;
+    st->totalLen += len;
+
+    if (st->bufferedSize + len <= XXH3_BUFFER_SIZE) {
+        memcpy(st->buffer + st->bufferedSize, in, len);
+        st->bufferedSize += len;
+        return;
+    }
+
+    if (st->bufferedSize > 0) {
+        size_t fill = XXH3_BUFFER_SIZE - st->bufferedSize;
+        memcpy(st->buffer + st->bufferedSize, in, fill);
+        in += fill;
+        len -= fill;
+        st->nbStripesSoFar = consume_stripes(st->acc, st->nbStripesSoFar,
+                                             st->buffer, bufferStripes);
+        st->bufferedSize = 0;
+    }
+
+    // Always keep some input buffered for the digest
+    if (len > XXH3_BUFFER_SIZE) {
+        do {
+            st->nbStripesSoFar = consume_stripes(st->acc, st->nbStripesSoFar,
+                                                 in, bufferStripes);
+            in += XXH3_BUFFER_SIZE;
+            len -= XXH3_BUFFER_SIZE;
+        } while (len > XXH3_BUFFER_SIZE);
+        // The digest may need the last stripe consumed
+        memcpy(st->buffer + XXH3_BUFFER_SIZE - STRIPE_LEN, in - STRIPE_LEN, STRIPE_LEN);
+    }
+    memcpy(st->buffer, in, len);
+    st->bufferedSize = len;
+}
+
+uint64_t xxh3_digest(const struct xxh3_state *st) {
+    if (st->totalLen <= MIDSIZE_MAX) {
+        return hash_short(st->buffer, st->totalLen);
+    }
+
+    uint64_t acc[8];
+    memcpy(acc, st->acc, sizeof(acc));
+    const uint8_t *lastSecret = secret + SECRET_SIZE - STRIPE_LEN - SECRET_LASTACC_START;
+    if (st->bufferedSize >= STRIPE_LEN) {
+        size_t nbStripes = (st->bufferedSize - 1) / STRIPE_LEN;
+        consume_stripes(acc, st->nbStripesSoFar, st->buffer, nbStripes);
+        accumulate_512(acc, st->buffer + st->bufferedSize - STRIPE_LEN, lastSecret);
+    } else {
+        // The last stripe straddles the previous buffer load
+        uint8_t lastStripe[STRIPE_LEN];
+        size_t catchup = STRIPE_LEN - st->bufferedSize;
+        memcpy(lastStripe, st->buffer + XXH3_BUFFER_SIZE - catchup, catchup);
+        memcpy(lastStripe + catchup, st->buffer, st->bufferedSize);
+        accumulate_512(acc, lastStripe, lastSecret);
+    }
+
+    uint64_t result = st->totalLen * PRIME64_1;
+    for (int i = 0; i < 4; i++) {
+        const uint8_t *sec = secret + SECRET_MERGEACCS_START + 16 * i;
+        result += mul128_fold64(acc[2 * i] ^ read64(sec), acc[2 * i + 1] ^ read64(sec + 8));
+    }
+    return avalanche(result);
+}
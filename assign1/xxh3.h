@@ -0,0 +1,36 @@
+#ifndef _XXH3_H_
+#define _XXH3_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * XXH3-64 (seed 0, default secret), a fast non-cryptographic hash,
+ * computed incrementally.  The results match the reference xxHash
+ * library's XXH3_64bits.
+ */
+
+#define XXH3_BUFFER_SIZE 256
+
+struct xxh3_state {
+    uint64_t acc[8];
+    uint8_t buffer[XXH3_BUFFER_SIZE];
+    size_t bufferedSize;
+    size_t nbStripesSoFar;      // Stripes accumulated in the current block
+    uint64_t totalLen;
+};
+
+void xxh3_init(struct xxh3_state *st);
+
+/**
+ * Adds len bytes at data to the hash.
+ */
+void xxh3_update(struct xxh3_state *st, const void *data, size_t len);
+
+/**
+ * Returns the hash of everything added so far.  The state is left
+ * unchanged, so more data may be added afterwards.
+ */
+uint64_t xxh3_digest(const struct xxh3_state *st);
+
+#endif // _XXH3_H_
@@ -0,0 +1,40 @@
+#!/bin/bash
+#
+# Heap allocation test: path lookups and reads, and writes without the
+# journal, must not allocate once the file system is set up.  v6bench
+# counts allocations with a replacement operator new and reports
+# allocs_per_op for each run.  (Journaled writes allocate log records,
+# so they are not checked.)
+#
+# usage: alloctest.sh [ops]
+
+set -u
+BIN=$(cd "$(dirname "$0")" && pwd)
+OPS=${1:-500}
+
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+fails=0
+check() {
+    local journal=$1 workloads=$2
+    "$BIN/v6bench" -n "$OPS" -j "$journal" -w "$workloads" \
+                   "$TMP/bench.img" > "$TMP/out.json" ||
+        { echo "alloctest: v6bench failed" >&2; exit 1; }
+    local re='.*"workload": "\([a-z]*\)".*"allocs_per_op": \([^,]*\),.*'
+    local runs=0
+    while read -r workload allocs; do
+        runs=$((runs + 1))
+        if [ "$allocs" != 0 ]; then
+            echo "$workload (journal $journal): $allocs allocations per op"
+            fails=$((fails + 1))
+        fi
+    done < <(sed -n "s/$re/\\1 \\2/p" "$TMP/out.json")
+    [ $runs -gt 0 ] || { echo "alloctest: no allocs_per_op" >&2; exit 1; }
+}
+
+check off lookup,read,scanmix,write
+check on lookup,read,scanmix
+
+echo "alloctest: $fails failed"
+[ $fails -eq 0 ]
@@ -1,5 +1,6 @@
 
 #include <iostream>
+#include <unistd.h>
 
 #include "v6fs.hh"
 #include "replay.hh"
@@ -17,14 +18,25 @@ int
 main(int argc, char **argv)
 {
     auto [dir, prog] = splitpath(argv[0]);
-    if (argc != 2) {
-        fprintf(stderr, "usage: %s <fs-image>\n", prog.c_str());
+    std::string journal;
+    int opt;
+    while ((opt = getopt(argc, argv, "J:")) != -1)
+        switch (opt) {
+        case 'J':
+            journal = optarg;
+            break;
+        default:
+            argc = 0;
+        }
+    if (argc != optind + 1) {
+        fprintf(stderr, "usage: %s [-J journal] <fs-image>\n", prog.c_str());
         exit(1);
     }
 
     std::unique_ptr<V6FS> fsp;
     try {
-        fsp = std::make_unique<V6FS>(argv[1], cache, V6FS::V6_NOLOG);
+        fsp = std::make_unique<V6FS>(argv[optind], cache, V6FS::V6_NOLOG,
+                                     journal);
     }
     catch(const std::exception &e) {
         std::cerr << e.what() << std::endl;
@@ -53,9 +53,16 @@ blockpath_no(BlockPath pth)
 bool
 BlockPtrArray::check(bool dbl_indir)
 {
-    for (unsigned i = 0, e = size(); i < e; ++i)
-        if (uint16_t bn = data()[i])
-            if (fs().badblock(bn)
+    return check(fs(), data(), size(), dbl_indir);
+}
+
+bool
+BlockPtrArray::check(const V6FS &fs, const uint16_t *ptrs, unsigned n,
+                     bool dbl_indir)
+{
+    for (unsigned i = 0; i < n; ++i)
+        if (uint16_t bn = ptrs[i])
+            if (fs.badblock(bn)
                 // The maxiumum file size is 2^{24}-1 bytes, or 2^{16}
                 // sectors, so the last (IADDR_SIZE-1) block numbers
                 // in a double-indirect block must be all zeros.
@@ -128,6 +128,9 @@ struct BlockPtrArray {
     // corrupted (as might happen if an indirect block is not
     // propertly initialized).
     bool check(bool dbl_indir = false);
+    // Same check on n raw block pointers that aren't in the cache
+    static bool check(const V6FS &fs, const uint16_t *ptrs, unsigned n,
+                      bool dbl_indir = false);
 
 private:
     uint16_t *data() {
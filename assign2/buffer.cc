@@ -4,9 +4,19 @@
 void
 Buffer::bwrite()
 {
-    assert(!logged_ || V6Log::le(lsn_, fs().log_->committed_));
+    assert(!logged_ || fs().log_->is_committed(lsn_));
 
     fs().writeblock(mem_, blockno());
     initialized_ = true;
     dirty_ = logged_ = false;
 }
+
+void
+Buffer::writeback()
+{
+    if (!fs().async_writeback_)
+        return bwrite();
+    assert(!logged_ || fs().log_->is_committed(lsn_));
+    fs().wb_.submit(blockno(), mem_);
+    dirty_ = logged_ = false;
+}
@@ -1,10 +1,13 @@
 
+#include <stdio.h>
 #include <unistd.h>
 
 #include <cassert>
 #include <cstring>
 
 #include "bufio.hh"
+#include "stats.hh"
+#include "trace.hh"
 #include "util.hh"
 
 namespace {
@@ -104,3 +107,178 @@ FdWriter::seek(uint32_t pos)
     flush();
     pos_ = buf_start_ = pos;
 }
+
+// AsyncFdWriter invariants (on the caller's thread):
+//   * bufs_[cur_] is not busy_
+//   * buf_start_ <= pos_ < upper_bound(buf_start_)
+// Offset offset(x) of bufs_[cur_] holds the byte for file offset x.
+// In direct mode, the buffer also holds valid bytes from the start
+// of pos_'s DIRECT_ALIGN unit, so a widened write resends them.
+
+AsyncFdWriter::AsyncFdWriter(int fd, unsigned nbufs, bool direct)
+    : fd_(fd), direct_(direct), bufs_(new Buf[std::max(nbufs, 2u)]),
+      nbufs_(std::max(nbufs, 2u))
+{
+    thread_ = std::thread([this]() { run(); });
+}
+
+AsyncFdWriter::~AsyncFdWriter()
+{
+    try {
+        flush();
+    }
+    catch (const std::exception &e) {
+        fprintf(stderr, "AsyncFdWriter: %s\n", e.what());
+    }
+    {
+        std::lock_guard lk(mu_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    thread_.join();
+}
+
+void
+AsyncFdWriter::write(const void *_data, std::size_t len)
+{
+    const char *data = static_cast<const char *>(_data);
+    while (len > 0) {
+        uint32_t n = std::min<uint32_t>(upper_bound(buf_start_) - pos_, len);
+        std::memcpy(bufs_[cur_].data_ + offset(pos_), data, n);
+        pos_ += n;
+        data += n;
+        len -= n;
+        if (!offset(pos_) && submit())
+            next_buffer();
+    }
+}
+
+std::shared_future<void>
+AsyncFdWriter::flush_async()
+{
+    auto done = std::make_shared<std::promise<void>>();
+    std::shared_future<void> res = done->get_future().share();
+    if (submit(std::move(done)))
+        next_buffer();
+    return res;
+}
+
+void
+AsyncFdWriter::seek(uint32_t pos)
+{
+    if (submit())
+        next_buffer();
+    pos_ = buf_start_ = pos;
+    if (direct_) {
+        Buf &b = bufs_[cur_];
+        std::memset(b.data_, 0, sizeof(b.data_));
+        if (uint32_t lead = pos % DIRECT_ALIGN) {
+            flush();            // Don't read back a block still queued
+            if (::pread(fd_, b.data_ + offset(pos - lead), DIRECT_ALIGN,
+                        pos - lead) == -1)
+                threrror("pread");
+        }
+    }
+}
+
+// Queue bytes [buf_start_, pos_) for the I/O thread, plus an optional
+// promise to fulfill once they (and everything before them) have been
+// written.  Returns true if bufs_[cur_] now belongs to the I/O thread.
+bool
+AsyncFdWriter::submit(std::shared_ptr<std::promise<void>> done)
+{
+    Job j{ -1, buf_start_, pos_, std::move(done) };
+    if (pos_ > buf_start_) {
+        j.buf_ = cur_;
+        if (direct_) {
+            j.start_ -= j.start_ % DIRECT_ALIGN;
+            j.end_ += (DIRECT_ALIGN - j.end_ % DIRECT_ALIGN) % DIRECT_ALIGN;
+        }
+    }
+    else if (!j.done_)
+        return false;
+
+    const bool handoff = j.buf_ >= 0;
+    {
+        std::lock_guard lk(mu_);
+        if (!handoff && jobs_.empty() && !inflight_) {
+            // Nothing outstanding, so no need to involve the I/O thread
+            if (error_)
+                j.done_->set_exception(error_);
+            else
+                j.done_->set_value();
+            return false;
+        }
+        if (handoff)
+            bufs_[cur_].busy_ = true;
+        jobs_.push_back(std::move(j));
+    }
+    cv_.notify_all();
+    buf_start_ = pos_;
+    return handoff;
+}
+
+// Switch to the next buffer in the ring after handing off the
+// current one, waiting for the I/O thread to release it if needed.
+void
+AsyncFdWriter::next_buffer()
+{
+    const unsigned next = (cur_ + 1) % nbufs_;
+    {
+        std::unique_lock lk(mu_);
+        cv_.wait(lk, [this, next]() { return !bufs_[next].busy_; });
+    }
+    if (direct_) {
+        // The I/O thread only reads the old buffer, so it's safe to
+        // copy the partial block we may need to resend.
+        uint32_t keep = offset(pos_);
+        std::memcpy(bufs_[next].data_, bufs_[cur_].data_, keep);
+        std::memset(bufs_[next].data_ + keep, 0, BUF_SIZE - keep);
+    }
+    cur_ = next;
+}
+
+void
+AsyncFdWriter::run()
+{
+    TRACE_THREAD("AsyncFdWriter");
+    std::unique_lock lk(mu_);
+    for (;;) {
+        cv_.wait(lk, [this]() { return stop_ || !jobs_.empty(); });
+        if (jobs_.empty())
+            return;
+        Job j = std::move(jobs_.front());
+        jobs_.pop_front();
+        inflight_ = true;
+        std::exception_ptr err = error_;
+        lk.unlock();
+
+        // Once a write has failed, the rest of the stream is useless.
+        if (j.buf_ >= 0 && !err)
+            try {
+                stats::Timed _t(stats::ASYNC_PWRITE);
+                int len = j.end_ - j.start_;
+                TRACE_SPAN("io", "pwrite", "offset", j.start_,
+                           "bytes", len);
+                if (::pwrite(fd_, bufs_[j.buf_].data_ + offset(j.start_),
+                             len, j.start_) != len)
+                    threrror("pwrite");
+            }
+            catch (...) {
+                err = std::current_exception();
+            }
+
+        lk.lock();
+        inflight_ = false;
+        error_ = err;
+        if (j.buf_ >= 0)
+            bufs_[j.buf_].busy_ = false;
+        if (j.done_) {
+            if (error_)
+                j.done_->set_exception(error_);
+            else
+                j.done_->set_value();
+        }
+        cv_.notify_all();
+    }
+}
@@ -1,8 +1,15 @@
 
 #pragma once
 
+#include <condition_variable>
 #include <cstdint>
+#include <deque>
+#include <exception>
+#include <future>
+#include <memory>
+#include <mutex>
 #include <stdexcept>
+#include <thread>
 
 using std::size_t;
 using std::uint32_t;
@@ -49,3 +56,63 @@ public:
     void seek(uint32_t pos);
     uint32_t tell() const { return pos_; }
 };
+
+// A Writer that appends through a ring of two or more BUF_SIZE
+// buffers.  Full buffers (and buffers handed off by flush_async() or
+// seek()) are written by a dedicated I/O thread, so write() only
+// blocks when every buffer is still waiting for the disk.  Writes
+// are issued in the order they were submitted.
+//
+// With direct set, the descriptor is assumed to have been opened
+// with O_DIRECT, so each pwrite is widened to whole DIRECT_ALIGN
+// units.  Bytes beyond the current position in the last unit are
+// zero, so the caller must never have live data there.
+class AsyncFdWriter : public Writer {
+public:
+    static constexpr size_t DIRECT_ALIGN = 512;
+
+    const int fd_;
+    AsyncFdWriter(int fd, unsigned nbufs = 2, bool direct = false);
+    AsyncFdWriter(const AsyncFdWriter&) = delete;
+    AsyncFdWriter &operator=(const AsyncFdWriter&) = delete;
+    ~AsyncFdWriter();
+    void write(const void *, std::size_t) override;
+    // Hand everything written so far to the I/O thread.  The future
+    // becomes ready once all of it has been written, and rethrows
+    // any error the I/O thread encountered.
+    std::shared_future<void> flush_async();
+    void flush() { flush_async().get(); }
+    void seek(uint32_t pos);
+    uint32_t tell() const { return pos_; }
+
+private:
+    struct alignas(4096) Buf {
+        char data_[BUF_SIZE];
+        bool busy_ = false;     // Owned by the I/O thread
+    };
+    struct Job {
+        int buf_;               // -1 for a pure barrier
+        uint32_t start_, end_;  // File offsets of bytes to write
+        std::shared_ptr<std::promise<void>> done_;
+    };
+
+    const bool direct_;
+    std::unique_ptr<Buf[]> bufs_;
+    const unsigned nbufs_;
+    unsigned cur_ = 0;          // Buffer currently being filled
+    uint32_t buf_start_ = 0;    // First byte of cur_ not yet submitted
+    uint32_t pos_ = 0;
+
+    // State shared with the I/O thread, protected by mu_
+    std::mutex mu_;
+    std::condition_variable cv_;
+    std::deque<Job> jobs_;
+    bool inflight_ = false;
+    bool stop_ = false;
+    std::exception_ptr error_;
+    std::thread thread_;
+
+    bool submit(std::shared_ptr<std::promise<void>> done = nullptr);
+    void next_buffer();
+    void run();
+};
@@ -1,10 +1,19 @@
 
+#include <algorithm>
 #include <iostream>
 #include <set>
 
 #include "cache.hh"
+#include "trace.hh"
 #include "v6fs.hh"
 
+// Trace category for a cache, given its first stats counter
+[[maybe_unused]] static const char *
+cache_name(stats::Counter st)
+{
+    return st == stats::INODE_CACHE ? "inode" : "buffer";
+}
+
 void
 report(const char *msg, const std::exception *e)
 {
@@ -24,15 +33,20 @@ CacheEntryBase::can_evict()
         return false;
     if (!logged_)
         return true;
-    return V6Log::le(lsn_, fs().log_->committed_);
+    return fs().log_->is_committed(lsn_);
 }
 
 CacheEntryBase *
 CacheBase::lookup(V6FS *dev, uint16_t id)
 {
     CacheEntryBase *e = index_[{dev, id}];
-    if (e)
+    if (e) {
+        stats::add(stats_, stats::HIT);
+        TRACE_INSTANT(cache_name(stats_), "hit", "id", id);
         return touch(e);
+    }
+    stats::add(stats_, stats::MISS);
+    TRACE_INSTANT(cache_name(stats_), "miss", "id", id);
     e = alloc();
     if (!e) {
         flush_all_logs();
@@ -45,7 +59,7 @@ CacheBase::lookup(V6FS *dev, uint16_t id)
     e->dev_ = dev;
     e->id_ = id;
     index_.insert(e);
-    return touch(e);
+    return take_ghost({dev, id}) ? promote(e) : insert(e);
 }
 
 void
@@ -54,10 +68,10 @@ CacheBase::free_entry(CacheEntryBase *e)
     // If the next line throws an assertion failure, you attempted to
     // double-free a cache entry.
     e->idxlink_.unlink();
-    e->logged_ = e->dirty_ = e->initialized_ = false;
+    e->logged_ = e->dirty_ = e->initialized_ = e->metadata_ = false;
     e->dev_ = nullptr;
     e->id_ = 0;
-    lrulist_.remove(e);
+    unlist(e);
     lrulist_.push_front(e);
 }
 
@@ -91,54 +105,179 @@ CacheBase::invalidate_dev(V6FS *dev) noexcept
         b = index_.next(b);
         free_entry(c);
     }
+    // A later V6FS could get the same address
+    for (auto &k : ghosts_)
+        if (k.first == dev)
+            k = {};
 }
 
-// Move entry to the back of the LRU list when it is used
+// Move entry to the back of the LRU list when it is used.  Under 2Q,
+// a hit on probation doesn't count, since it is most likely part of
+// the same burst of use (reading each block of a file touches its
+// indirect block again).
 CacheEntryBase *
 CacheBase::touch(CacheEntryBase *e)
 {
-    lrulist_.remove(e);
+    if (policy_ == CachePolicy::LRU)
+        return insert(e);
+    if (e->hot_) {
+        hotlist_.remove(e);
+        hotlist_.push_back(e);
+    }
+    return e;
+}
+
+// Move an entry to the back of the 2Q protected list
+CacheEntryBase *
+CacheBase::promote(CacheEntryBase *e)
+{
+    unlist(e);
+    e->hot_ = true;
+    ++nhot_;
+    hotlist_.push_back(e);
+    return e;
+}
+
+// Put a newly loaded entry at the back of the LRU (or probation) list
+CacheEntryBase *
+CacheBase::insert(CacheEntryBase *e)
+{
+    unlist(e);
     lrulist_.push_back(e);
     return e;
 }
 
+// Take e off whichever list it is on
+void
+CacheBase::unlist(CacheEntryBase *e)
+{
+    if (e->hot_) {
+        e->hot_ = false;
+        --nhot_;
+    }
+    lrulist_.remove(e);
+}
+
+// True if k was recently evicted from probation, and forget it
+bool
+CacheBase::take_ghost(CacheEntryBase::CacheKey k)
+{
+    auto g = std::find(ghosts_.begin(), ghosts_.end(), k);
+    if (g == ghosts_.end())
+        return false;
+    *g = {};
+    return true;
+}
+
+// Return the first entry for which usable(e) is true, in the order
+// entries should be recycled.
+template<typename F> CacheEntryBase *
+CacheBase::find_victim(F &&usable)
+{
+    auto scan = [this, &usable](CacheEntryBase *e, auto &&want) {
+        for (; e; e = lrulist_.next(e))
+            if (want(e) && usable(e))
+                return e;
+        return static_cast<CacheEntryBase *>(nullptr);
+    };
+    auto all = [](CacheEntryBase *) { return true; };
+    auto free = [](CacheEntryBase *e) { return !e->idxlink_.is_linked(); };
+    auto data = [](CacheEntryBase *e) {
+        return e->idxlink_.is_linked() && !e->metadata_;
+    };
+    auto meta = [](CacheEntryBase *e) { return e->metadata_; };
+
+    if (policy_ == CachePolicy::LRU)
+        return scan(lrulist_.front(), all);
+    // Recycle probation entries while they fill more than a quarter
+    // of the cache, otherwise protected ones.  Metadata goes last.
+    auto *first = &lrulist_, *second = &hotlist_;
+    if (capacity_ - nhot_ <= capacity_ / 4)
+        std::swap(first, second);
+    CacheEntryBase *e = scan(lrulist_.front(), free);
+    if (!e)
+        e = scan(first->front(), data);
+    if (!e)
+        e = scan(second->front(), data);
+    if (!e)
+        e = scan(first->front(), meta);
+    if (!e)
+        e = scan(second->front(), meta);
+    return e;
+}
+
 // Find a not recently used entry that is free or can be evicted.
 CacheEntryBase *
 CacheBase::alloc()
 {
-    for (CacheEntryBase *e = lrulist_.front(); e; e = lrulist_.next(e))
-        if (!e->idxlink_.is_linked()) {
-            return e;
-        }
-        else if (e->can_evict()) {
-            if (e->dirty_) {
-                e->writeback();
-                e->dirty_ = e->logged_ = false;
-            }
-            e->idxlink_.unlink();
-            e->logged_ = e->dirty_ = e->initialized_ = false;
-            return e;
-        }
-    return nullptr;
+    CacheEntryBase *e = find_victim([](CacheEntryBase *e) {
+        return !e->idxlink_.is_linked() || e->can_evict();
+    });
+    if (!e || !e->idxlink_.is_linked())
+        return e;
+    stats::add(stats_, stats::EVICT);
+    TRACE_INSTANT(cache_name(stats_), "evict", "id", e->id_,
+                  "dirty", e->dirty_);
+    if (e->dirty_) {
+        stats::add(stats_, stats::WRITEBACK);
+        TRACE_SPAN(cache_name(stats_), "writeback",
+                   "id", e->id_, "lsn", e->lsn_);
+        e->writeback();
+        e->dirty_ = e->logged_ = false;
+    }
+    if (!ghosts_.empty() && !e->hot_) {
+        ghosts_[ghost_next_] = e->cache_key();
+        ghost_next_ = (ghost_next_ + 1) % ghosts_.size();
+    }
+    e->idxlink_.unlink();
+    e->logged_ = e->dirty_ = e->initialized_ = e->metadata_ = false;
+    return e;
 }
 
 bool
 CacheBase::can_alloc(int want)
 {
-    int n = want;
-    for (CacheEntryBase *e = lrulist_.front(); e && n > 0;
-         e = lrulist_.next(e))
-        if (!e->idxlink_.is_linked() || e->can_evict())
-            --n;
-    if (!n)
+    if (want <= 0)
+        return true;
+    auto enough = [this, want]() {
+        int n = want;
+        return find_victim([&n](CacheEntryBase *e) {
+            return (!e->idxlink_.is_linked() || e->can_evict()) && --n == 0;
+        }) != nullptr;
+    };
+    if (enough())
         return true;
     flush_all_logs();
-    n = want;
-    for (CacheEntryBase *e = lrulist_.front(); e && n > 0;
-         e = lrulist_.next(e))
-        if (!e->idxlink_.is_linked() || e->can_evict())
-            --n;
-    return !n;
+    return enough();
+}
+
+std::vector<uint16_t>
+CacheBase::lru_ids(V6FS *dev) const
+{
+    std::vector<uint16_t> ids;
+    for (auto *list : { &lrulist_, &hotlist_ })
+        for (const CacheEntryBase *e = list->front(); e; e = list->next(e))
+            if (e->idxlink_.is_linked() && e->dev_ == dev)
+                ids.push_back(e->id_);
+    return ids;
+}
+
+void
+CacheBase::set_policy(CachePolicy p)
+{
+    policy_ = p;
+    ghosts_.assign(p == CachePolicy::TWO_Q ? capacity_ / 2 + 1 : 0,
+                   CacheEntryBase::CacheKey{});
+    ghost_next_ = 0;
+    if (p == CachePolicy::LRU)
+        while (CacheEntryBase *e = hotlist_.front())
+            insert(e);
+}
+
+void
+CacheBase::mark_metadata(CacheEntryBase *e)
+{
+    e->metadata_ = true;
 }
 
 // If we can't evict any cache slots, it's probably because we've
@@ -148,12 +287,22 @@ CacheBase::can_alloc(int want)
 void
 CacheBase::flush_all_logs()
 {
+    stats::add(stats::CACHE_LOG_STALL);
+    TRACE_SPAN("cache", "flush_all_logs");
     std::set<V6FS*> fses;
-    for (CacheEntryBase *ce = lrulist_.front(); ce; ce = lrulist_.next(ce))
-        if(ce->dev_->log_)
+    for (CacheEntryBase *ce = index_.min(); ce; ce = index_.next(ce))
+        if (ce->dev_->log_)
             fses.insert(ce->dev_);
+    // Start every flush before waiting, so the writes overlap.
+    std::vector<std::shared_future<void>> flushes;
     for (V6FS *dev : fses)
-        dev->log_->flush();
+        flushes.push_back(dev->log_->flush_async());
+    for (auto &f : flushes)
+        f.wait();
+    for (V6FS *dev : fses) {
+        dev->log_->reap();
+        dev->log_->throw_write_error();
+    }
 }
 
 bool
@@ -163,9 +312,16 @@ CacheBase::flush_range(CacheEntryBase *b, CacheEntryBase *end) noexcept
     while (b != end) {
         CacheEntryBase *c = b;
         b = index_.next(b);
-        if (c->dirty_ &&
-            (!c->logged_ || V6Log::le(c->lsn_, c->dev_->log_->committed_)))
+        if (c->dirty_)
             try {
+                if (c->logged_ && !c->dev_->log_->is_committed(c->lsn_)) {
+                    // Not in the log yet, or never will be
+                    c->dev_->log_->throw_write_error();
+                    continue;
+                }
+                stats::add(stats_, stats::WRITEBACK);
+                TRACE_SPAN(cache_name(stats_), "writeback",
+                           "id", c->id_, "lsn", c->lsn_);
                 c->writeback();
                 c->dirty_ = c->logged_ = false;
             } catch (std::exception &e) {
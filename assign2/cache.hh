@@ -6,6 +6,7 @@
 #include <utility>
 
 #include "ilist.hh"
+#include "stats.hh"
 #include "util.hh"
 #include "itree.hh"
 
@@ -27,6 +28,8 @@ struct CacheEntryBase {
     bool initialized_ = false;
     bool dirty_ = false;
     bool logged_ = false;       // Contains a logged patch
+    bool hot_ = false;          // On the 2Q protected list
+    bool metadata_ = false;     // Indirect or directory block
     uint32_t lsn_;              // Log sequence number if logged_
     ilist_entry lrulink_;
     itree_entry idxlink_;
@@ -40,6 +43,16 @@ struct CacheEntryBase {
     CacheKey cache_key() const { return {dev_, id_}; }
 };
 
+// How a cache chooses which entry to recycle
+enum class CachePolicy {
+    LRU,                        // Least recently used
+    // 2Q: entries start on a FIFO probation list, and only move to
+    // the protected (LRU) list if loaded again soon after leaving
+    // probation.  So a one-pass scan only churns the probation list.
+    // Metadata is recycled after everything else.
+    TWO_Q,
+};
+
 class CacheBase {
 public:
     // Remove an item from the index, discard its contents, and put it
@@ -59,12 +72,33 @@ public:
     // The next n allocations will succeed.
     bool can_alloc(int n = 1);
 
+    // Ids of dev's cached entries, least recently used first.
+    std::vector<uint16_t> lru_ids(V6FS *dev) const;
+
+    void set_policy(CachePolicy p);
+    CachePolicy policy() const { return policy_; }
+
+    // Note that e holds metadata, which is worth keeping over file
+    // data.  Only affects 2Q.
+    void mark_metadata(CacheEntryBase *e);
+
 protected:
     std::string oom_ = "cache full";
+    stats::Counter stats_;      // First of this cache's counters
+    const size_t capacity_;
+    CachePolicy policy_ = CachePolicy::LRU;
+    // Free entries, then LRU order (or for 2Q, probation FIFO order)
     ilist<&CacheEntryBase::lrulink_> lrulist_;
+    ilist<&CacheEntryBase::lrulink_> hotlist_; // 2Q protected, LRU order
+    size_t nhot_ = 0;           // Entries on hotlist_
+    // Keys recently evicted from probation, oldest at ghost_next_.
+    // Searched linearly on a miss, which is cheap next to the read.
+    std::vector<CacheEntryBase::CacheKey> ghosts_;
+    size_t ghost_next_ = 0;
     itree<&CacheEntryBase::cache_key, &CacheEntryBase::idxlink_> index_;
 
-    CacheBase() = default;
+    CacheBase(stats::Counter st, size_t capacity)
+        : stats_(st), capacity_(capacity) {}
     CacheEntryBase *lookup(V6FS *dev, uint16_t id);
     CacheEntryBase *try_lookup(V6FS *dev, uint16_t id) {
         return index_[{dev, id}];
@@ -72,6 +106,11 @@ protected:
 
 private:
     CacheEntryBase *touch(CacheEntryBase *);
+    CacheEntryBase *insert(CacheEntryBase *);
+    CacheEntryBase *promote(CacheEntryBase *);
+    void unlist(CacheEntryBase *);
+    bool take_ghost(CacheEntryBase::CacheKey k);
+    template<typename F> CacheEntryBase *find_victim(F &&usable);
     CacheEntryBase *alloc();
     void flush_all_logs();
     bool flush_range(CacheEntryBase *begin, CacheEntryBase *end) noexcept;
@@ -129,7 +168,8 @@ struct Cache : CacheBase {
     const size_t size_;
 
     explicit Cache(size_t size)
-        : CacheBase(), entries_(new value_type[size]), size_(size) {
+        : CacheBase(T::cache_stats, size), entries_(new value_type[size]),
+          size_(size) {
         for (size_t i = 0; i < size; ++i)
             lrulist_.push_back(&entries_[i]);
         oom_ = std::string(typeid(T).name()) + " cache full";
@@ -0,0 +1,179 @@
+#include <algorithm>
+#include <cstring>
+#include <optional>
+#include <sstream>
+
+#include "blockpath.hh"
+#include "defrag.hh"
+#include "log.hh"
+
+namespace {
+
+// Most blocks to move in one transaction
+constexpr uint32_t BATCH_BLOCKS = 32;
+// A moved block is logged in pieces this size (LogPatch holds at
+// most 255 bytes), skipping pieces that are all zero.
+constexpr unsigned PATCH_BYTES = SECTOR_SIZE / 4;
+
+// Call f(ba, i, depth) on every non-zero pointer ba.at(i) of ip in
+// the order of a sequential read, where depth is the number of levels
+// of indirect blocks below that pointer.  f may change the pointer;
+// children are found through its new value.
+template<typename F> void
+walk_ptr(BlockPtrArray &ba, unsigned i, int depth, F &f)
+{
+    if (!ba.at(i))
+        return;
+    f(ba, i, depth);
+    if (depth > 0) {
+        BlockPtrArray child(ba.fetch_at(i));
+        for (unsigned j = 0; j < child.size(); ++j)
+            walk_ptr(child, j, depth - 1, f);
+    }
+}
+
+template<typename F> void
+walk(Ref<Inode> ip, F &&f)
+{
+    const bool large = ip->i_mode & ILARG;
+    BlockPtrArray ba(ip);
+    for (unsigned i = 0; i < ba.size(); ++i)
+        walk_ptr(ba, i, !large ? 0 : i < IADDR_SIZE-1 ? 1 : 2, f);
+}
+
+struct Layout {
+    uint32_t blocks = 0;
+    uint32_t extents = 0;
+};
+
+Layout
+layout(Ref<Inode> ip)
+{
+    Layout l;
+    uint32_t prev = 0;
+    walk(ip, [&l, &prev](BlockPtrArray &ba, unsigned i, int) {
+        uint16_t bn = ba.at(i);
+        if (bn != prev + 1)
+            ++l.extents;
+        prev = bn;
+        ++l.blocks;
+    });
+    return l;
+}
+
+// First block of the lowest run of n free blocks, or 0 if none
+uint16_t
+free_run(const Bitmap &freemap, uint32_t n)
+{
+    const size_t max = freemap.max_index();
+    for (int start = freemap.find1(freemap.min_index()); start >= 0;) {
+        size_t end = start;
+        while (end < max && end - start < n && freemap.at(end))
+            ++end;
+        if (end - start == n)
+            return start;
+        if (end >= max)
+            break;
+        start = freemap.find1(end);
+    }
+    return 0;
+}
+
+// Copy the block ba.at(i) to dest, which must be free, and point
+// ba.at(i) at the copy.  Must be called inside a transaction.
+void
+move_block(BlockPtrArray &ba, unsigned i, uint16_t dest)
+{
+    V6FS &fs = ba.fs();
+    const uint16_t src = ba.at(i);
+    // Zero dest on replay, so only non-zero pieces need logging.
+    if (fs.log_->balloc_near(dest, true) != dest)
+        throw std::logic_error("defrag: destination block not free");
+    Ref<Buffer> bp = fs.bget(dest);
+    memcpy(bp->mem_, fs.bread(src)->mem_, SECTOR_SIZE);
+    bp->bdwrite();
+    for (char *p = bp->mem_; p < bp->mem_ + SECTOR_SIZE; p += PATCH_BYTES)
+        if (std::any_of(p, p + PATCH_BYTES, [](char c) { return c; }))
+            fs.log_patch(p, PATCH_BYTES);
+    ba.set_at(i, dest);
+    fs.bfree(src);
+}
+
+} // anonymous namespace
+
+std::string
+DefragStats::summary() const
+{
+    std::ostringstream os;
+    os << files << " files, " << fragmented << " fragmented, "
+       << moved << " defragmented (" << blocks_moved << " blocks moved)\n"
+       << "extents: " << extents_before << " before, "
+       << extents_after << " after\n";
+    return os.str();
+}
+
+uint32_t
+file_extents(Ref<Inode> ip)
+{
+    return layout(ip).extents;
+}
+
+void
+defrag_file(Ref<Inode> ip, DefragStats *st)
+{
+    V6FS &fs = ip->fs();
+    if (!fs.log_)
+        throw std::logic_error("defrag_file: file system has no journal");
+
+    const Layout before = layout(ip);
+    ++st->files;
+    st->extents_before += before.extents;
+    uint16_t dest = 0;
+    if (before.extents > 1) {
+        ++st->fragmented;
+        dest = free_run(fs.log_->freemap_, before.blocks);
+    }
+    if (!dest) {
+        st->extents_after += before.extents;
+        return;
+    }
+
+    // Keep transactions small enough that their dirty blocks fit in
+    // the cache, since none of them can be written back until the
+    // transaction commits.
+    std::optional<Tx> tx;
+    uint32_t batch = 0;
+    walk(ip, [&](BlockPtrArray &ba, unsigned i, int) {
+        if (!tx)
+            tx.emplace(fs.begin());
+        move_block(ba, i, dest++);
+        if (++batch == BATCH_BLOCKS || !fs.cache_.b.can_alloc(2)) {
+            tx.reset();
+            batch = 0;
+        }
+    });
+    tx.reset();
+
+    ++st->moved;
+    st->blocks_moved += before.blocks;
+    st->extents_after += file_extents(ip);
+}
+
+void
+defrag_inode(V6FS &fs, uint16_t inum, DefragStats *st)
+{
+    Ref<Inode> ip = fs.iget(inum);
+    const uint16_t fmt = ip->i_mode & IFMT;
+    if ((ip->i_mode & IALLOC) && (fmt == IFREG || fmt == IFDIR))
+        defrag_file(ip, st);
+}
+
+DefragStats
+defrag_fs(V6FS &fs)
+{
+    DefragStats st;
+    const unsigned ninodes = fs.superblock().s_isize * INODES_PER_BLOCK;
+    for (unsigned inum = ROOT_INUMBER; inum <= ninodes; ++inum)
+        defrag_inode(fs, inum, &st);
+    return st;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string>
+
+#include "v6fs.hh"
+
+// Online defragmentation.  Defragmenting a file copies all its blocks
+// into one free run, in the order a sequential read visits them (each
+// indirect block just ahead of the blocks it points to).  Every copy
+// is logged as a LogBlockAlloc, the block's contents as LogPatch
+// records, the pointer update and a LogBlockFree of the old block, so
+// a crash part way through leaves each file intact in either its old
+// or its new place.  All of this requires a journaled file system.
+
+struct DefragStats {
+    unsigned files = 0;         // Regular files and directories seen
+    unsigned fragmented = 0;    // Files with more than one extent
+    unsigned moved = 0;         // Fragmented files made contiguous
+    uint32_t extents_before = 0;
+    uint32_t extents_after = 0;
+    uint32_t blocks_moved = 0;
+
+    std::string summary() const;
+};
+
+// Number of contiguous runs of blocks in a file, counting indirect
+// blocks and ignoring holes.
+uint32_t file_extents(Ref<Inode> ip);
+
+// Move ip's blocks into the first free run big enough to hold them
+// all, if ip is fragmented and there is one.  Adds the results to st.
+void defrag_file(Ref<Inode> ip, DefragStats *st);
+
+// Defragment inode inum if it is an allocated file or directory.
+void defrag_inode(V6FS &fs, uint16_t inum, DefragStats *st);
+
+// Defragment every file in the file system.
+DefragStats defrag_fs(V6FS &fs);
@@ -1,10 +1,14 @@
-
 #include <fcntl.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <array>
 #include <string>
+#include <vector>
 
 #include "log.hh"
 #include "layout.hh"
@@ -16,37 +20,58 @@ struct closefd {
     ~closefd() { close(fd); }
 };
 
-void
-read_log(const char *image, int startpos)
-try {
-    int fd = open(image, O_RDONLY);
-    if (fd == -1)
-        threrror(image);
-
+// The file holding the log, which is the image unless the log is in
+// an external journal.
+struct LogFile {
+    closefd fd;
+    std::string path;
     filsys fs;
-    if (pread(fd, &fs, sizeof(fs), SUPERBLOCK_SECTOR * SECTOR_SIZE) !=
+    loghdr lh;
+
+    LogFile(const char *image, std::string journal);
+};
+
+LogFile::LogFile(const char *image, std::string journal)
+    : path(image)
+{
+    if ((fd.fd = open(image, O_RDONLY)) == -1)
+        threrror(image);
+    if (pread(fd.fd, &fs, sizeof(fs), SUPERBLOCK_SECTOR * SECTOR_SIZE) !=
         sizeof(fs)) {
         fprintf(stderr, "can't read superblock\n");
         exit(1);
     }
-    loghdr lh;
-    read_loghdr(fd, &lh, fs.s_fsize);
+    if (fs.logid()) {
+        path = journal.empty() ? journal_path(image) : journal;
+        close(fd.fd);
+        if ((fd.fd = open(path.c_str(), O_RDONLY)) == -1)
+            threrror(path.c_str());
+    }
+    read_loghdr(fd.fd, &lh, fs);
+}
 
-    FdReader f(fd);
+void
+read_log(LogFile &lf, int startpos)
+try {
+    FdReader f(lf.fd.fd);
     if (startpos < 0)
-        f.seek(lh.l_checkpoint);
-    else if (size_t(startpos) <= lh.logstart() * SECTOR_SIZE)
-        f.seek(lh.logstart() * SECTOR_SIZE);
+        f.seek(lf.lh.l_checkpoint);
+    else if (size_t(startpos) <= lf.lh.logstart() * SECTOR_SIZE)
+        f.seek(lf.lh.logstart() * SECTOR_SIZE);
     else
         f.seek(startpos);
 
     bool above = true;
     uint32_t pos = f.tell();
-    while (above || pos < lh.l_checkpoint) {
+    while (above || pos < lf.lh.l_checkpoint) {
         LogEntry le;
         printf("[offset %u]\n", f.tell());
         le.load(f);
-        puts(le.show(&fs).c_str());
+        puts(le.show(&lf.fs).c_str());
+        // From the checkpoint, go on with the live entries at the
+        // start of the log area; otherwise those are already printed.
+        if (startpos < 0 && le.get<LogRewind>())
+            f.seek(lf.lh.logstart() * SECTOR_SIZE);
         uint32_t newpos = f.tell();
         if (newpos < pos)
             above = false;
@@ -58,10 +83,322 @@ catch(log_corrupt &e) {
     exit(0);
 }
 
+// The sidecar index, <log file>.logidx, lets queries skip decoding
+// entries that don't match.  It lists the live entries in the order
+// replay reads them:  from the checkpoint, through a LogRewind back to
+// the start of the log area, until the LSNs stop following on.  It is
+// rebuilt whenever the log file's size or mtime no longer match.
+
+constexpr uint64_t INDEX_MAGIC = 0x3278646967306c36; // "6l0gidx2"
+constexpr uint16_t NO_BLOCK = 0;  // Never a data block, so means none
+
+struct IndexHeader {
+    uint64_t magic;
+    uint64_t log_size;          // st_size of the log file
+    int64_t log_mtime_ns;       // st_mtim of the log file
+    uint32_t nrecords;
+    uint32_t pad;
+};
+
+struct IndexRecord {
+    lsn_t lsn;
+    uint32_t offset;            // Position in the log file
+    uint32_t nbytes;            // Size of the entry on disk
+    uint16_t block;             // Block patched, allocated or freed
+    uint8_t type;               // Index in LogEntry::entry_type
+    uint8_t pad;
+};
+static_assert(sizeof(IndexRecord) == 16);
+
+template<size_t... I> constexpr auto
+type_names(std::index_sequence<I...>)
+{
+    return std::array<const char *, sizeof...(I)>{
+        std::variant_alternative_t<I, LogEntry::entry_type>::type()...
+    };
+}
+const auto entry_names = type_names(
+    std::make_index_sequence<std::variant_size_v<LogEntry::entry_type>>{});
+
+struct LogIndex {
+    std::vector<IndexRecord> records; // In log order
+    std::vector<uint32_t> by_block;   // Indices sorted by block, LSN
+
+    // Load the sidecar, or build (and try to save) it if it is
+    // missing, stale or rebuild is true.
+    LogIndex(LogFile &lf, bool rebuild);
+
+private:
+    void build(LogFile &lf);
+    bool load(const std::string &path, const IndexHeader &want);
+    void save(const std::string &path, IndexHeader hdr);
+};
+
+LogIndex::LogIndex(LogFile &lf, bool rebuild)
+{
+    struct stat sb;
+    if (fstat(lf.fd.fd, &sb) == -1)
+        threrror(lf.path.c_str());
+    IndexHeader hdr{ INDEX_MAGIC, uint64_t(sb.st_size),
+                     sb.st_mtim.tv_sec * 1'000'000'000LL + sb.st_mtim.tv_nsec,
+                     0, 0 };
+    const std::string path = lf.path + ".logidx";
+    if (rebuild || !load(path, hdr)) {
+        build(lf);
+        save(path, hdr);
+    }
+
+    by_block.resize(records.size());
+    for (uint32_t i = 0; i < records.size(); ++i)
+        by_block[i] = i;
+    std::stable_sort(by_block.begin(), by_block.end(),
+                     [this](uint32_t a, uint32_t b) {
+                         return records[a].block < records[b].block;
+                     });
+}
+
+void
+LogIndex::build(LogFile &lf)
+{
+    FdReader f(lf.fd.fd);
+    f.seek(lf.lh.l_checkpoint);
+    lsn_t sequence = lf.lh.l_sequence;
+    bool rewound = false;
+    for (;;)
+        try {
+            IndexRecord r{};
+            r.offset = f.tell();
+            LogEntry le;
+            le.load(f);
+            if (le.sequence_ != sequence++)
+                break;
+            r.lsn = le.sequence_;
+            r.nbytes = f.tell() - r.offset;
+            r.type = le.entry_.index();
+            r.block = NO_BLOCK;
+            if (auto *e = le.get<LogPatch>())
+                r.block = e->blockno;
+            else if (auto *e = le.get<LogBlockAlloc>())
+                r.block = e->blockno;
+            else if (auto *e = le.get<LogBlockFree>())
+                r.block = e->blockno;
+            records.push_back(r);
+            if (le.get<LogRewind>()) {
+                if (rewound)
+                    break;
+                rewound = true;
+                f.seek(lf.lh.logstart() * SECTOR_SIZE);
+            }
+        }
+        catch (const log_corrupt &) {
+            break;
+        }
+}
+
+bool
+LogIndex::load(const std::string &path, const IndexHeader &want)
+{
+    closefd fd;
+    if ((fd.fd = open(path.c_str(), O_RDONLY)) == -1)
+        return false;
+    IndexHeader hdr;
+    if (pread(fd.fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+        hdr.magic != want.magic || hdr.log_size != want.log_size ||
+        hdr.log_mtime_ns != want.log_mtime_ns)
+        return false;
+    records.resize(hdr.nrecords);
+    ssize_t len = records.size() * sizeof(IndexRecord);
+    if (pread(fd.fd, records.data(), len, sizeof(hdr)) != len) {
+        records.clear();
+        return false;
+    }
+    return true;
+}
+
+// Failing to save only makes the next query slower, so just warn.
+void
+LogIndex::save(const std::string &path, IndexHeader hdr)
+{
+    hdr.nrecords = records.size();
+    std::string tmp = path + ".tmp";
+    closefd fd;
+    if ((fd.fd = open(tmp.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0666)) == -1) {
+        perror(tmp.c_str());
+        return;
+    }
+    ssize_t len = records.size() * sizeof(IndexRecord);
+    if (write(fd.fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+        write(fd.fd, records.data(), len) != len ||
+        rename(tmp.c_str(), path.c_str()) == -1) {
+        perror(path.c_str());
+        unlink(tmp.c_str());
+    }
+}
+
+struct Query {
+    int block = -1;             // -b
+    bool lsn_range = false;     // -l
+    lsn_t lsn_lo = 0, lsn_hi = 0;
+    int type = -1;              // -t
+    bool summary = false;       // -s
+    bool rebuild = false;       // -R
+    uint32_t startpos = 0;      // Only entries at or after this offset
+
+    bool active() const {
+        return block >= 0 || lsn_range || type >= 0 || summary || rebuild;
+    }
+    bool match(const IndexRecord &r) const {
+        return (block < 0 || r.block == block) &&
+            (!lsn_range || (V6Log::le(lsn_lo, r.lsn) &&
+                            V6Log::le(r.lsn, lsn_hi))) &&
+            (type < 0 || r.type == type) && r.offset >= startpos;
+    }
+};
+
+void
+print_summary(const LogIndex &idx, const Query &q)
+{
+    constexpr size_t N = entry_names.size();
+    uint64_t count[N] = {}, bytes[N] = {}, total = 0, ntotal = 0;
+    for (const IndexRecord &r : idx.records)
+        if (q.match(r)) {
+            ++count[r.type];
+            bytes[r.type] += r.nbytes;
+            ++ntotal;
+            total += r.nbytes;
+        }
+    printf("%-14s %10s %12s %8s %7s\n", "type", "entries", "bytes",
+           "avg", "%bytes");
+    for (size_t t = 0; t < N; ++t)
+        if (count[t])
+            printf("%-14s %10llu %12llu %8.1f %6.1f%%\n", entry_names[t],
+                   (unsigned long long) count[t],
+                   (unsigned long long) bytes[t], double(bytes[t]) / count[t],
+                   100.0 * bytes[t] / total);
+    printf("%-14s %10llu %12llu\n", "total", (unsigned long long) ntotal,
+           (unsigned long long) total);
+    const uint64_t ntx = count[LogEntry::entry_type(LogBegin{}).index()];
+    if (ntx)
+        printf("%llu transactions, %.1f bytes each\n",
+               (unsigned long long) ntx, double(total) / ntx);
+}
+
+void
+query_log(LogFile &lf, const Query &q)
+{
+    LogIndex idx(lf, q.rebuild);
+    if (q.summary) {
+        print_summary(idx, q);
+        return;
+    }
+
+    // Every record matching the query, in log order
+    std::vector<uint32_t> hits;
+    if (q.block >= 0) {
+        const auto &r = idx.records;
+        auto lo = std::lower_bound(
+            idx.by_block.begin(), idx.by_block.end(), q.block,
+            [&r](uint32_t i, int b) { return r[i].block < b; });
+        auto hi = std::upper_bound(
+            lo, idx.by_block.end(), q.block,
+            [&r](int b, uint32_t i) { return b < r[i].block; });
+        hits.assign(lo, hi);
+        std::sort(hits.begin(), hits.end());
+    }
+    else
+        for (uint32_t i = 0; i < idx.records.size(); ++i)
+            hits.push_back(i);
+    hits.erase(std::remove_if(hits.begin(), hits.end(),
+                              [&](uint32_t i) {
+                                  return !q.match(idx.records[i]);
+                              }),
+               hits.end());
+
+    FdReader f(lf.fd.fd);
+    for (uint32_t i : hits) {
+        const IndexRecord &r = idx.records[i];
+        f.seek(r.offset);
+        LogEntry le;
+        try {
+            le.load(f);
+        }
+        catch (const log_corrupt &e) {
+            printf("[offset %u]\n* %s (index out of date?)\n", r.offset,
+                   e.what());
+            continue;
+        }
+        printf("[offset %u]\n", r.offset);
+        puts(le.show(&lf.fs).c_str());
+    }
+    printf("* %zu of %zu entries matched\n", hits.size(),
+           idx.records.size());
+}
+
+[[noreturn]] static void
+usage(const std::string &prog)
+{
+    fprintf(stderr, "usage: %s [-J journal] [-b block] [-l lsn[-lsn]]"
+            " [-t type] [-s] [-R]\n"
+            "           <fs-image> [<offset> | c]\n"
+            "  -b  entries that patch, allocate or free block\n"
+            "  -l  entries with LSNs in the range\n"
+            "  -t  entries of one type, e.g. LogPatch or patch\n"
+            "  -s  count entries and bytes by type instead of printing\n"
+            "  -R  rebuild <log file>.logidx even if it looks current\n",
+            prog.c_str());
+    exit(1);
+}
+
 int
 main(int argc, char **argv)
 {
     auto [dir, prog] = splitpath(argv[0]);
+    std::string journal;
+    Query q;
+    int opt;
+    while ((opt = getopt(argc, argv, "J:b:l:t:sR")) != -1)
+        switch (opt) {
+        case 'J':
+            journal = optarg;
+            break;
+        case 'b':
+            if ((q.block = atoi(optarg)) <= 0 || q.block > 0xffff)
+                usage(prog);
+            break;
+        case 'l': {
+            char *end;
+            q.lsn_range = true;
+            q.lsn_lo = q.lsn_hi = strtoul(optarg, &end, 0);
+            if (*end == '-')
+                q.lsn_hi = strtoul(end + 1, &end, 0);
+            // LSNs wrap, so 4294967290-5 is a range of 12
+            if (*end || !V6Log::le(q.lsn_lo, q.lsn_hi))
+                usage(prog);
+            break;
+        }
+        case 't': {
+            auto t = std::find_if(entry_names.begin(), entry_names.end(),
+                                  [](const char *n) {
+                                      return !strcasecmp(n, optarg) ||
+                                          !strcasecmp(n + 3, optarg);
+                                  });
+            if (t == entry_names.end())
+                usage(prog);
+            q.type = t - entry_names.begin();
+            break;
+        }
+        case 's':
+            q.summary = true;
+            break;
+        case 'R':
+            q.rebuild = true;
+            break;
+        default:
+            usage(prog);
+        }
+    argc -= optind - 1;
+    argv += optind - 1;
+
     int startpos = 0;
     if (argc == 3) {
         if (*argv[2] == 'c')
@@ -69,9 +406,21 @@ main(int argc, char **argv)
         else
             startpos = atoi(argv[2]);
     }
-    else if (argc != 2) {
-        fprintf(stderr, "usage: %s <fs-image> [<offset> | c]\n", prog.c_str());
-        exit(1);
+    else if (argc != 2)
+        usage(prog);
+
+    try {
+        LogFile lf(argv[1], journal);
+        if (!q.active()) {
+            read_log(lf, startpos);
+            return 0;
+        }
+        // The index starts at the checkpoint, so c needs no filter
+        q.startpos = startpos < 0 ? 0 : startpos;
+        query_log(lf, q);
+    }
+    catch (const std::exception &e) {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
     }
-    read_log(argv[1], startpos);
 }
@@ -1,8 +1,13 @@
 
+#include <atomic>
 #include <cstring>
+#include <future>
 #include <iostream>
 #include <map>
+#include <mutex>
+#include <optional>
 #include <set>
+#include <thread>
 
 #include <unistd.h>
 
@@ -13,6 +18,34 @@
 const char *progname;
 FScache cache(30);
 
+// Number of inodes each worker thread reads and pre-scans at once
+constexpr unsigned CHUNK_INODES = 64 * INODES_PER_BLOCK;
+
+// A non-zero block pointer examined by a worker thread.  The workers
+// can't decide cross-allocation, because that depends on the order in
+// which blocks are claimed, so they record everything else and the
+// main thread replays scan_blocks() from these records.
+struct BlockScan {
+    enum : uint8_t {
+        BAD,                    // Bad block number
+        BEYOND,                 // Allocated beyond end of file
+        LEAF,                   // Data block
+        BADINDIR,               // Indirect block failing check()
+        INDIR,                  // Indirect block, followed by subtree
+    };
+    uint8_t what;
+    uint16_t bn;
+    uint32_t ptroff;            // Disk offset of the pointer
+    uint32_t subtree = 0;       // Number of records for INDIR's pointers
+};
+
+// Pre-scan results for one chunk of the inode table
+struct InodeChunk {
+    std::vector<BlockScan> scans;
+    std::vector<uint32_t> start; // Per-inode index into scans, plus end
+    std::vector<bool> fallback;  // Worker failed, scan inode serially
+};
+
 struct Fsck {
     V6FS &fs_;
     Bitmap freemap_;
@@ -21,6 +54,18 @@ struct Fsck {
     std::ostream &out_ = std::cout;
     std::string ctx_;
 
+    // With more than one thread, the inode table and directory
+    // contents are read in bulk by worker threads.  itable_ and
+    // dirs_ are indexed by inumber and are empty when stale.  A
+    // directory is nullopt in dirs_ if a worker couldn't read it.
+    unsigned nthreads_ = 1;
+    std::vector<inode> itable_;
+    struct DirSlot {
+        direntv6 d;
+        uint32_t off;           // Disk offset of d
+    };
+    std::vector<std::optional<std::vector<DirSlot>>> dirs_;
+
     std::map<uint32_t, std::vector<uint8_t>> patches_;
     // Keep track of link additions separately from other patches, as
     // they could require block allocation, so we want to do them
@@ -72,11 +117,35 @@ struct Fsck {
 
     bool scan_inodes();
 
-    bool scan_directory(Ref<Inode> ip, uint16_t parent = ROOT_INUMBER);
+    bool scan_directory(uint16_t ino = ROOT_INUMBER,
+                        uint16_t parent = ROOT_INUMBER);
 
     bool fix_nlink();
     void rebuild_freelist();
 
+    // Helpers for the multi-threaded scans
+    template<typename F> void parallel_for(unsigned n, F f);
+    void read_blocks(void *buf, uint32_t bn, uint32_t n) const;
+    void load_inodes();
+    void load_directories();
+    void prescan_chunk(unsigned chunk, InodeChunk *out);
+    void prescan_blocks(const uint16_t *ptrs, unsigned n, uint32_t ptroff,
+                        BlockPath end, std::vector<BlockScan> *out) const;
+    bool replay_blocks(const BlockScan *b, const BlockScan *e);
+    bool scan_inodes_parallel();
+    uint16_t getblock(const inode &ip, uint16_t blockno) const;
+    void read_directory(uint16_t ino, std::vector<DirSlot> *out) const;
+
+    // Call f(d, off) for each entry d in directory ino, where off is
+    // the disk offset of d.
+    template<typename F> void dir_foreach(uint16_t ino, F f);
+    uint16_t imode(uint16_t ino) {
+        return itable_.empty() ? fs_.iget(ino)->i_mode : itable_.at(ino).i_mode;
+    }
+    uint32_t inode_offset(uint16_t ino) {
+        return fs_.iblock(ino) * SECTOR_SIZE + V6FS::iindex(ino) * sizeof(inode);
+    }
+
     bool valid_inum(uint16_t inum) const {
         return inum >= ROOT_INUMBER && inum < nlinks_.size();
     }
@@ -138,6 +207,9 @@ Fsck::scan_blocks(BlockPtrArray ba, BlockPath end)
 bool
 Fsck::scan_inodes()
 {
+    if (nthreads_ > 1)
+        return scan_inodes_parallel();
+
     const unsigned end = nlinks_.size();
     bool res = true;
     for (unsigned ino = ROOT_INUMBER; ino < end; ++ino) {
@@ -148,92 +220,365 @@ Fsck::scan_inodes()
     return res;
 }
 
+// Run f(i) for each i in [0, n) on nthreads_ threads, and rethrow
+// the first exception (if any) once they are done.
+template<typename F> void
+Fsck::parallel_for(unsigned n, F f)
+{
+    std::atomic<unsigned> next = 0;
+    std::mutex mu;
+    std::exception_ptr err;
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < nthreads_; ++t)
+        threads.emplace_back([&]() {
+            for (unsigned i; (i = next++) < n;)
+                try {
+                    f(i);
+                }
+                catch (...) {
+                    std::lock_guard lk(mu);
+                    if (!err)
+                        err = std::current_exception();
+                }
+        });
+    for (std::thread &t : threads)
+        t.join();
+    if (err)
+        std::rethrow_exception(err);
+}
+
+// Read n blocks straight from disk, bypassing the (single-threaded)
+// cache.  Safe to call from worker threads.
+void
+Fsck::read_blocks(void *buf, uint32_t bn, uint32_t n) const
+{
+    ssize_t want = n * SECTOR_SIZE;
+    if (ssize_t r = pread(fs_.fd_, buf, want, bn * SECTOR_SIZE); r != want) {
+        if (r != -1)
+            errno = EPIPE;
+        threrror("pread");
+    }
+}
+
+void
+Fsck::load_inodes()
+{
+    const unsigned end = nlinks_.size();
+    itable_.assign(end, inode{});
+    parallel_for((end - ROOT_INUMBER + CHUNK_INODES - 1) / CHUNK_INODES,
+                 [this, end](unsigned c) {
+        const unsigned first = ROOT_INUMBER + c * CHUNK_INODES;
+        const unsigned n = std::min(CHUNK_INODES, end - first);
+        read_blocks(&itable_[first], fs_.iblock(first), n / INODES_PER_BLOCK);
+    });
+}
+
+// Read the contents of every directory in parallel, so that
+// scan_directory() can walk the tree without any I/O.
+void
+Fsck::load_directories()
+{
+    if (itable_.empty())
+        load_inodes();
+    std::vector<uint16_t> dirs;
+    for (unsigned ino = ROOT_INUMBER; ino < itable_.size(); ++ino)
+        if (ino == ROOT_INUMBER || (itable_[ino].i_mode & IFMT) == IFDIR)
+            dirs.push_back(ino);
+    dirs_.assign(itable_.size(), std::nullopt);
+    parallel_for(dirs.size(), [this, &dirs](unsigned i) {
+        std::vector<DirSlot> v;
+        try {
+            read_directory(dirs[i], &v);
+        }
+        catch (const std::exception &) {
+            return;             // Let the serial code hit the error
+        }
+        dirs_[dirs[i]] = std::move(v);
+    });
+}
+
+// Like Inode::getblock, but reading straight from disk.
+uint16_t
+Fsck::getblock(const inode &ip, uint16_t blockno) const
+{
+    const uint16_t *ptrs = ip.i_addr;
+    unsigned size = IADDR_SIZE;
+    uint16_t buf[INDBLK_SIZE];
+    uint16_t bn = 0;
+    for (BlockPath idx = blockno_path(ip.i_mode, blockno); idx.height();
+         idx = idx.tail()) {
+        if (idx >= size)
+            throw std::out_of_range("BlockPtrArray size exceeded");
+        if (!(bn = ptrs[idx]))
+            return 0;
+        if (idx.height() > 1) {
+            read_blocks(buf, bn, 1);
+            ptrs = buf;
+            size = INDBLK_SIZE;
+        }
+    }
+    return bn;
+}
+
+// Collect the entries that Cursor::next<direntv6>() would return.
+void
+Fsck::read_directory(uint16_t ino, std::vector<DirSlot> *out) const
+{
+    const inode &ip = itable_.at(ino);
+    const uint32_t size = ip.size();
+    char buf[SECTOR_SIZE];
+    for (uint32_t pos = 0; pos < size && sizeof(direntv6) <= size - pos;) {
+        uint16_t bn = getblock(ip, pos / SECTOR_SIZE);
+        if (!bn) {
+            pos += SECTOR_SIZE;
+            continue;
+        }
+        read_blocks(buf, bn, 1);
+        for (uint32_t off = 0;
+             off < SECTOR_SIZE && sizeof(direntv6) <= size - pos;
+             off += sizeof(direntv6), pos += sizeof(direntv6)) {
+            DirSlot &s = out->emplace_back();
+            memcpy(&s.d, buf + off, sizeof(s.d));
+            s.off = bn * SECTOR_SIZE + off;
+        }
+    }
+}
+
+// Worker-thread half of scan_blocks(): everything but claiming blocks.
+void
+Fsck::prescan_blocks(const uint16_t *ptrs, unsigned n, uint32_t ptroff,
+                     BlockPath end, std::vector<BlockScan> *out) const
+{
+    for (unsigned i = 0; i < n; ++i)
+        if (uint16_t bn = ptrs[i]) {
+            const size_t me = out->size();
+            out->push_back({BlockScan::LEAF, bn,
+                            uint32_t(ptroff + i * sizeof(*ptrs))});
+            if (fs_.badblock(bn))
+                (*out)[me].what = BlockScan::BAD;
+            else if (i > end || (i == end && end.tail().is_zero()))
+                (*out)[me].what = BlockScan::BEYOND;
+            else if (end.height() > 1) {
+                uint16_t buf[INDBLK_SIZE];
+                read_blocks(buf, bn, 1);
+                BlockPath sub = end.tail_at(i);
+                if (!BlockPtrArray::check(fs_, buf, INDBLK_SIZE,
+                                          sub.height() == 2))
+                    (*out)[me].what = BlockScan::BADINDIR;
+                else {
+                    (*out)[me].what = BlockScan::INDIR;
+                    prescan_blocks(buf, INDBLK_SIZE, bn * SECTOR_SIZE,
+                                   sub, out);
+                    (*out)[me].subtree = out->size() - me - 1;
+                }
+            }
+        }
+}
+
+void
+Fsck::prescan_chunk(unsigned c, InodeChunk *out)
+{
+    const unsigned first = ROOT_INUMBER + c * CHUNK_INODES;
+    const unsigned n = std::min<unsigned>(CHUNK_INODES, itable_.size() - first);
+    read_blocks(&itable_[first], fs_.iblock(first), n / INODES_PER_BLOCK);
+    out->fallback.assign(n, false);
+    for (unsigned i = 0; i < n; ++i) {
+        const inode &ip = itable_[first + i];
+        out->start.push_back(out->scans.size());
+        if (uint16_t type = ip.i_mode & IFMT; type == IFCHR || type == IFBLK)
+            continue;
+        try {
+            prescan_blocks(ip.i_addr, IADDR_SIZE,
+                           inode_offset(first + i) + offsetof(inode, i_addr),
+                           sentinel_path(ip.i_mode, ip.size()), &out->scans);
+        }
+        catch (const std::exception &) {
+            out->scans.resize(out->start.back());
+            out->fallback[i] = true;
+        }
+    }
+    out->start.push_back(out->scans.size());
+}
+
+// Main-thread half of scan_blocks(), over records from prescan_blocks().
+bool
+Fsck::replay_blocks(const BlockScan *b, const BlockScan *e)
+{
+    bool res = true;
+    while (b < e) {
+        const BlockScan &s = *b++;
+        const BlockScan *kids = b;
+        b += s.subtree;
+        if (s.what == BlockScan::BAD)
+            out() << "block " << s.bn << ": bad block number in inode\n";
+        else if (s.what == BlockScan::BEYOND)
+            out() << "block " << s.bn << ": allocated beyond end of file\n";
+        else if (!freemap_.at(s.bn))
+            out() << "block " << s.bn << ": cross-allocated\n";
+        else {
+            freemap_.at(s.bn) = false;
+            if (s.what == BlockScan::LEAF ||
+                (s.what == BlockScan::INDIR && replay_blocks(kids, b)))
+                continue;
+        }
+        patch16(s.ptroff, 0);
+        res = false;
+    }
+    return res;
+}
+
+// Worker threads read the inode table in chunks and pre-scan each
+// inode's block tree, while this thread replays the results in
+// inode order, so messages and patches_ match the serial scan.
+bool
+Fsck::scan_inodes_parallel()
+{
+    const unsigned end = nlinks_.size();
+    const unsigned nchunks = (end - ROOT_INUMBER + CHUNK_INODES - 1)
+        / CHUNK_INODES;
+    itable_.assign(end, inode{});
+    std::vector<InodeChunk> chunks(nchunks);
+    std::vector<std::promise<void>> done(nchunks);
+
+    std::atomic<unsigned> next = 0;
+    std::vector<std::thread> threads;
+    cleanup _join([&]() {
+        next = nchunks;         // Stop early if we are unwinding
+        for (std::thread &t : threads)
+            t.join();
+    });
+    for (unsigned t = 0; t < nthreads_; ++t)
+        threads.emplace_back([&]() {
+            for (unsigned c; (c = next++) < nchunks;)
+                try {
+                    prescan_chunk(c, &chunks[c]);
+                    done[c].set_value();
+                }
+                catch (...) {
+                    done[c].set_exception(std::current_exception());
+                }
+        });
+
+    bool res = true;
+    for (unsigned c = 0; c < nchunks; ++c) {
+        done[c].get_future().get();
+        InodeChunk &ch = chunks[c];
+        const unsigned first = ROOT_INUMBER + c * CHUNK_INODES;
+        for (unsigned i = 0; i + 1 < ch.start.size(); ++i) {
+            auto sc = context("inode " + std::to_string(first + i));
+            if (ch.fallback[i] ? !scan_blocks(fs_.iget(first + i))
+                : !replay_blocks(ch.scans.data() + ch.start[i],
+                                 ch.scans.data() + ch.start[i+1]))
+                res = false;
+        }
+        ch = InodeChunk{};
+    }
+    return res;
+}
+
 bool
-Fsck::scan_directory(Ref<Inode> ip, uint16_t parent)
+Fsck::scan_directory(uint16_t ino, uint16_t parent)
 {
+    if (nthreads_ > 1 && dirs_.empty())
+        load_directories();
+
     saved_context _sc = context(ctx_ + "/");
     if (!parent)
-        parent = ip->inum();
+        parent = ino;
     bool res = true, dot_ok = false, dotdot_ok = false;
     std::set<std::string> names;
-    for (Cursor c{ip}; direntv6 *p = c.next<direntv6>();) {
-        if (!p->d_inumber)
-            continue;
-        std::string name(p->name());
-        if (!valid_inum(p->d_inumber)) {
-            out() << "invalid inumber " << p->d_inumber << " for "
+    dir_foreach(ino, [&](const direntv6 &d, uint32_t off) {
+        if (!d.d_inumber)
+            return;
+        std::string name(d.name());
+        if (!valid_inum(d.d_inumber)) {
+            out() << "invalid inumber " << d.d_inumber << " for "
                   << name << "\n";
             res = false;
-            patch(&p->d_inumber, 0);
-            continue;
+            patch16(off, 0);
+            return;
         }
         if (names.count(name)) {
-            out() << "duplicate directory entry for \"" << p->name() << "\"\n";
+            out() << "duplicate directory entry for \"" << d.name() << "\"\n";
             res = false;
-            patch(&p->d_inumber, 0);
-            continue;
+            patch16(off, 0);
+            return;
         }
-        names.emplace(p->name());
+        names.emplace(d.name());
         if (name == ".") {
-            if (p->d_inumber != ip->inum()) {
+            if (d.d_inumber != ino) {
                 out() << "incorrect \".\" inumber\n";
                 res = false;
-                patch(&p->d_inumber, ip->inum());
+                patch16(off, ino);
             }
             dot_ok = true;
-            ++nlinks_.at(ip->inum());
-            continue;
+            ++nlinks_.at(ino);
+            return;
         }
         if (name == "..") {
-            if (p->d_inumber != parent) {
+            if (d.d_inumber != parent) {
                 out() << "incorrect \"..\" inumber\n";
                 res = false;
-                patch(&p->d_inumber, parent);
+                patch16(off, parent);
             }
             dotdot_ok = true;
             ++nlinks_.at(parent);
-            continue;
+            return;
         }
-        ++nlinks_.at(p->d_inumber);
-        Ref<Inode> eip = fs_.iget(p->d_inumber);
-        if (!(eip->i_mode & IALLOC)) {
+        ++nlinks_.at(d.d_inumber);
+        uint16_t emode = imode(d.d_inumber);
+        if (!(emode & IALLOC)) {
             out() << "directory entry " << name << " for unallocated inode "
-                  << p->d_inumber << "\n";
+                  << d.d_inumber << "\n";
             res = false;
-            --nlinks_.at(p->d_inumber);
-            patch(&p->d_inumber, 0);
-            continue;
+            --nlinks_.at(d.d_inumber);
+            patch16(off, 0);
+            return;
         }
-        if ((eip->i_mode & IFMT) == IFDIR) {
-            if (nlinks_.at(p->d_inumber) != 1) {
+        if ((emode & IFMT) == IFDIR) {
+            if (nlinks_.at(d.d_inumber) != 1) {
                 out() << "hard link \"" << name << "\" to directory "
-                      << p->d_inumber << "\n";
+                      << d.d_inumber << "\n";
                 res = false;
-                --nlinks_.at(p->d_inumber);
-                patch(&p->d_inumber, 0);
-                continue;
+                --nlinks_.at(d.d_inumber);
+                patch16(off, 0);
+                return;
             }
             saved_context _sc2 = context(ctx_ + name);
-            if (!scan_directory(eip, ip->inum()))
+            if (!scan_directory(d.d_inumber, ino))
                 res = false;
         }
-    }
+    });
     if (!dot_ok) {
         out() << "missing \".\"\n";
-        newlinks_.emplace_back(ip->inum(), ip->inum(), ".");
-        ++nlinks_.at(ip->inum());
+        newlinks_.emplace_back(ino, ino, ".");
+        ++nlinks_.at(ino);
     }
     if (!dotdot_ok) {
         out() << "missing \"..\"\n";
-        newlinks_.emplace_back(ip->inum(), parent, "..");
+        newlinks_.emplace_back(ino, parent, "..");
         ++nlinks_.at(parent);
     }
     return res && dot_ok && dotdot_ok;
 }
 
+template<typename F> void
+Fsck::dir_foreach(uint16_t ino, F f)
+{
+    if (!dirs_.empty() && dirs_.at(ino)) {
+        for (const DirSlot &s : *dirs_[ino])
+            f(s.d, s.off);
+        return;
+    }
+    for (Cursor c{fs_.iget(ino)}; direntv6 *p = c.next<direntv6>();)
+        f(*p, fs_.disk_offset(&p->d_inumber));
+}
+
 void
 Fsck::apply()
 {
+    itable_.clear();
+    dirs_.clear();
     fs_.invalidate();
     for (const auto &[pos, contents] : patches_) {
         assert(pos % SECTOR_SIZE + contents.size() <= SECTOR_SIZE);
@@ -272,34 +617,43 @@ bool
 Fsck::fix_nlink()
 {
     // Doesn't handle case of > 255 links
+    if (nthreads_ > 1 && itable_.empty())
+        load_inodes();
+
     bool res = true;
     const uint32_t stop = nlinks_.size();
     const inode zero{};
     for (uint32_t i = ROOT_INUMBER; i < stop; ++i) {
-        Ref<Inode> ip = fs_.iget(i);
+        Ref<Inode> ref;
+        if (itable_.empty())
+            ref = fs_.iget(i);
+        const inode &ip = ref ? *ref : itable_.at(i);
         int n = nlinks_.at(i);
         if (n == 0) {
-            if (ip->i_mode & IALLOC) {
+            if (ip.i_mode & IALLOC) {
                 out() << "clearing unreachable inode " << i << "\n";
                 res = false;
-                patch<inode>(ip.get(), zero);
+                patch(inode_offset(i), &zero, sizeof(zero));
             }
         }
-        else if (n != ip->i_nlink) {
-            out() << "inode " << ip->inum() << ": link count "
-                  << int(ip->i_nlink)
+        else if (n != ip.i_nlink) {
+            out() << "inode " << i << ": link count "
+                  << int(ip.i_nlink)
                   << " should be " << n << "\n";
             res = false;
-            patch(&ip->i_nlink, n);
+            uint8_t nlink = n;
+            patch(inode_offset(i) + offsetof(inode, i_nlink),
+                  &nlink, sizeof(nlink));
         }
     }
     return res;
 }
 
 int
-fsck(V6FS &fs, bool write = true)
+fsck(V6FS &fs, bool write = true, unsigned nthreads = 1)
 {
     Fsck fsck(fs);
+    fsck.nthreads_ = nthreads;
     bool res = true;
     if (!fsck.scan_inodes()) {
         std::cout << "scan inodes required fixes\n";
@@ -317,7 +671,7 @@ fsck(V6FS &fs, bool write = true)
             res = false;
         }
     }
-    if (!fsck.scan_directory(fs.iget(ROOT_INUMBER))) {
+    if (!fsck.scan_directory()) {
         std::cout << "scan directories required fixes\n";
         res = false;
         if (write)
@@ -365,7 +719,8 @@ fsck(V6FS &fs, bool write = true)
 [[noreturn]] void
 usage(int exitval = 2)
 {
-    std::cerr << "usage: " << progname << " [-y] fs-image" << std::endl;
+    std::cerr << "usage: " << progname << " [-y] [-j nthreads] [-J journal] fs-image"
+              << std::endl;
     exit(exitval);
 }
 
@@ -380,13 +735,25 @@ main(int argc, char **argv)
         progname = argv[0];
 
     bool opt_yes = false;
+    // -j 1 uses the original, purely serial code
+    unsigned nthreads = std::max(1u, std::thread::hardware_concurrency());
     int opt;
     int flags = V6FS::V6_NOLOG;
-    while ((opt = getopt(argc, argv, "y")) != -1)
+    std::string journal;
+    while ((opt = getopt(argc, argv, "yj:J:")) != -1)
         switch (opt) {
         case 'y':
             opt_yes = true;
             break;
+        case 'j':
+            if (int n = atoi(optarg); n > 0)
+                nthreads = n;
+            else
+                usage();
+            break;
+        case 'J':
+            journal = optarg;
+            break;
         default:
             usage();
         }
@@ -397,8 +764,15 @@ main(int argc, char **argv)
     if (!opt_yes)
         flags |= V6FS::V6_RDONLY;
     int res = [&]() {
-        V6FS fs(argv[optind], cache, flags);
-        return fsck(fs, opt_yes);
+        std::unique_ptr<V6FS> fsp;
+        try {
+            fsp = std::make_unique<V6FS>(argv[optind], cache, flags, journal);
+        }
+        catch (const std::exception &e) {
+            std::cerr << e.what() << std::endl;
+            return 2;
+        }
+        return fsck(*fsp, opt_yes, nthreads);
     }();
     exit(res);
 }
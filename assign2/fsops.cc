@@ -1,6 +1,7 @@
 
 #include <unistd.h>
 
+#include "blockpath.hh"
 #include "fsops.hh"
 
 namespace {
@@ -17,6 +18,79 @@ begin(const Dirent &de)
     return begin(de.dir_);
 }
 
+// Blocks to allocate or copy per transaction
+constexpr uint32_t BATCH_BLOCKS = 32;
+
+// Return the first block in [b, end) that is allocated (if data is
+// true) or a hole (if data is false), or end if there isn't one.  A
+// missing indirect block skips the whole range it would cover, and
+// runs within the last pointer array are scanned without re-walking
+// the path.
+uint32_t
+find_block(const Ref<Inode> &ip, uint32_t b, uint32_t end, bool data)
+{
+    while (b < end) {
+        // Small files have nothing past the direct blocks
+        if (!(ip->i_mode & ILARG) && b >= IADDR_SIZE)
+            return data ? end : b;
+        BlockPtrArray ba(ip);
+        BlockPath idx = blockno_path(ip->i_mode, b);
+        for (; idx.height() > 1; idx = idx.tail()) {
+            uint16_t bn = ba.at(idx);
+            if (bn) {
+                ba = ip->fs().bread(bn);
+                continue;
+            }
+            if (!data)
+                return b;
+            uint32_t skip = 1, off = 0;
+            for (BlockPath t = idx; t.height() > 1;) {
+                t = t.tail();
+                off = off * INDBLK_SIZE + t;
+                skip *= INDBLK_SIZE;
+            }
+            b += skip - off;
+            break;
+        }
+        if (idx.height() > 1)
+            continue;
+        const unsigned last = std::min<uint32_t>(ba.size(), idx + (end - b));
+        unsigned i = idx;
+        while (i < last && (ba.at(i) != 0) != data)
+            ++i;
+        b += i - idx;
+        if (i < last)
+            return b;
+    }
+    return end;
+}
+
+uint32_t
+count_blocks(BlockPtrArray ba, unsigned depth)
+{
+    uint32_t n = 0;
+    for (unsigned i = 0, e = ba.size(); i < e; ++i)
+        if (uint16_t bn = ba.at(i)) {
+            ++n;
+            if (depth && !ba.fs().badblock(bn))
+                n += count_blocks(ba.fs().bread(bn), depth - 1);
+        }
+    return n;
+}
+
+int
+regular_file(const Ref<Inode> &ip)
+{
+    switch (ip->i_mode & IFMT) {
+    case IFREG:
+        return 0;
+    case IFDIR:
+        return -EISDIR;
+    default:
+        return -EINVAL;
+    }
+}
+
 } // anonymous namespace
 
 int
@@ -26,19 +100,19 @@ null_inode_permissions(const Inode *)
 }
 
 int
-fs_named(Dirent *out, Ref<Inode> ip, std::string path, int flags,
+fs_named(Dirent *out, Ref<Inode> ip, std::string_view path, int flags,
          inode_permissions access)
 try {
     assert(!(flags & ND_CREATE) || &ip->fs().log_ || ip->fs().log_->in_tx_);
 
-    std::vector<std::string> cs = path_components(path);
-    if (cs.empty())
-        cs.push_back(".");
-
-    std::string name = std::move(cs.back());
+    PathComponents cs(path);
+    std::string_view name = ".";
+    if (!cs.empty()) {
+        name = cs.back();
+        cs.pop_back();
+    }
     if (name.size() > sizeof(direntv6::d_name))
         return -ENAMETOOLONG;
-    cs.pop_back();
     if ((flags & (ND_DOT_OK|ND_CREATE)) != ND_DOT_OK &&
         (name == "." || name == ".."))
         return -EINVAL;
@@ -69,7 +143,7 @@ try {
         return -ENOENT;
     if ((flags & ND_EXCLUSIVE) && de.inum())
         return -EEXIST;
-    *out = de;
+    *out = std::move(de);
     return 0;
  }
  catch(const resource_exhausted &e) {
@@ -204,6 +278,37 @@ try {
      return e.error;
  }
 
+int
+fs_rename(Dirent oldde, Dirent newde)
+try {
+    if (!oldde.inum())
+        return -ENOENT;
+    // Renaming a file to one of its own links does nothing
+    if (newde.inum() == oldde.inum())
+        return 0;
+
+    Tx _tx = begin(newde);
+    if (newde.inum()) {
+        Ref<Inode> ip = newde.fs().iget(newde.inum());
+        if (ip->i_nlink > 1) {
+            ip->fs().patch(--ip->i_nlink);
+            ip->mtouch();
+        }
+        else {
+            ip->clear();
+            ip->fs().ifree(ip->inum());
+        }
+    }
+    Ref<Inode> ip = oldde.fs().iget(oldde.inum());
+    newde.set_inum(ip->inum());
+    oldde.set_inum(0);
+    ip->mtouch();
+    return 0;
+ }
+ catch(const resource_exhausted &e) {
+     return e.error;
+ }
+
 int
 fs_num_free_inodes(V6FS &fs)
 {
@@ -231,8 +336,8 @@ fs_num_free_blocks(V6FS &fs)
         return fs.log_->freemap_.num1();
     else if (fs.superblock().s_uselog) {
         Bitmap freemap(fs.superblock().s_fsize, fs.superblock().datastart());
-        if (pread(fs.fd_, freemap.data(), freemap.datasize(),
-                  (fs.superblock().s_fsize + 1) * SECTOR_SIZE) == -1)
+        if (pread(fs.logfd(), freemap.data(), freemap.datasize(),
+                  (fs.loghdrblock() + 1) * SECTOR_SIZE) == -1)
             threrror("pread");
         freemap.tidy();
         return freemap.num1();
@@ -258,8 +363,8 @@ fs_freemap(V6FS &fs)
     if (fs.log_)
         memcpy(freemap.data(), fs.log_->freemap_.data(), freemap.datasize());
     else if (fs.superblock().s_uselog) {
-        if (pread(fs.fd_, freemap.data(), freemap.datasize(),
-                  (fs.superblock().s_fsize + 1) * SECTOR_SIZE) == -1)
+        if (pread(fs.logfd(), freemap.data(), freemap.datasize(),
+                  (fs.loghdrblock() + 1) * SECTOR_SIZE) == -1)
             threrror("pread");
         freemap.tidy();
     }
@@ -277,3 +382,141 @@ fs_freemap(V6FS &fs)
     }
     return freemap;
 }
+
+off_t
+fs_lseek(Ref<Inode> ip, off_t pos, int whence)
+try {
+    if (whence != SEEK_DATA && whence != SEEK_HOLE)
+        return -EINVAL;
+    if (uint16_t type = ip->i_mode & IFMT; type == IFCHR || type == IFBLK)
+        return -EINVAL;
+    const uint32_t size = ip->size();
+    if (pos < 0 || pos >= size)
+        return -ENXIO;
+    const uint32_t end = (size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    uint32_t b = find_block(ip, pos / SECTOR_SIZE, end, whence == SEEK_DATA);
+    if (b == end)
+        return whence == SEEK_DATA ? -ENXIO : off_t(size);
+    return std::max<off_t>(pos, off_t(b) * SECTOR_SIZE);
+ }
+ catch(const resource_exhausted &e) {
+     return e.error;
+ }
+
+int
+fs_fallocate(Ref<Inode> ip, int mode, off_t offset, off_t len)
+try {
+    if (mode)
+        return -EOPNOTSUPP;
+    if (int err = regular_file(ip))
+        return err;
+    if (offset < 0 || len <= 0)
+        return -EINVAL;
+    if (offset + len > MAX_FILE_SIZE)
+        return -EFBIG;
+
+    // Fail up front rather than leave the job half done
+    const uint32_t first = offset / SECTOR_SIZE;
+    const uint32_t end = (offset + len + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    uint32_t missing = 0;
+    for (uint32_t b = first; (b = find_block(ip, b, end, false)) < end;) {
+        uint32_t e = find_block(ip, b, end, true);
+        missing += e - b;
+        b = e;
+    }
+    if (missing + missing / (INDBLK_SIZE - 1) + 2 >
+        uint32_t(fs_num_free_blocks(ip->fs())))
+        return -ENOSPC;
+
+    // Extend the file first, so that a crash part way through leaves
+    // holes rather than blocks beyond the end of the file.
+    if (Tx _tx = begin(ip); uint32_t(offset + len) > ip->size())
+        ip->set_size(offset + len);
+
+    // getblock allocates through balloc, so blocks come out
+    // contiguous when the log's allocator can manage it.
+    for (uint32_t b = find_block(ip, first, end, false); b < end;) {
+        Tx _tx = begin(ip);
+        for (uint32_t n = 0; n < BATCH_BLOCKS && b < end;
+             ++n, b = find_block(ip, b + 1, end, false))
+            ip->getblock(b, true);
+    }
+
+    Tx _tx = begin(ip);
+    ip->mtouch();
+    return 0;
+ }
+ catch(const resource_exhausted &e) {
+     return e.error;
+ }
+
+ssize_t
+fs_copy_range(Ref<Inode> in, off_t inpos, Ref<Inode> out, off_t outpos,
+              size_t len)
+try {
+    if (int err = regular_file(in); err || (err = regular_file(out)))
+        return err;
+    if (inpos < 0 || outpos < 0)
+        return -EINVAL;
+    const uint32_t insize = in->size();
+    if (inpos >= insize)
+        return 0;
+    len = std::min<size_t>(len, insize - inpos);
+    if (in->inum() == out->inum() &&
+        inpos < off_t(outpos + len) && outpos < off_t(inpos + len))
+        return -EINVAL;
+    if (outpos + len > MAX_FILE_SIZE)
+        return -EFBIG;
+
+    static const char zeros[SECTOR_SIZE] = {};
+    Cursor c(out);
+    uint32_t done = 0;
+    while (done < len) {
+        Tx _tx = begin(out);
+        for (uint32_t n = 0; n < BATCH_BLOCKS && done < len; ++n) {
+            const uint32_t ipos = inpos + done, opos = outpos + done;
+            const uint32_t piece = std::min<uint32_t>({
+                    uint32_t(len - done),
+                    uint32_t(SECTOR_SIZE - ipos % SECTOR_SIZE),
+                    uint32_t(SECTOR_SIZE - opos % SECTOR_SIZE) });
+            // Nothing to do if both sides are holes
+            Ref<Buffer> src = in->getblock(ipos / SECTOR_SIZE);
+            const uint32_t ob = opos / SECTOR_SIZE;
+            if (src || find_block(out, ob, ob + 1, true) == ob) {
+                c.seek(opos);
+                const char *p = src ? src->mem_ + ipos % SECTOR_SIZE : zeros;
+                if (c.write(p, piece) != int(piece))
+                    return done ? ssize_t(done) : -ENOSPC;
+            }
+            done += piece;
+        }
+    }
+
+    Tx _tx = begin(out);
+    if (outpos + len > out->size())
+        out->set_size(outpos + len);
+    out->mtouch();
+    return done;
+ }
+ catch(const resource_exhausted &e) {
+     return e.error;
+ }
+
+uint32_t
+fs_allocated_blocks(Ref<Inode> ip)
+{
+    if (uint16_t type = ip->i_mode & IFMT; type == IFCHR || type == IFBLK)
+        return 0;
+    if (!(ip->i_mode & ILARG))
+        return count_blocks(ip, 0);
+    // Last block pointer in a large file is double-indirect
+    uint32_t n = 0;
+    for (unsigned i = 0; i < IADDR_SIZE; ++i)
+        if (uint16_t bn = ip->i_addr[i]) {
+            ++n;
+            if (!ip->fs().badblock(bn))
+                n += count_blocks(ip->fs().bread(bn),
+                                  i == IADDR_SIZE - 1 ? 1 : 0);
+        }
+    return n;
+}
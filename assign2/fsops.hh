@@ -20,8 +20,8 @@ constexpr int ND_EXCLUSIVE = 0x4;
 constexpr int ND_DIRWRITE = 0x8;
 
 // If start is nullptr, starts at root directory.
-int fs_named(Dirent *out, Ref<Inode> start, std::string path, int flags,
-             inode_permissions = null_inode_permissions);
+int fs_named(Dirent *out, Ref<Inode> start, std::string_view path,
+             int flags, inode_permissions = null_inode_permissions);
 
 // Functions that allocate an inode take an inode_initializer to set
 // up permissions and such inside the log transaction.
@@ -32,9 +32,26 @@ int fs_mkdir(Dirent where, inode_initializer);
 int fs_rmdir(Dirent where);
 int fs_link(Dirent oldde, Dirent newde);
 int fs_unlink(Dirent where);
+// Point newde at oldde's inode and clear oldde, dropping whatever
+// newde used to point to.  newde may have come from ND_CREATE.
+int fs_rename(Dirent oldde, Dirent newde);
 int fs_num_free_inodes(V6FS &fs);
 int fs_num_free_blocks(V6FS &fs);
 
+// lseek with SEEK_DATA or SEEK_HOLE.  Returns the new offset or -errno.
+off_t fs_lseek(Ref<Inode> ip, off_t pos, int whence);
+// Preallocate (zeroed) blocks for [offset, offset+len), extending the
+// file if necessary.  Only mode 0 is supported, because V6 can't
+// represent blocks beyond the end of file.
+int fs_fallocate(Ref<Inode> ip, int mode, off_t offset, off_t len);
+// Copy len bytes between regular files without leaving the daemon.
+// Holes in the source stay holes in the destination where possible.
+// Returns the number of bytes copied or -errno.
+ssize_t fs_copy_range(Ref<Inode> in, off_t inpos, Ref<Inode> out,
+                      off_t outpos, size_t len);
+// Number of blocks (data and indirect) allocated to a file
+uint32_t fs_allocated_blocks(Ref<Inode> ip);
+
 // Get a copy of the freemap.  If the FS in is logging mode, copy the
 // in-memory bitmap.  Otherwise if the superblock supports logging,
 // read the log area from disk even if the V6FS isn't currently in
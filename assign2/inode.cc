@@ -17,6 +17,7 @@ void
 Inode::put()
 {
     Ref<Buffer> bp = fs().bread(fs().iblock(inum()));
+    fs().cache_.b.mark_metadata(bp.get());
     bp->at<inode>(fs().iindex(inum())) = *this;
     bp->bdwrite();
     dirty_ = logged_ = false;
@@ -136,15 +137,18 @@ Inode::getblock(uint16_t blockno, bool allocate)
 
     for (BlockPath idx = blockno_path(i_mode, blockno); idx.height();
          idx = idx.tail()) {
+        const bool metadata = idx.height() > 1 || (i_mode&IFMT) == IFDIR;
         if (uint16_t bn = ba.at(idx); !bn) {
             if (!allocate)
                 return nullptr;
-            bp = fs().balloc(idx.height() > 1 || (i_mode&IFMT) == IFDIR);
+            bp = fs().balloc(metadata);
             bn = bp->blockno();
             ba.set_at(idx, bp->blockno());
         }
         else
             bp = fs().bread(bn);
+        if (metadata)
+            fs().cache_.b.mark_metadata(bp.get());
         ba = bp;
     }
 
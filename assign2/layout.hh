@@ -26,6 +26,8 @@ constexpr uint16_t INODE_START_SECTOR = 2;
 constexpr uint16_t ROOT_INUMBER = 1;
 constexpr uint16_t BOOTBLOCK_MAGIC_NUM = 0407;
 constexpr uint32_t MAX_FILE_SIZE = 0xffffff;
+// In s_logmagic when s_logid is valid (old superblocks have garbage there)
+constexpr uint32_t EXTLOG_MAGIC_NUM = 0x4a4e4c36;
 
 
 struct filsys {
@@ -44,12 +46,22 @@ struct filsys {
     // Modern additions for CS111
     uint8_t  s_uselog;        // Use log
     uint8_t  s_dirty;         // File system was not cleanly shut down
+    uint16_t s_logid[2];      // If non-zero, log is in an external journal
+                              // whose header has the same l_logid
+    uint16_t s_logmagic[2];   // EXTLOG_MAGIC_NUM if s_logid is set
 
-    uint16_t pad[47];         // aligns struct filsys to be 512 bytes in
+    uint16_t pad[43];         // aligns struct filsys to be 512 bytes in
                               // size (the block size!)
 
     // First data block of file
     uint16_t datastart() const { return INODE_START_SECTOR + s_isize; }
+    // s_logid, or 0 if the log is not in an external journal
+    uint32_t logid() const {
+        uint32_t magic = uint32_t(s_logmagic[0]) << 16 | s_logmagic[1];
+        if (magic != EXTLOG_MAGIC_NUM)
+            return 0;
+        return uint32_t(s_logid[0]) << 16 | s_logid[1];
+    }
 };
 static_assert(std::is_standard_layout_v<filsys>,
               "on-disk data strcutures must have standard layout");
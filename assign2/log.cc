@@ -8,6 +8,7 @@
 
 #include "fsops.hh"
 #include "log.hh"
+#include "trace.hh"
 
 uint32_t
 rnd_uint32()
@@ -37,20 +38,58 @@ read_loghdr(int fd, loghdr *hdr, uint32_t blockno)
         throw log_corrupt("invalid log header");
 }
 
-V6Log::V6Log(V6FS &fs)
-    : fs_(fs), w_(fs.fd_),
+void
+read_loghdr(int fd, loghdr *hdr, const filsys &sb)
+{
+    read_loghdr(fd, hdr, sb.logid() ? 0 : sb.s_fsize);
+    if (hdr->l_logid != sb.logid())
+        throw log_corrupt("journal does not belong to this file system");
+}
+
+std::string
+journal_path(const std::string &image)
+{
+    return image + ".journal";
+}
+
+// The log gets its own descriptor on the image when it needs open
+// flags the rest of the file system should not pay for.
+static int
+open_logfd(V6FS &fs, int flags)
+{
+    int oflags = 0;
+    if (flags & V6FS::V6_LOGSYNC)
+        oflags |= O_DSYNC;
+    if (flags & V6FS::V6_LOGDIRECT)
+        oflags |= O_DIRECT | O_DSYNC;
+    if (!oflags)
+        return -1;
+    const std::string &path =
+        fs.superblock().logid() ? fs.logpath_ : fs.path_;
+    int fd = open(path.c_str(), O_RDWR | oflags);
+    if (fd == -1)
+        threrror(path.c_str());
+    return fd;
+}
+
+V6Log::V6Log(V6FS &fs, int flags)
+    : fs_(fs), logfd_(open_logfd(fs, flags)),
+      w_(logfd_ == -1 ? fs.logfd() : int(logfd_), 2,
+         flags & V6FS::V6_LOGDIRECT),
       freemap_(fs_.superblock().s_fsize, fs_.superblock().datastart())
 {
-    read_loghdr(fs_.fd_, &hdr_, fs_.superblock().s_fsize);
+    read_loghdr(fs_.logfd(), &hdr_, fs_.superblock());
     // Subtract one from sequence because first log entry should match
     // log header in case we crash before making a checkpoint.
     applied_ = committed_ = sequence_ = hdr_.l_sequence -1 ;
     w_.seek(hdr_.l_checkpoint);
-    if (pread(fs.fd_, freemap_.data(), freemap_.datasize(),
+    if (pread(fs.logfd(), freemap_.data(), freemap_.datasize(),
               hdr_.mapstart() * SECTOR_SIZE) == -1)
         threrror("pread");
     freemap_.tidy();
     checkpoint_time_ = time(nullptr);
+    stats::set(stats::LOG_SIZE_BYTES, hdr_.logbytes());
+    stats::set(stats::LOG_USED_BYTES, hdr_.logbytes() - space());
 }
 
 Tx
@@ -58,27 +97,86 @@ V6Log::begin()
 {
     if (in_tx_)
         return {};
+    stats::add(stats::LOG_TX);
     log(LogBegin{});
+    TRACE_INSTANT("log", "begin", "lsn", sequence_);
     begin_sequence_ = sequence_;
     begin_offset = w_.tell();
     in_tx_ = true;
     return Tx(this);
 }
 
+// Size of the LogRewind record that ends each pass through the log
+static uint32_t
+rewind_bytes()
+{
+    static const uint32_t n = LogEntry(0, LogRewind{}).nbytes();
+    return n;
+}
+
 void
 V6Log::log(LogEntry::entry_type e)
 {
-    static const uint32_t reserve = LogEntry(0, LogRewind{}).nbytes();
+    LogEntry le(0, std::move(e));
+    make_space(le.nbytes());
+    le.sequence_ = ++sequence_;
+    append(le);
+}
 
-    LogEntry le(++sequence_, std::move(e));
+void
+V6Log::append(LogEntry &le)
+{
     uint32_t pos = w_.tell();
-    if (pos + reserve > hdr_.logend() * SECTOR_SIZE) {
-        LogEntry(sequence_, LogRewind{}).save(w_);
+    if (pos + rewind_bytes() > hdr_.logend() * SECTOR_SIZE) {
+        LogEntry rw(le.sequence_, LogRewind{});
+        rw.save(w_);
+        bytes_logged_ += rw.nbytes();
         le.sequence_ = ++sequence_;
         w_.seek(hdr_.logstart() * SECTOR_SIZE);
     }
 
     le.save(w_);
+    bytes_logged_ += le.nbytes();
+    stats::add(stats::LOG_RECORDS);
+    stats::add(stats::LOG_BYTES, le.nbytes());
+    TRACE_INSTANT("log", "append", "lsn", le.sequence_,
+                  "bytes", le.nbytes());
+}
+
+void
+V6Log::make_space(uint32_t nbytes)
+{
+    if (suppress_commit_)       // commit() checks for a full log
+        return;
+
+    // Log space append() would use, counting any skip to the start of
+    // the log, plus room for a checkpoint's null transaction.
+    static const uint32_t checkpoint_bytes =
+        LogEntry(0, LogBegin{}).nbytes() + LogEntry(0, LogCommit{}).nbytes()
+        + 2 * rewind_bytes();
+    const uint32_t pos = w_.tell();
+    const uint32_t end = hdr_.logend() * SECTOR_SIZE;
+    uint32_t need = nbytes + checkpoint_bytes;
+    if (pos + rewind_bytes() > end && end > pos)
+        need += end - pos;
+
+    // space() stops at hdr_.l_checkpoint, which a pending checkpoint's
+    // start follows, so neither can be overwritten.  Waiting for the
+    // pending one frees the log up to the end of its transaction; a
+    // new checkpoint can only be taken between transactions.
+    if (space() > need)
+        return;
+    finish_checkpoint(true);
+    if (space() > need)
+        return;
+    if (!in_tx_) {
+        checkpoint(true);
+        if (space() > need)
+            return;
+    }
+    std::cerr << "log full (transaction larger than the free log space),"
+              << " aborting" << std::endl;
+    std::abort();
 }
 
 uint16_t
@@ -107,6 +205,9 @@ void
 V6Log::commit()
 {
     log(LogCommit{begin_sequence_});
+    TRACE_INSTANT("log", "commit", "lsn", sequence_,
+                  "begin", begin_sequence_);
+    stats::set(stats::LOG_USED_BYTES, hdr_.logbytes() - space());
     for (uint16_t bn : freed_)
         freemap_.at(bn) = true;
     freed_.clear();
@@ -118,24 +219,70 @@ V6Log::commit()
             std::abort();
         }
     }
-    else if (space() < hdr_.logbytes() / 2)
-        checkpoint();
+    else if (const uint32_t free = space(); checkpoint_done_.valid()) {
+        // One is already being written; wait for it only if the log
+        // is getting full.
+        if (free < hdr_.logbytes() / 4)
+            finish_checkpoint(true);
+    }
+    else if (free < hdr_.logbytes() / 2)
+        checkpoint(false);
     else if (time(nullptr) > checkpoint_time_ + 30)
-        checkpoint();
+        checkpoint(false);
 }
 
 void
 V6Log::flush()
 {
-    w_.flush();
+    stats::Timed _t(stats::LOG_FLUSH);
+    TRACE_SPAN("log", "flush", "lsn", sequence_);
+    flush_async().get();
+    reap();
+    throw_write_error();
+}
+
+std::shared_future<void>
+V6Log::flush_async()
+{
+    stats::add(stats::LOG_FLUSHES);
+    TRACE_INSTANT("log", "flush_async", "lsn", sequence_);
+    std::shared_future<void> done = w_.flush_async();
     if (!suppress_commit_)
-        committed_ = in_tx_ ? begin_sequence_ : sequence_;
+        pending_.emplace_back(in_tx_ ? begin_sequence_ : sequence_, done);
+    return done;
+}
+
+void
+V6Log::reap() noexcept
+{
+    while (!pending_.empty() &&
+           pending_.front().second.wait_for(std::chrono::seconds(0)) ==
+           std::future_status::ready) {
+        auto [lsn, done] = std::move(pending_.front());
+        pending_.pop_front();
+        try {
+            done.get();
+        }
+        catch (...) {
+            if (!write_error_)
+                write_error_ = std::current_exception();
+        }
+        // Records after a failed write are not durable either
+        if (write_error_)
+            continue;
+        committed_ = lsn;
+        TRACE_INSTANT("log", "committed", "lsn", lsn);
+    }
 }
 
 void
-V6Log::checkpoint()
+V6Log::checkpoint(bool wait)
 {
     assert(!in_tx_);
+    stats::Timed _t(stats::LOG_CHECKPOINT);
+    stats::add(stats::LOG_CHECKPOINTS);
+    TRACE_SPAN("log", "checkpoint", "lsn", sequence_,
+               "used", hdr_.logbytes() - space());
 
     if (suppress_commit_) {
         w_.flush();
@@ -143,45 +290,81 @@ V6Log::checkpoint()
         return;
     }
 
-    hdr_.l_checkpoint = w_.tell();
-    hdr_.l_sequence = sequence_ + 1;
-    // Stick null transaction after checkpoint
-    log(LogBegin{});
-    log(LogCommit{sequence_});
+    // The on-disk header must move forward one checkpoint at a time
+    finish_checkpoint(true);
+
+    loghdr hdr = hdr_;
+    hdr.l_checkpoint = w_.tell();
+    hdr.l_sequence = sequence_ + 1;
+    // Stick null transaction after checkpoint, in the room make_space()
+    // keeps for it
+    LogEntry begin(++sequence_, LogBegin{});
+    append(begin);
+    LogEntry commit(++sequence_, LogCommit{begin.sequence_});
+    append(commit);
 
     flush();
-    fs_.sync();
+    fs_.sync_async();
     applied_ = committed_;
 
     std::vector<uint16_t> freed(std::move(freed_));
     freed_.clear();
     for (uint16_t bn : freed)
         freemap_.at(bn) = true;
-    if (pwrite(fs_.fd_, freemap_.data(), freemap_.datasize(),
-               hdr_.mapstart() * SECTOR_SIZE) == -1)
-        threrror("pwrite");
 
-    fs_.writeblock(&hdr_, hdr_.l_hdrblock);
+    // Once the buffers are on disk, the writer thread writes the free
+    // map and header as they are now.  Until then, hdr_ keeps the old
+    // checkpoint, so space() won't let the log overwrite records a
+    // crash would still need.
+    auto map = std::make_shared<Bitmap>(freemap_.max_index(),
+                                        freemap_.min_index());
+    memcpy(map->data(), freemap_.data(), map->datasize());
+    checkpoint_hdr_ = hdr;
+    checkpoint_done_ = fs_.wb_.barrier([fs = &fs_, map, hdr]() {
+        if (pwrite(fs->logfd(), map->data(), map->datasize(),
+                   hdr.mapstart() * SECTOR_SIZE) == -1)
+            threrror("pwrite");
+        fs->writelogblock(&hdr, hdr.l_hdrblock);
+    });
     checkpoint_time_ = time(nullptr);
+    if (wait)
+        finish_checkpoint(true);
+}
+
+void
+V6Log::finish_checkpoint(bool wait)
+{
+    if (!checkpoint_done_.valid() ||
+        (!wait && checkpoint_done_.wait_for(std::chrono::seconds(0)) !=
+         std::future_status::ready))
+        return;
+    std::shared_future<void> done = std::move(checkpoint_done_);
+    checkpoint_done_ = {};
+    done.get();                 // Rethrows any write error
+    hdr_.l_checkpoint = checkpoint_hdr_.l_checkpoint;
+    hdr_.l_sequence = checkpoint_hdr_.l_sequence;
+    stats::set(stats::LOG_USED_BYTES, hdr_.logbytes() - space());
 }
 
 uint32_t
 V6Log::space()
 {
+    finish_checkpoint(false);
     const uint32_t pos = w_.tell();
     const uint32_t cp = hdr_.l_checkpoint;
     return cp >= pos ? cp - pos : hdr_.logbytes() - (pos - cp);
 }
 
 void
-V6Log::create(V6FS &fs, uint16_t log_blocks)
+V6Log::create(V6FS &fs, uint16_t log_blocks, const Bitmap *freemap)
 {
     filsys &sb = fs.superblock();
+    const bool external = !fs.logpath_.empty();
 
     loghdr lh;
     memset(&lh, 0, sizeof(lh));
     lh.l_magic = LOG_MAGIC_NUM;
-    lh.l_hdrblock = sb.s_fsize;
+    lh.l_hdrblock = external ? 0 : sb.s_fsize;
     lh.l_mapsize = (sb.s_fsize - sb.datastart() + (8 * SECTOR_SIZE - 1)) /
         (8 * SECTOR_SIZE);
     if (!log_blocks)
@@ -189,17 +372,32 @@ V6Log::create(V6FS &fs, uint16_t log_blocks)
     lh.l_logsize = lh.l_mapsize + log_blocks;
     lh.l_checkpoint = lh.logstart() * SECTOR_SIZE;
     lh.l_sequence = rnd_uint32();
+    if (external) {
+        lh.l_logid = rnd_uint32() | 1; // Zero would mean internal
+        fs.logfd_.set(open(fs.logpath_.c_str(), O_RDWR|O_CREAT|O_TRUNC, 0666));
+        if (fs.logfd_ == -1)
+            threrror(fs.logpath_.c_str());
+    }
 
-    if (ftruncate(fs.fd_, lh.l_hdrblock * SECTOR_SIZE) == -1 ||
-        ftruncate(fs.fd_, lh.logend() * SECTOR_SIZE) == -1)
+    if (ftruncate(fs.fd_, sb.s_fsize * SECTOR_SIZE) == -1 ||
+        ftruncate(fs.logfd(), lh.logend() * SECTOR_SIZE) == -1)
         threrror("ftruncate");
 
-    Bitmap freemap = fs_freemap(fs);
-    if (pwrite(fs.fd_, freemap.data(), freemap.datasize(),
+    Bitmap computed;
+    if (!freemap) {
+        computed = fs_freemap(fs);
+        freemap = &computed;
+    }
+    if (pwrite(fs.logfd(), freemap->data(), freemap->datasize(),
                lh.mapstart() * SECTOR_SIZE) == -1)
         threrror("pwrite");
-    fs.writeblock(&lh, lh.l_hdrblock);
+    fs.writelogblock(&lh, lh.l_hdrblock);
     sb.s_uselog = 1;
+    sb.s_logid[0] = lh.l_logid >> 16;
+    sb.s_logid[1] = lh.l_logid;
+    const uint32_t magic = external ? EXTLOG_MAGIC_NUM : 0;
+    sb.s_logmagic[0] = magic >> 16;
+    sb.s_logmagic[1] = magic;
     sb.s_nfree = 0;             // using free map now
     fs.writeblock(&fs.superblock(), SUPERBLOCK_SECTOR);
 }
@@ -3,9 +3,13 @@
 
 #include <cassert>
 #include <cstdint>
+#include <deque>
+#include <exception>
 #include <functional>
+#include <future>
 #include <optional>
 #include <sstream>
+#include <string>
 #include <stdexcept>
 #include <type_traits>
 #include <utility>
@@ -22,17 +26,27 @@ struct V6FS;
 uint32_t rnd_uint32();
 
 void read_loghdr(int fd, loghdr *hdr, uint32_t blockno);
+// Read the log header belonging to superblock sb from fd, which
+// must be the image or (if sb.logid() is non-zero) the journal.
+void read_loghdr(int fd, loghdr *hdr, const filsys &sb);
+
+// Where to look for the external journal of an image by default
+std::string journal_path(const std::string &image);
 
 class Tx;
 
 struct V6Log {
     V6FS &fs_;
-    FdWriter w_;
+    unique_fd logfd_;           // Log-only descriptor, if flags need one
+    AsyncFdWriter w_;
     bool in_tx_ = false;
     lsn_t sequence_;            // LSN of last written log record
-    lsn_t committed_;           // Highest LSN written to log
+    lsn_t committed_;           // Highest LSN known to be on disk
     lsn_t applied_;             // Highest LSN applied to file system
     time_t checkpoint_time_ = 0;
+    uint64_t bytes_logged_ = 0; // Total size of records written
+    // First failed log write, if any; committed_ stays below it
+    std::exception_ptr write_error_;
     loghdr hdr_;
     Bitmap freemap_;
 
@@ -44,7 +58,8 @@ struct V6Log {
         return b - a <= half_range;
     }
 
-    V6Log(V6FS &fs);
+    // flags may contain V6FS::V6_LOGSYNC and V6FS::V6_LOGDIRECT.
+    V6Log(V6FS &fs, int flags = 0);
 
     friend Tx;
     [[nodiscard]] Tx begin();
@@ -58,10 +73,32 @@ struct V6Log {
     void bfree(uint16_t blockno);
 
     void flush();               // Flush log to increase committed_
-    void checkpoint(); // Write checkpoint record to increase applied_
+    // Start writing the log without waiting.  committed_ advances
+    // when a later reap() finds the write has finished.
+    std::shared_future<void> flush_async();
+    // Retire finished flush_async() calls.  A write error goes to
+    // write_error_ rather than being thrown, so that cache scans can
+    // call is_committed(); flush() and throw_write_error() raise it.
+    void reap() noexcept;
+    void throw_write_error() {
+        if (write_error_)
+            std::rethrow_exception(write_error_);
+    }
+    bool is_committed(lsn_t lsn) {
+        if (!le(lsn, committed_))
+            reap();
+        return le(lsn, committed_);
+    }
+    // Write checkpoint record to increase applied_.  Dirty buffers are
+    // written in the background unless wait is true, and the log space
+    // they free becomes available once they are on disk.
+    void checkpoint(bool wait = true);
     uint32_t space();           // Available log space
 
-    static void create(V6FS &fs, uint16_t log_blocks = 0);
+    // Create the log.  If freemap is nullptr, the free map is
+    // computed from the file system's free list.
+    static void create(V6FS &fs, uint16_t log_blocks = 0,
+                       const Bitmap *freemap = nullptr);
 
     // If true, prevents flushing the log so you eventually run out of
     // buffers.  It's just for generating test cases--leave it false.
@@ -75,6 +112,25 @@ private:
     // List of blocks that have been freed by previous transactions
     std::vector<uint16_t> freed_;
 
+    // Outstanding asynchronous flushes and the LSN each one commits
+    std::deque<std::pair<lsn_t, std::shared_future<void>>> pending_;
+
+    // Background checkpoint, if any, and the header it will write
+    std::shared_future<void> checkpoint_done_;
+    loghdr checkpoint_hdr_;
+    // If the background checkpoint has finished (or once it does,
+    // if wait), adopt its header.
+    void finish_checkpoint(bool wait);
+
+    // Write le at the current position, rewinding to the start of the
+    // log first if it is too close to the end.
+    void append(LogEntry &le);
+    // Make sure an entry of nbytes can be appended without overwriting
+    // records replay may still need, waiting for the pending
+    // checkpoint or checkpointing if necessary.  Aborts if the current
+    // transaction has filled the log.
+    void make_space(uint32_t nbytes);
+
     void commit();
 };
 
@@ -127,6 +127,7 @@ using lsn_t = uint32_t;
 struct loghdr {
     uint32_t l_magic;           // LOG_MAGIC_NUM
     uint32_t l_hdrblock;        // Block containing this log header
+                                // (0 in an external journal)
 
     // Total size of log in SECTOR_SIZE blocks.  File system plus log
     // area consume l_hdrblock+l_logsize sectors.
@@ -136,13 +137,17 @@ struct loghdr {
     uint16_t l_mapsize;
 
     // Byte offset of the first byte that should be read from the log
-    // after a crash (measured from the start of the disk).
+    // after a crash (measured from the start of the disk, or of the
+    // journal file if the log is external).
     uint32_t l_checkpoint;
 
     // First sequence number expected
     lsn_t l_sequence;
 
-    char l_pad[SECTOR_SIZE-20];
+    // Copy of the superblock's s_logid, or 0 if log is inside image
+    uint32_t l_logid;
+
+    char l_pad[SECTOR_SIZE-24];
 
     uint32_t mapstart() const { return l_hdrblock + 1; }
     uint32_t logstart() const { return mapstart() + l_mapsize; }
@@ -0,0 +1,115 @@
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "layout.hh"
+#include "mkfs.hh"
+#include "v6fs.hh"
+
+// Build the free list for blocks [start, nblocks) in memory, exactly
+// as calling bfree() on each block from the top down would, and
+// write each chain block directly rather than through the cache.  If
+// chain is false, only start goes on the list, which is enough to
+// allocate the root directory before the log's free map takes over.
+static bool
+write_freelist(int fd, filsys *s, uint16_t start, int nblocks, bool chain)
+{
+    uint16_t blk[INDBLK_SIZE] = {};
+    s->s_nfree = 0;
+    for (int bn = chain ? nblocks : start + 1; bn-- > start;) {
+        if (s->s_nfree == array_size(s->s_free)) {
+            memcpy(blk, s->s_free, sizeof(s->s_free));
+            if (pwrite(fd, blk, sizeof(blk), bn * SECTOR_SIZE) != sizeof(blk))
+                return false;
+            s->s_free[0] = bn;
+            s->s_nfree = 1;
+            continue;
+        }
+        if (s->s_nfree == 0) {
+            s->s_free[0] = 0;
+            s->s_nfree = 1;
+        }
+        s->s_free[s->s_nfree++] = bn;
+    }
+    return true;
+}
+
+// The image is sparse, so only the superblock and free-list chain
+// blocks are actually written.
+static bool
+create_file(const char *target, int nblocks, int ninodes, bool freelist)
+{
+    int fd = open(target, O_CREAT|O_EXCL|O_WRONLY, 0666);
+    if (fd < 0) {
+        perror(target);
+        return false;
+    }
+
+    ftruncate(fd, nblocks * SECTOR_SIZE);
+
+    filsys s;
+    memset(&s, 0, sizeof(s));
+    s.s_isize = (ninodes + INODES_PER_BLOCK - 1)/INODES_PER_BLOCK;
+    s.s_fsize = nblocks;
+    uint32_t now = time(NULL);
+    s.s_time[0] = now>>16;
+    s.s_time[1] = now;
+    if (!write_freelist(fd, &s, s.datastart(), nblocks, freelist)) {
+        perror(target);
+        close(fd);
+        return false;
+    }
+    pwrite(fd, &s, sizeof(s), SUPERBLOCK_SECTOR*SECTOR_SIZE);
+
+    uint16_t magic = BOOTBLOCK_MAGIC_NUM;
+    pwrite(fd, &magic, sizeof(magic), 0);
+
+    close(fd);
+    return true;
+}
+
+bool
+make_fs(const char *target, int nblocks, int ninodes, int log_blocks,
+        const std::string &journal)
+try {
+    if (log_blocks == -1 && !journal.empty()) {
+        fprintf(stderr, "%s: journal given without a log\n", journal.c_str());
+        return false;
+    }
+    // With a log, the free list is replaced by a bitmap anyway
+    if (!create_file(target, nblocks, ninodes, log_blocks == -1))
+        return false;
+
+    FScache cache(30);
+    V6FS fs(target, cache, 0, journal);
+    const uint16_t start = INODE_START_SECTOR + fs.superblock().s_isize;
+
+    Ref<Inode> ip = fs.iget(ROOT_INUMBER);
+    Ref<Buffer> bp = fs.balloc(true);
+
+    ip->i_mode = IALLOC|IFDIR|0755;
+    ip->i_nlink = 2;
+    ip->i_addr[0] = bp->blockno();
+    ip->mtouch();
+    ip->atouch();
+
+    ip->create(".").set_inum(ROOT_INUMBER);
+    ip->create("..").set_inum(ROOT_INUMBER);
+
+    if (log_blocks != -1) {
+        // Everything but the root directory is free
+        Bitmap freemap(nblocks, start);
+        memset(freemap.data(), 0xff, freemap.datasize());
+        freemap.tidy();
+        freemap.at(bp->blockno()) = false;
+        V6Log::create(fs, log_blocks, &freemap);
+    }
+    return true;
+}
+catch(const std::exception &e) {
+    fprintf(stderr, "%s: %s\n", target, e.what());
+    return false;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <string>
+
+// Create a new, empty file system image in target, which must not
+// already exist.  log_blocks is -1 for no log, 0 for a log of the
+// default size, and otherwise the size of the log.  A non-empty
+// journal puts the log in that file rather than in the image, so it
+// needs log_blocks other than -1.  Prints an error and returns false
+// on failure.
+bool make_fs(const char *target, int nblocks, int ninodes,
+             int log_blocks = -1, const std::string &journal = {});
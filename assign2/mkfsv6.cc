@@ -1,51 +1,23 @@
 
-#include <fcntl.h>
+#include <cstring>
+#include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
 #include <unistd.h>
 
-#include "layout.hh"
-#include "v6fs.hh"
+#include "mkfs.hh"
 
 const char *progname;
-FScache cache(30);
 
 [[noreturn]] static void
 usage()
 {
     fprintf(stderr,
-            "usage: %s file.img [#sectors [#inodes [#journal-blocks]]\n",
+            "usage: %s [-J journal] file.img"
+            " [#sectors [#inodes [#journal-blocks]]\n",
             progname);
     exit(1);
 }
 
-bool
-create_file(const char *target, int nblocks, int ninodes)
-{
-    int fd = open(target, O_CREAT|O_EXCL|O_WRONLY, 0666);
-    if (fd < 0) {
-        perror(target);
-        return false;
-    }
-
-    ftruncate(fd, nblocks * SECTOR_SIZE);
-
-    filsys s;
-    memset(&s, 0, sizeof(s));
-    s.s_isize = (ninodes + INODES_PER_BLOCK - 1)/INODES_PER_BLOCK;
-    s.s_fsize = nblocks;
-    uint32_t now = time(NULL);
-    s.s_time[0] = now>>16;
-    s.s_time[1] = now;
-    pwrite(fd, &s, sizeof(s), SUPERBLOCK_SECTOR*SECTOR_SIZE);
-
-    uint16_t magic = BOOTBLOCK_MAGIC_NUM;
-    pwrite(fd, &magic, sizeof(magic), 0);
-
-    close(fd);
-    return true;
-}
-
 int
 main(int argc, char **argv)
 {
@@ -56,6 +28,19 @@ main(int argc, char **argv)
     else
         progname = argv[0];
 
+    std::string journal;
+    int opt;
+    while ((opt = getopt(argc, argv, "J:")) != -1)
+        switch (opt) {
+        case 'J':
+            journal = optarg;
+            break;
+        default:
+            usage();
+        }
+    argc -= optind - 1;
+    argv += optind - 1;
+
     if (argc < 2 || argc > 5)
         usage();
 
@@ -79,31 +64,15 @@ main(int argc, char **argv)
             ninodes = nblocks;
     }
 
-    int log_blocks = -1;
-    if (argc >= 5)
+    // An external journal implies a log, of default size if need be
+    int log_blocks = journal.empty() ? -1 : 0;
+    if (argc >= 5) {
         log_blocks = atoi(argv[4]);
+        if (log_blocks < -1 || (log_blocks == -1 && !journal.empty()))
+            usage();
+    }
 
-    if (!create_file(target, nblocks, ninodes))
+    if (!make_fs(target, nblocks, ninodes, log_blocks, journal))
         exit(1);
-
-    V6FS fs(target, cache);
-    const uint16_t start = INODE_START_SECTOR + fs.superblock().s_isize;
-    for (uint16_t bn = nblocks; bn-- > start;)
-        fs.bfree(bn);
-
-    Ref<Inode> ip = fs.iget(ROOT_INUMBER);
-    Ref<Buffer> bp = fs.balloc(true);
-
-    ip->i_mode = IALLOC|IFDIR|0755;
-    ip->i_nlink = 2;
-    ip->i_addr[0] = bp->blockno();
-    ip->mtouch();
-    ip->atouch();
-
-    ip->create(".").set_inum(ROOT_INUMBER);
-    ip->create("..").set_inum(ROOT_INUMBER);
-
-    if (log_blocks != -1)
-        V6Log::create(fs, log_blocks);
     return 0;
 }
@@ -4,6 +4,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <fuse.h>
+#include <signal.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <string.h>
@@ -14,7 +15,17 @@
 #include <unistd.h>
 #include <time.h>
 
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "defrag.hh"
 #include "fsops.hh"
+#include "warm.hh"
 
 FScache cache;
 V6FS *fs;
@@ -27,6 +38,13 @@ static struct options {
     int create_journal;
     int force;
     int suppress_commit;
+    int log_sync;
+    int log_direct;
+    int stats_json;
+    int defrag;
+    const char *journal;
+    const char *warm;
+    const char *cache_policy;
 } options;
 
 #define OPTION(t, p)                            \
@@ -35,12 +53,28 @@ static const struct fuse_opt option_spec[] = {
     OPTION("--suppress-commit", suppress_commit),
     OPTION("--checkuid", checkuid),
     OPTION("--force", force),
+    OPTION("--log-sync", log_sync),
+    OPTION("--log-direct", log_direct),
+    OPTION("--journal=%s", journal),
+    OPTION("--stats-json", stats_json),
+    OPTION("--defrag", defrag),
+    OPTION("--warm=%s", warm),
+    OPTION("--cache-policy=%s", cache_policy),
     OPTION("-h", show_help),
     OPTION("--help", show_help),
     OPTION("-j", create_journal),
     FUSE_OPT_END
 };
 
+// Each request holds fs_mutex, so the background defragmenter can
+// move blocks between requests.  The latency includes waiting for it.
+static std::mutex fs_mutex;
+struct Op {
+    stats::Timed t_;
+    std::lock_guard<std::mutex> lk_{fs_mutex};
+    explicit Op(stats::Timer t) : t_(t) {}
+};
+
 static bool
 root_user()
 {
@@ -57,6 +91,103 @@ file_owner(const Ref<Inode> &ip)
     return -EPERM;
 }
 
+// Read-only files that aren't in the image.  Opening one takes a
+// snapshot of the performance counters, in human or JSON form.
+static const char *const stats_paths[] = { "/.v6stats", "/.v6stats.json" };
+// File handles of open snapshots are above any inode number
+static constexpr uint64_t STATS_FH = 0x10000;
+static std::map<uint64_t, std::string> stats_snapshots;
+
+// Returns the index in stats_paths, or -1 for an ordinary path
+static int
+stats_file(const char *path)
+{
+    for (int i = 0; i < int(std::size(stats_paths)); ++i)
+        if (!strcmp(path, stats_paths[i]))
+            return i;
+    return -1;
+}
+
+static int
+stats_getattr(int which, struct stat *st)
+{
+    memset(st, 0, sizeof(*st));
+    st->st_mode = S_IFREG | 0444;
+    st->st_ino = STATS_FH + which;
+    st->st_nlink = 1;
+    st->st_size = stats::report(which).size();
+    st->st_blksize = SECTOR_SIZE;
+    st->st_atime = st->st_mtime = st->st_ctime = time(nullptr);
+    return 0;
+}
+
+static int
+stats_open(int which, struct fuse_file_info *fi)
+{
+    if ((fi->flags & O_ACCMODE) != O_RDONLY)
+        return -EACCES;
+    static uint64_t next_fh = STATS_FH;
+    fi->fh = next_fh++;
+    // The size changes between getattr and read, so bypass the page cache
+    fi->direct_io = 1;
+    stats_snapshots[fi->fh] = stats::report(which);
+    return 0;
+}
+
+// Dump the counters on stderr whenever we get SIGUSR1.  Every other
+// thread must have SIGUSR1 blocked.
+static void
+stats_dumper()
+{
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    for (int sig; sigwait(&set, &sig) == 0;) {
+        std::string s = stats::report(options.stats_json);
+        fwrite(s.data(), 1, s.size(), stderr);
+    }
+}
+
+// With --defrag, make one pass over the inodes, defragmenting one
+// file at a time and letting requests in between files.
+static std::atomic<bool> defrag_stop;
+static void
+defragger()
+{
+    DefragStats st;
+    const unsigned ninodes = fs->superblock().s_isize * INODES_PER_BLOCK;
+    for (unsigned inum = ROOT_INUMBER; inum <= ninodes && !defrag_stop;
+         ++inum) {
+        {
+            std::lock_guard lk(fs_mutex);
+            try {
+                defrag_inode(*fs, inum, &st);
+            }
+            catch (const std::exception &e) {
+                fprintf(stderr, "defrag: inode %u: %s\n", inum, e.what());
+            }
+        }
+        std::this_thread::yield();
+    }
+    std::string s = "defrag: " + st.summary();
+    fwrite(s.data(), 1, s.size(), stderr);
+}
+
+// With --warm, prefetch what was cached at the last clean unmount.
+static std::atomic<bool> warm_stop;
+static void
+warmer(WarmHints h)
+{
+    try {
+        unsigned n = warm_prefetch(*fs, h, fs_mutex, warm_stop);
+        fprintf(stderr, "warm: prefetched %u blocks, %zu inodes\n", n,
+                h.inodes.size());
+    }
+    catch (const std::exception &e) {
+        fprintf(stderr, "warm: %s\n", e.what());
+    }
+}
+
 static Ref<Inode>
 get_inode(const char *path, fuse_file_info *fi = nullptr)
 {
@@ -66,6 +197,8 @@ get_inode(const char *path, fuse_file_info *fi = nullptr)
     else
         printf("get_inode: path == \"%s\", fi == NULL\n", path);
 #endif
+    if (fi && fi->fh >= STATS_FH)
+        return nullptr;
     if (fi && fi->fh)
         return fs->iget(fi->fh);
     else if (Ref<Inode> ip = fs->namei(path)) {
@@ -165,8 +298,7 @@ get_attr(Ref<Inode> ip, struct stat *st)
     st->st_gid = ip->i_gid;
     st->st_size = ip->size();
     st->st_blksize = SECTOR_SIZE;
-    // XXX blocks shouldn't count gaps in sparse files
-    st->st_blocks = (st->st_size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    st->st_blocks = fs_allocated_blocks(ip);
     st->st_atime = ip->atime();
     st->st_mtime = ip->mtime();
     st->st_ctime = ip->mtime();
@@ -186,6 +318,9 @@ v6_init(struct fuse_conn_info *conn, struct fuse_config *cfg)
 static int
 v6_getattr(const char *path, struct stat *st, struct fuse_file_info *fi)
 {
+    Op _op(stats::OP_GETATTR);
+    if (int which = stats_file(path); which >= 0)
+        return stats_getattr(which, st);
     Ref<Inode> ip = get_inode(path, fi);
     if (!ip)
         return -ENOENT;
@@ -197,17 +332,20 @@ v6_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
               off_t offset, struct fuse_file_info *fi,
               enum fuse_readdir_flags flags)
 {
+    Op _op(stats::OP_READDIR);
     Ref<Inode> ip = get_inode(path, fi);
     if (!ip)
         return -ENOENT;
     Cursor c(ip);
     c.seek(offset - (offset % sizeof(direntv6)));
 
+    char name[sizeof(direntv6::d_name) + 1];
     for (direntv6 *d = c.next<direntv6>(); d; d = c.next<direntv6>()) {
         if (!d->d_inumber)
             continue;
-        if (filler(buf, std::string(d->name()).c_str(), nullptr,
-                   c.tell(), FILLDIR_FLAGS_NONE))
+        std::string_view sv = d->name();
+        *std::copy(sv.begin(), sv.end(), name) = '\0';
+        if (filler(buf, name, nullptr, c.tell(), FILLDIR_FLAGS_NONE))
             break;
     }
     return 0;
@@ -216,6 +354,9 @@ v6_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
 static int
 v6_open(const char *path, struct fuse_file_info *fi)
 {
+    Op _op(stats::OP_OPEN);
+    if (int which = stats_file(path); which >= 0)
+        return stats_open(which, fi);
     Tx _tx = fs->begin();
     Ref<Inode> ip = get_inode(path, fi);
     if (int err = check_access(ip, flags_to_mode(fi->flags)))
@@ -234,6 +375,7 @@ v6_open(const char *path, struct fuse_file_info *fi)
 static int
 v6_truncate(const char *path, off_t size, struct fuse_file_info *fi)
 {
+    Op _op(stats::OP_TRUNCATE);
     Tx _tx = fs->begin();
     Ref<Inode> ip = get_inode(path, fi);
     if (int err = check_access(ip, 2))
@@ -246,6 +388,7 @@ static int
 v6_utimens(const char *path, const struct timespec tv[2],
            struct fuse_file_info *fi)
 {
+    Op _op(stats::OP_UTIMENS);
     Ref<Inode> ip = get_inode(path, fi);
     if (int err = check_access(ip, 2))
         return err;
@@ -272,6 +415,7 @@ v6_utimens(const char *path, const struct timespec tv[2],
 static int
 v6_chown(const char *path, uid_t uid, gid_t gid, struct fuse_file_info *fi)
 {
+    Op _op(stats::OP_CHOWN);
     Ref<Inode> ip = get_inode(path, fi);
     if (int err = file_owner(ip))
         return err;
@@ -294,6 +438,7 @@ v6_chown(const char *path, uid_t uid, gid_t gid, struct fuse_file_info *fi)
 static int
 v6_chmod(const char *path, mode_t mode, struct fuse_file_info *fi)
 {
+    Op _op(stats::OP_CHMOD);
     Ref<Inode> ip = get_inode(path, fi);
     if (int err = file_owner(ip))
         return err;
@@ -311,6 +456,18 @@ static int
 v6_read(const char *path, char *buf, size_t size, off_t offset,
         struct fuse_file_info *fi)
 {
+    Op _op(stats::OP_READ);
+    if (fi && fi->fh >= STATS_FH) {
+        auto snap = stats_snapshots.find(fi->fh);
+        if (snap == stats_snapshots.end())
+            return -EBADF;
+        const std::string &s = snap->second;
+        if (offset >= off_t(s.size()))
+            return 0;
+        size = std::min<size_t>(size, s.size() - offset);
+        memcpy(buf, s.data() + offset, size);
+        return size;
+    }
     Ref<Inode> ip = get_inode(path, fi);
     if (!ip)
         return -ENOENT;
@@ -325,6 +482,7 @@ static int
 v6_write(const char* path, const char *buf, size_t size, off_t offset,
          struct fuse_file_info* fi)
 try {
+    Op _op(stats::OP_WRITE);
     Ref<Inode> ip = get_inode(path, fi);
     if (!ip)
         return -ENOENT;
@@ -340,9 +498,58 @@ try {
      return e.error;
  }
 
+static int
+v6_release(const char *path, struct fuse_file_info *fi)
+{
+    if (fi->fh >= STATS_FH)
+        stats_snapshots.erase(fi->fh);
+    return 0;
+}
+
+static off_t
+v6_lseek(const char *path, off_t off, int whence, struct fuse_file_info *fi)
+{
+    Op _op(stats::OP_LSEEK);
+    Ref<Inode> ip = get_inode(path, fi);
+    if (!ip)
+        return -ENOENT;
+    return fs_lseek(ip, off, whence);
+}
+
+static int
+v6_fallocate(const char *path, int mode, off_t offset, off_t len,
+             struct fuse_file_info *fi)
+{
+    Op _op(stats::OP_FALLOCATE);
+    Ref<Inode> ip = get_inode(path, fi);
+    if (int err = check_access(ip, 2))
+        return err;
+    return fs_fallocate(ip, mode, offset, len);
+}
+
+static ssize_t
+v6_copy_file_range(const char *path_in, struct fuse_file_info *fi_in,
+                   off_t off_in, const char *path_out,
+                   struct fuse_file_info *fi_out, off_t off_out,
+                   size_t len, int flags)
+{
+    Op _op(stats::OP_COPY_FILE_RANGE);
+    if (flags)
+        return -EINVAL;
+    Ref<Inode> in = get_inode(path_in, fi_in);
+    if (int err = check_access(in, 4))
+        return err;
+    Ref<Inode> out = get_inode(path_out, fi_out);
+    if (int err = check_access(out, 2))
+        return err;
+    in->atouch();
+    return fs_copy_range(in, off_in, out, off_out, len);
+}
+
 static int
 v6_mknod(const char *path, mode_t mode, dev_t dev)
 {
+    Op _op(stats::OP_MKNOD);
     uint16_t newmode = (mode & 07777) | IALLOC;
     switch (mode & S_IFMT) {
     case S_IFBLK:
@@ -374,6 +581,7 @@ v6_mknod(const char *path, mode_t mode, dev_t dev)
 static int
 v6_create(const char *path, mode_t mode, fuse_file_info *fi)
 {
+    Op _op(stats::OP_CREATE);
     Tx _tx = fs->begin();
     Dirent de;
     if (int err = get_dirent(&de, path, ND_CREATE))
@@ -395,6 +603,7 @@ v6_create(const char *path, mode_t mode, fuse_file_info *fi)
 static int
 v6_unlink(const char *path)
 {
+    Op _op(stats::OP_UNLINK);
     Dirent de;
     if (int err = get_dirent(&de, path, ND_DIRWRITE))
         return err;
@@ -404,6 +613,7 @@ v6_unlink(const char *path)
 static int
 v6_mkdir(const char *path, mode_t mode)
 {
+    Op _op(stats::OP_MKDIR);
     Tx _tx = fs->begin();
     Dirent de;
     if (int err = get_dirent(&de, path, ND_CREATE|ND_EXCLUSIVE))
@@ -421,6 +631,7 @@ v6_mkdir(const char *path, mode_t mode)
 static int
 v6_rmdir(const char *path)
 {
+    Op _op(stats::OP_RMDIR);
     Dirent de;
     if (int err = get_dirent(&de, path, ND_DIRWRITE))
         return err;
@@ -430,6 +641,7 @@ v6_rmdir(const char *path)
 static int
 v6_link(const char *oldpath, const char *newpath)
 {
+    Op _op(stats::OP_LINK);
     Dirent oldde, newde;
     if (int err = get_dirent(&oldde, oldpath, ND_DIRWRITE))
         return err;
@@ -443,6 +655,7 @@ v6_link(const char *oldpath, const char *newpath)
 static int
 v6_rename(const char *oldpath, const char *newpath, unsigned int flags)
 {
+    Op _op(stats::OP_RENAME);
     if (flags)
         return -EINVAL;
 
@@ -454,30 +667,13 @@ v6_rename(const char *oldpath, const char *newpath, unsigned int flags)
     Dirent newde;
     if (int err = get_dirent(&newde, newpath, ND_CREATE))
         return err;
-
-    if (newde.inum()) {
-        Ref<Inode> ip = fs->iget(newde.inum());
-        if (ip->i_nlink > 1) {
-            --ip->i_nlink;
-            fs->patch(ip->i_nlink);
-            ip->mtouch();
-        }
-        else {
-            ip->clear();
-            fs->ifree(ip->inum());
-        }
-    }
-    Ref<Inode> ip = fs->iget(oldde.inum());
-    newde.set_inum(ip->inum());
-    oldde.set_inum(0);
-    ip->mtouch();
-
-    return 0;
+    return fs_rename(oldde, newde);
 }
 
 static int
 v6_statfs(const char *path, struct statvfs *sfs)
 {
+    Op _op(stats::OP_STATFS);
     filsys &sb = fs->superblock();
     memset(sfs, 0, sizeof(*sfs));
     sfs->f_bsize = SECTOR_SIZE;
@@ -508,6 +704,10 @@ static const fuse_operations v6_oper = [](){
     ops.mknod = v6_mknod;
     ops.rename = v6_rename;
     ops.statfs = v6_statfs;
+    ops.release = v6_release;
+    ops.lseek = v6_lseek;
+    ops.fallocate = v6_fallocate;
+    ops.copy_file_range = v6_copy_file_range;
     return ops;
  }();
 
@@ -519,6 +719,19 @@ usage(const char *progname)
            "    -j                  Create journal if not already journaling\n"
            "    --checkuid          Use low byte of uid for access control\n"
            "    --force             Mount a dirty file system (beware!)\n"
+           "    --log-sync          Open the journal with O_DSYNC\n"
+           "    --log-direct        Write the journal with O_DIRECT\n"
+           "    --journal=FILE      Use (or with -j create) external journal\n"
+           "                        (default: <fs-image>.journal if external)\n"
+           "    --stats-json        SIGUSR1 dumps counters as JSON, not text\n"
+           "                        (always readable in /.v6stats{,.json})\n"
+           "    --defrag            Defragment files in the background\n"
+           "                        (needs a journal)\n"
+           "    --warm=FILE         Prefetch the blocks and inodes listed in\n"
+           "                        FILE, and list the cached ones there on\n"
+           "                        a clean unmount\n"
+           "    --cache-policy=P    Cache replacement: lru (default) or 2q\n"
+           "                        (2q resists scans, keeps metadata)\n"
            "    --suppress-commit   Write metadata to log but not file system\n"
            "                        (only for generating test cases!)\n"
            " watch all hell break loose\n"
@@ -544,6 +757,8 @@ mount_cleanup(std::string progdir, const char *mountpoint)
     if (pipe(fds) == -1)
         return;
 
+    // Built before forking, as the child should not allocate
+    const std::string fcpath = progdir + "/fusecleanup";
     pid = fork();
     if (!pid) {
         close(fds[1]);
@@ -557,7 +772,6 @@ mount_cleanup(std::string progdir, const char *mountpoint)
             dup2(fds[0], 0);
             close(fds[0]);
         }
-        std::string fcpath = progdir + "/fusecleanup";
         execl(fcpath.c_str(), fcpath.c_str(), mountpoint, nullptr);
         // We try to do this in a separate program so that pkill won't
         // kill it, but we fall back to running fusermount here.
@@ -608,10 +822,45 @@ main(int argc, char **argv)
         args.argv[0][0] = '\0';
     }
 
+    // Block SIGUSR1 before any threads start, so only stats_dumper
+    // gets it.
+    sigset_t usr1;
+    sigemptyset(&usr1);
+    sigaddset(&usr1, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &usr1, nullptr);
+
+    if (options.cache_policy) {
+        if (!strcmp(options.cache_policy, "2q"))
+            cache.set_policy(CachePolicy::TWO_Q);
+        else if (strcmp(options.cache_policy, "lru")) {
+            fprintf(stderr, "Error: unknown cache policy %s\n",
+                    options.cache_policy);
+            exit(1);
+        }
+    }
+
+    const std::string journal = options.journal ? options.journal : "";
+    std::optional<WarmHints> hints;
+    if (image && options.warm)
+        try {
+            hints = warm_load(options.warm,
+                              warm_fingerprint(image, journal));
+            if (!hints)
+                fprintf(stderr, "warm: ignoring missing or stale %s\n",
+                        options.warm);
+        }
+        catch (const std::exception &e) {
+            fprintf(stderr, "warm: %s\n", e.what());
+        }
+
     if (image) {
         int flags = 0;
         if (!options.force)
             flags |= V6FS::V6_MUST_BE_CLEAN;
+        if (options.log_sync)
+            flags |= V6FS::V6_LOGSYNC;
+        if (options.log_direct)
+            flags |= V6FS::V6_LOGDIRECT;
         if (options.create_journal) {
             flags |= V6FS::V6_MKLOG;
 
@@ -621,7 +870,7 @@ main(int argc, char **argv)
             // flags |= V6FS::V6_REPLAY;
         }
         try {
-            fs = new V6FS(image, cache, flags);
+            fs = new V6FS(image, cache, flags, journal);
         }
         catch(const std::exception &e) {
             fprintf(stderr, "Error: %s\n", e.what());
@@ -630,6 +879,10 @@ main(int argc, char **argv)
     }
     if (options.suppress_commit && fs && fs->log_)
         fs->log_->suppress_commit_ = true;
+    if (options.defrag && fs && !fs->log_) {
+        fprintf(stderr, "Error: --defrag requires a journal\n");
+        exit(1);
+    }
 
     // Spawn a process with the reading end of a pipe, so as to detect
     // the parent crashing by EOF on the pipe.  When the parent
@@ -637,8 +890,39 @@ main(int argc, char **argv)
     if (!options.show_help && mountpoint)
         mount_cleanup(progdir, mountpoint);
 
+    // Only now start our own threads, so none of them can hold a lock
+    // (such as malloc's) in mount_cleanup's forked children.
+    std::thread(stats_dumper).detach();
+    std::thread defrag_thread;
+    if (options.defrag && fs)
+        defrag_thread = std::thread(defragger);
+    std::thread warm_thread;
+    if (hints && fs)
+        warm_thread = std::thread(warmer, std::move(*hints));
+
     ret = fuse_main(args.argc, args.argv, &v6_oper, nullptr);
     fuse_opt_free_args(&args);
-    delete fs;
+    if (defrag_thread.joinable()) {
+        defrag_stop = true;
+        defrag_thread.join();
+    }
+    if (warm_thread.joinable()) {
+        warm_stop = true;
+        warm_thread.join();
+    }
+    if (fs && options.warm) {
+        WarmHints h = warm_capture(*fs);
+        delete fs;
+        try {
+            if (!warm_save(options.warm, h,
+                           warm_fingerprint(image, journal)))
+                perror(options.warm);
+        }
+        catch (const std::exception &e) {
+            fprintf(stderr, "warm: %s\n", e.what());
+        }
+    }
+    else
+        delete fs;
     return ret;
 }
@@ -5,14 +5,15 @@
 #include <iostream>
 
 #include "replay.hh"
+#include "trace.hh"
 #include "v6fs.hh"
 
 V6Replay::V6Replay(V6FS &fs)
-    : fs_(fs), r_(fs_.fd_),
+    : fs_(fs), r_(fs_.logfd()),
       freemap_(fs_.superblock().s_fsize, fs_.superblock().datastart())
 {
-    read_loghdr(fs_.fd_, &hdr_, fs_.superblock().s_fsize);
-    if (pread(fs.fd_, freemap_.data(), freemap_.datasize(),
+    read_loghdr(fs_.logfd(), &hdr_, fs_.superblock());
+    if (pread(fs.logfd(), freemap_.data(), freemap_.datasize(),
               hdr_.mapstart() * SECTOR_SIZE) == -1)
         threrror("pread");
     freemap_.tidy();
@@ -120,8 +121,10 @@ V6Replay::check_tx()
 void
 V6Replay::replay()
 {
+    TRACE_SPAN("replay", "replay", "from_lsn", hdr_.l_sequence);
     LogEntry le;
     while (check_tx()) {
+        TRACE_SPAN("replay", "tx", "lsn", sequence_ + 1);
         do {
             read_next(&le);
             le.visit([this](const auto &e) { apply(e); });
@@ -130,10 +133,11 @@ V6Replay::replay()
 
     std::cout << "played log entries " << hdr_.l_sequence
               << " to " << sequence_ << std::endl;
+    TRACE_INSTANT("replay", "done", "to_lsn", sequence_);
 
     hdr_.l_sequence = sequence_;
     hdr_.l_checkpoint = r_.tell();
-    if (pwrite(fs_.fd_, freemap_.data(), freemap_.datasize(),
+    if (pwrite(fs_.logfd(), freemap_.data(), freemap_.datasize(),
                hdr_.mapstart() * SECTOR_SIZE) == -1)
         threrror("pwrite");
     // We don't log inode allocations, so just force re-scan
@@ -145,7 +149,7 @@ V6Replay::replay()
     fs_.sync();
 
     // Now save to update checkpoint (and re-update superblock to show clean)
-    fs_.writeblock(&hdr_, fs_.superblock().s_fsize);
+    fs_.writelogblock(&hdr_, hdr_.l_hdrblock);
     fs_.superblock().s_fmod = 1;
     fs_.unclean_ = false;
 }
@@ -0,0 +1,292 @@
+#include <algorithm>
+#include <atomic>
+#include <iomanip>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+#include "stats.hh"
+
+namespace stats {
+
+namespace {
+
+const char *const counter_names[] = {
+    "buffer.hit", "buffer.miss", "buffer.evict", "buffer.writeback",
+    "inode.hit", "inode.miss", "inode.evict", "inode.writeback",
+    "cache.log_stall", "log.tx", "log.records", "log.bytes", "log.flushes",
+    "log.checkpoints",
+};
+static_assert(std::size(counter_names) == NCOUNTERS);
+
+const char *const gauge_names[] = {
+    "log.used_bytes", "log.size_bytes",
+};
+static_assert(std::size(gauge_names) == NGAUGES);
+
+const char *const timer_names[] = {
+    "op.getattr", "op.readdir", "op.open", "op.read", "op.write",
+    "op.create", "op.mknod", "op.mkdir", "op.unlink", "op.rmdir", "op.link",
+    "op.rename", "op.truncate", "op.utimens", "op.chown", "op.chmod",
+    "op.statfs", "op.lseek", "op.fallocate", "op.copy_file_range",
+    "log.flush", "log.checkpoint", "async.pwrite",
+};
+static_assert(std::size(timer_names) == NTIMERS);
+
+// Histograms keep SUB_BITS significant bits of each value, in the
+// style of HdrHistogram, so a recorded latency is within 12.5% of the
+// true value at any scale from nanoseconds to hours.
+constexpr unsigned SUB_BITS = 3;
+constexpr unsigned SUB = 1 << SUB_BITS;
+constexpr unsigned NBUCKETS = (64 - SUB_BITS + 1) * SUB;
+
+inline unsigned
+bucket(uint64_t v)
+{
+    if (v < 2 * SUB)
+        return v;
+    unsigned shift = 63 - __builtin_clzll(v) - SUB_BITS;
+    return shift * SUB + (v >> shift);
+}
+
+// Smallest value that falls in bucket b
+inline uint64_t
+bucket_low(unsigned b)
+{
+    if (b < 2 * SUB)
+        return b;
+    unsigned shift = b / SUB - 1;
+    return uint64_t(b % SUB + SUB) << shift;
+}
+
+// Only the owning thread writes a shard, so a relaxed load and store
+// is enough; the atomics just keep concurrent readers from tearing.
+template<typename T> inline void
+bump(std::atomic<T> &a, T n = 1)
+{
+    a.store(a.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+struct Histogram {
+    std::atomic<uint64_t> buckets[NBUCKETS];
+    std::atomic<uint64_t> count, sum, max; // sum and max in nanoseconds
+};
+
+struct Shard {
+    std::atomic<uint64_t> counters[NCOUNTERS];
+    Histogram hist[NTIMERS];
+
+    void merge_into(Shard &out) const {
+        for (unsigned i = 0; i < NCOUNTERS; ++i)
+            bump(out.counters[i], counters[i].load());
+        for (unsigned t = 0; t < NTIMERS; ++t) {
+            const Histogram &h = hist[t];
+            Histogram &o = out.hist[t];
+            for (unsigned b = 0; b < NBUCKETS; ++b)
+                if (uint64_t n = h.buckets[b].load())
+                    bump(o.buckets[b], n);
+            bump(o.count, h.count.load());
+            bump(o.sum, h.sum.load());
+            if (h.max.load() > o.max.load())
+                o.max.store(h.max.load());
+        }
+    }
+};
+
+struct Registry {
+    std::mutex mu_;
+    std::vector<Shard *> live_;
+    Shard retired_{};           // Totals of threads that have exited
+};
+
+// Never destroyed, since threads may exit after static destructors run
+Registry &
+registry()
+{
+    static Registry *r = new Registry;
+    return *r;
+}
+
+// A plain pointer, so it stays usable after the thread's destructors
+// have run (static destructors on the main thread still count things).
+thread_local Shard *local;
+
+struct RetireShard {
+    ~RetireShard() {
+        if (!local)
+            return;
+        Registry &r = registry();
+        std::lock_guard lk(r.mu_);
+        local->merge_into(r.retired_);
+        r.live_.erase(std::remove(r.live_.begin(), r.live_.end(), local),
+                      r.live_.end());
+        delete local;
+        local = nullptr;
+    }
+};
+thread_local RetireShard retire;
+
+std::atomic<int64_t> gauges[NGAUGES];
+
+// A shard made after RetireShard has run is never freed, which only
+// happens once, late in exit.
+Shard &
+mine()
+{
+    if (!local) {
+        auto s = std::make_unique<Shard>();
+        Registry &r = registry();
+        std::lock_guard lk(r.mu_);
+        r.live_.push_back(s.get());
+        local = s.release();
+        (void)&retire;          // Constructs it, registering the cleanup
+    }
+    return *local;
+}
+
+// Latency at quantile q in microseconds, reporting the top of the
+// bucket it falls in (but never more than the maximum seen).
+double
+quantile_us(const Histogram &h, double q)
+{
+    const uint64_t count = h.count.load(), max = h.max.load();
+    if (!count)
+        return 0;
+    uint64_t want = std::max<uint64_t>(1, q * count + 0.5), seen = 0;
+    for (unsigned b = 0; b < NBUCKETS; ++b)
+        if ((seen += h.buckets[b].load()) >= want)
+            return std::min(bucket_low(b + 1) - 1, max) / 1000.0;
+    return max / 1000.0;
+}
+
+// Sum of all threads' shards
+std::unique_ptr<Shard>
+totals()
+{
+    auto total = std::make_unique<Shard>();
+    Registry &r = registry();
+    std::lock_guard lk(r.mu_);
+    r.retired_.merge_into(*total);
+    for (const Shard *s : r.live_)
+        s->merge_into(*total);
+    return total;
+}
+
+double
+ratio(uint64_t num, uint64_t den)
+{
+    return den ? double(num) / den : 0;
+}
+
+} // anonymous namespace
+
+void
+add(Counter c, uint64_t n)
+{
+    bump(mine().counters[c], n);
+}
+
+void
+set(Gauge g, int64_t val)
+{
+    gauges[g].store(val, std::memory_order_relaxed);
+}
+
+void
+record(Timer t, std::chrono::nanoseconds elapsed)
+{
+    const uint64_t ns = std::max<int64_t>(0, elapsed.count());
+    Histogram &h = mine().hist[t];
+    bump(h.buckets[bucket(ns)]);
+    bump(h.count);
+    bump(h.sum, ns);
+    if (ns > h.max.load(std::memory_order_relaxed))
+        h.max.store(ns, std::memory_order_relaxed);
+}
+
+uint64_t
+get(Counter c)
+{
+    return totals()->counters[c].load();
+}
+
+std::string
+report(bool json)
+{
+    auto total = totals();
+    auto c = [&total](unsigned i) { return total->counters[i].load(); };
+    auto hit_rate = [&c](Counter cache) {
+        return ratio(c(cache + HIT), c(cache + HIT) + c(cache + MISS));
+    };
+    const double log_fill = ratio(gauges[LOG_USED_BYTES].load(),
+                                  gauges[LOG_SIZE_BYTES].load());
+
+    std::ostringstream os;
+    os << std::fixed << std::setprecision(1);
+    if (json) {
+        os << "{\"counters\": {";
+        for (unsigned i = 0; i < NCOUNTERS; ++i)
+            os << (i ? ", " : "") << '"' << counter_names[i] << "\": " << c(i);
+        os << "}, \"gauges\": {";
+        for (unsigned i = 0; i < NGAUGES; ++i)
+            os << (i ? ", " : "") << '"' << gauge_names[i] << "\": "
+               << gauges[i].load();
+        os << std::setprecision(4)
+           << "}, \"buffer.hit_rate\": " << hit_rate(BUFFER_CACHE)
+           << ", \"inode.hit_rate\": " << hit_rate(INODE_CACHE)
+           << ", \"log.fill\": " << log_fill
+           << std::setprecision(1) << ", \"latency_us\": {";
+        for (unsigned t = 0; t < NTIMERS; ++t) {
+            const Histogram &h = total->hist[t];
+            os << (t ? ", " : "") << '"' << timer_names[t] << "\": {"
+               << "\"count\": " << h.count.load()
+               << ", \"mean\": " << ratio(h.sum.load(), h.count.load()) / 1000
+               << ", \"p50\": " << quantile_us(h, .5)
+               << ", \"p90\": " << quantile_us(h, .9)
+               << ", \"p99\": " << quantile_us(h, .99)
+               << ", \"p999\": " << quantile_us(h, .999)
+               << ", \"max\": " << h.max.load() / 1000.0 << "}";
+        }
+        os << "}}\n";
+        return os.str();
+    }
+
+    auto line = [&os](const char *name) -> std::ostream & {
+        return os << "  " << std::left << std::setw(24) << name
+                  << std::right;
+    };
+    os << "counters:\n";
+    for (unsigned i = 0; i < NCOUNTERS; ++i)
+        line(counter_names[i]) << std::setw(14) << c(i) << "\n";
+    os << "gauges:\n";
+    for (unsigned i = 0; i < NGAUGES; ++i)
+        line(gauge_names[i]) << std::setw(14) << gauges[i].load() << "\n";
+    line("buffer.hit_rate") << std::setw(13)
+                            << 100 * hit_rate(BUFFER_CACHE) << "%\n";
+    line("inode.hit_rate") << std::setw(13)
+                           << 100 * hit_rate(INODE_CACHE) << "%\n";
+    line("log.fill") << std::setw(13) << 100 * log_fill << "%\n";
+    os << "latency (usec):" << std::string(11, ' ');
+    for (const char *h : { "count", "mean", "p50", "p90", "p99", "p99.9",
+                           "max" })
+        os << std::setw(10) << h;
+    os << "\n";
+    for (unsigned t = 0; t < NTIMERS; ++t) {
+        const Histogram &h = total->hist[t];
+        if (!h.count.load())
+            continue;
+        line(timer_names[t])
+            << std::setw(10) << h.count.load()
+            << std::setw(10) << ratio(h.sum.load(), h.count.load()) / 1000
+            << std::setw(10) << quantile_us(h, .5)
+            << std::setw(10) << quantile_us(h, .9)
+            << std::setw(10) << quantile_us(h, .99)
+            << std::setw(10) << quantile_us(h, .999)
+            << std::setw(10) << h.max.load() / 1000.0 << "\n";
+    }
+    return os.str();
+}
+
+} // namespace stats
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Performance counters and latency histograms.  Each thread updates
+// its own shard without locks or atomic read-modify-write, so
+// counting costs about as much as an ordinary increment.  Readers
+// sum the shards of all threads (plus those of threads that have
+// exited), which may be a few events stale but is never torn.
+namespace stats {
+
+// Each cache gets CACHE_NCOUNTERS consecutive counters.
+enum CacheCounter : unsigned {
+    HIT, MISS, EVICT, WRITEBACK, CACHE_NCOUNTERS,
+};
+
+enum Counter : unsigned {
+    BUFFER_CACHE = 0,
+    INODE_CACHE = BUFFER_CACHE + CACHE_NCOUNTERS,
+    CACHE_LOG_STALL = INODE_CACHE + CACHE_NCOUNTERS, // flush_all_logs calls
+    LOG_TX,
+    LOG_RECORDS,
+    LOG_BYTES,
+    LOG_FLUSHES,
+    LOG_CHECKPOINTS,
+    NCOUNTERS,
+};
+
+// Values that are set rather than accumulated
+enum Gauge : unsigned {
+    LOG_USED_BYTES,
+    LOG_SIZE_BYTES,
+    NGAUGES,
+};
+
+enum Timer : unsigned {
+    OP_GETATTR, OP_READDIR, OP_OPEN, OP_READ, OP_WRITE, OP_CREATE,
+    OP_MKNOD, OP_MKDIR, OP_UNLINK, OP_RMDIR, OP_LINK, OP_RENAME,
+    OP_TRUNCATE, OP_UTIMENS, OP_CHOWN, OP_CHMOD, OP_STATFS, OP_LSEEK,
+    OP_FALLOCATE, OP_COPY_FILE_RANGE,
+    LOG_FLUSH,                  // Waiting for the log to reach disk
+    LOG_CHECKPOINT,
+    ASYNC_PWRITE,               // One write by an AsyncFdWriter thread
+    NTIMERS,
+};
+
+void add(Counter c, uint64_t n = 1);
+inline void
+add(Counter cache, CacheCounter c)
+{
+    add(Counter(cache + c));
+}
+void set(Gauge g, int64_t val);
+// Current total of a counter over all threads
+uint64_t get(Counter c);
+void record(Timer t, std::chrono::nanoseconds elapsed);
+
+// Records the lifetime of the object in a latency histogram
+class Timed {
+public:
+    explicit Timed(Timer t)
+        : t_(t), start_(std::chrono::steady_clock::now()) {}
+    Timed(const Timed &) = delete;
+    ~Timed() { record(t_, std::chrono::steady_clock::now() - start_); }
+private:
+    const Timer t_;
+    const std::chrono::steady_clock::time_point start_;
+};
+
+// A snapshot of everything, formatted for people or as one line of JSON
+std::string report(bool json = false);
+
+} // namespace stats
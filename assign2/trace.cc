@@ -0,0 +1,190 @@
+#include "trace.hh"
+
+#ifdef V6TRACE
+
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace trace {
+
+namespace {
+
+struct Event {
+    uint64_t ts_;               // Nanoseconds since the tracer started
+    uint64_t dur_;              // Nanoseconds, for spans
+    const char *cat_, *name_, *k1_, *k2_;
+    uint64_t v1_, v2_;
+    uint32_t tid_;
+    char ph_;                   // Chrome phase: 'X' for span, 'i' instant
+};
+
+struct Tracer {
+    const std::string path_;
+    const std::chrono::steady_clock::time_point start_ =
+        std::chrono::steady_clock::now();
+    std::mutex mu_;
+    std::vector<Event> ring_;
+    uint64_t next_ = 0;         // Total events ever recorded
+    std::map<uint32_t, const char *> threads_;
+
+    Tracer(const char *path, size_t size) : path_(path), ring_(size) {}
+
+    uint64_t since_start(std::chrono::steady_clock::time_point t) const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            t - start_).count();
+    }
+
+    void add(const Event &e) {
+        std::lock_guard lk(mu_);
+        ring_[next_++ % ring_.size()] = e;
+    }
+};
+
+// nullptr when V6TRACE_FILE isn't set.  Never destroyed, so threads
+// can record events until the very end.
+Tracer *
+tracer()
+{
+    static Tracer *t = []() -> Tracer * {
+        const char *path = getenv("V6TRACE_FILE");
+        if (!path || !*path)
+            return nullptr;
+        size_t size = 1 << 18;
+        if (const char *n = getenv("V6TRACE_EVENTS"); n && atol(n) > 0)
+            size = atol(n);
+        Tracer *t = new Tracer(path, size);
+        atexit([]() {
+            Tracer *t = tracer();
+            if (!dump(t->path_.c_str()))
+                perror(t->path_.c_str());
+        });
+        return t;
+    }();
+    return t;
+}
+
+uint32_t
+tid()
+{
+    static thread_local uint32_t id = syscall(SYS_gettid);
+    return id;
+}
+
+// Event names are literals, but escape them anyway so a stray quote
+// can't corrupt the whole file.
+void
+put_string(FILE *fp, const char *s)
+{
+    putc('"', fp);
+    for (; *s; ++s) {
+        if (*s == '"' || *s == '\\')
+            putc('\\', fp);
+        if (static_cast<unsigned char>(*s) >= 0x20)
+            putc(*s, fp);
+    }
+    putc('"', fp);
+}
+
+} // anonymous namespace
+
+bool
+enabled()
+{
+    return tracer();
+}
+
+void
+instant(const char *cat, const char *name, const char *k1, uint64_t v1,
+        const char *k2, uint64_t v2)
+{
+    if (Tracer *t = tracer())
+        t->add({ t->since_start(std::chrono::steady_clock::now()), 0,
+                 cat, name, k1, k2, v1, v2, tid(), 'i' });
+}
+
+void
+thread_name(const char *name)
+{
+    if (Tracer *t = tracer()) {
+        std::lock_guard lk(t->mu_);
+        t->threads_[tid()] = name;
+    }
+}
+
+Span::~Span()
+{
+    if (!on_)
+        return;
+    Tracer *t = tracer();
+    uint64_t start = t->since_start(start_);
+    uint64_t end = t->since_start(std::chrono::steady_clock::now());
+    t->add({ start, end - start, cat_, name_, k1_, k2_, v1_, v2_, tid(),
+             'X' });
+}
+
+bool
+dump(const char *path)
+{
+    Tracer *t = tracer();
+    if (!t)
+        return true;
+    FILE *fp = fopen(path, "w");
+    if (!fp)
+        return false;
+
+    std::lock_guard lk(t->mu_);
+    const int pid = getpid();
+    fprintf(fp, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+    const char *sep = "";
+    for (auto [id, name] : t->threads_) {
+        fprintf(fp, "%s{\"ph\": \"M\", \"name\": \"thread_name\", "
+                "\"pid\": %d, \"tid\": %u, \"args\": {\"name\": ",
+                sep, pid, id);
+        put_string(fp, name);
+        fprintf(fp, "}}");
+        sep = ",\n";
+    }
+    const uint64_t size = t->ring_.size();
+    for (uint64_t i = t->next_ > size ? t->next_ - size : 0;
+         i < t->next_; ++i) {
+        const Event &e = t->ring_[i % size];
+        fprintf(fp, "%s{\"ph\": \"%c\", \"cat\": ", sep, e.ph_);
+        put_string(fp, e.cat_);
+        fprintf(fp, ", \"name\": ");
+        put_string(fp, e.name_);
+        fprintf(fp, ", \"pid\": %d, \"tid\": %u, \"ts\": %.3f", pid, e.tid_,
+                e.ts_ / 1000.0);
+        if (e.ph_ == 'X')
+            fprintf(fp, ", \"dur\": %.3f", e.dur_ / 1000.0);
+        else
+            fprintf(fp, ", \"s\": \"t\"");
+        fprintf(fp, ", \"args\": {");
+        if (e.k1_) {
+            put_string(fp, e.k1_);
+            fprintf(fp, ": %llu", (unsigned long long) e.v1_);
+        }
+        if (e.k2_) {
+            fprintf(fp, ", ");
+            put_string(fp, e.k2_);
+            fprintf(fp, ": %llu", (unsigned long long) e.v2_);
+        }
+        fprintf(fp, "}}");
+        sep = ",\n";
+    }
+    if (t->next_ > size)
+        fprintf(stderr, "trace: dropped %llu oldest events\n",
+                (unsigned long long) (t->next_ - size));
+    fprintf(fp, "\n]}\n");
+    return fclose(fp) == 0;
+}
+
+} // namespace trace
+
+#endif // V6TRACE
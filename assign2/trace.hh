@@ -0,0 +1,74 @@
+#pragma once
+
+// Event tracing for the cache, log and replay code.  Tracing is only
+// compiled in when V6TRACE is defined (make TRACE=1, after a make
+// clean).  Otherwise the TRACE_ macros expand to nothing and their
+// arguments are never evaluated.
+//
+// A traced binary records events only if the V6TRACE_FILE
+// environment variable is set.  Events go in a ring buffer of
+// V6TRACE_EVENTS entries (default 262144), which is written to
+// V6TRACE_FILE at exit in Chrome trace JSON.  You can load that file
+// into chrome://tracing or https://ui.perfetto.dev.
+//
+//   TRACE_SPAN(cat, name [, key1, val1 [, key2, val2]]);
+//       Record the time from here to the end of the enclosing scope.
+//   TRACE_INSTANT(cat, name [, key1, val1 [, key2, val2]]);
+//       Record a point in time.
+//   TRACE_THREAD(name);
+//       Label the current thread in the trace viewer.
+//
+// cat, name and keys must be string literals (or otherwise live
+// forever), and values are integers.
+
+#ifdef V6TRACE
+
+#include <chrono>
+#include <cstdint>
+
+namespace trace {
+
+bool enabled();
+void instant(const char *cat, const char *name,
+             const char *k1 = nullptr, uint64_t v1 = 0,
+             const char *k2 = nullptr, uint64_t v2 = 0);
+void thread_name(const char *name);
+// Write the events recorded so far; returns false on error.
+bool dump(const char *path);
+
+class Span {
+public:
+    Span(const char *cat, const char *name,
+         const char *k1 = nullptr, uint64_t v1 = 0,
+         const char *k2 = nullptr, uint64_t v2 = 0)
+        : cat_(cat), name_(name), k1_(k1), k2_(k2), v1_(v1), v2_(v2),
+          on_(enabled()) {
+        if (on_)
+            start_ = std::chrono::steady_clock::now();
+    }
+    Span(const Span &) = delete;
+    ~Span();
+
+private:
+    const char *cat_, *name_, *k1_, *k2_;
+    uint64_t v1_, v2_;
+    const bool on_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+} // namespace trace
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SPAN(...) \
+    ::trace::Span TRACE_CONCAT(trace_span_, __LINE__)(__VA_ARGS__)
+#define TRACE_INSTANT(...) ::trace::instant(__VA_ARGS__)
+#define TRACE_THREAD(name) ::trace::thread_name(name)
+
+#else // !V6TRACE
+
+#define TRACE_SPAN(...) ((void) 0)
+#define TRACE_INSTANT(...) ((void) 0)
+#define TRACE_THREAD(name) ((void) 0)
+
+#endif // !V6TRACE
@@ -17,25 +17,37 @@ splitpath(const char *path)
     return {{path, p}, *tail ? tail : "."};
 }
 
-std::vector<std::string>
-path_components(const std::string &s)
+PathComponents::PathComponents(std::string_view s)
 {
-    std::vector<std::string> ret;
-    for (std::string::size_type p = 0;;) {
+    for (size_t p = 0;;) {
         if (p = s.find_first_not_of('/', p); p == s.npos)
-            return ret;
-        std::string::size_type e = s.find_first_of('/', p);
+            return;
+        size_t e = s.find_first_of('/', p);
         if (e == s.npos)
             e = s.size();
-        std::string_view sv(s.data() + p, e - p);
-        if (sv == ".." && !ret.empty())
-            ret.pop_back();
+        std::string_view sv = s.substr(p, e - p);
+        if (sv == ".." && n_ > 0)
+            pop_back();
         else if (sv != ".")
-            ret.emplace_back(sv);
+            push_back(sv);
         p = e;
     }
 }
 
+void
+PathComponents::push_back(std::string_view name)
+{
+    if (n_ == INLINE && spill_.empty())
+        spill_.assign(inline_, inline_ + INLINE);
+    if (spill_.empty())
+        inline_[n_] = name;
+    else if (n_ < spill_.size())
+        spill_[n_] = name;
+    else
+        spill_.push_back(name);
+    ++n_;
+}
+
 void
 unique_fd::close()
 {
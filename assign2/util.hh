@@ -3,6 +3,7 @@
 
 #include <functional>
 #include <string>
+#include <string_view>
 #include <system_error>
 #include <utility>
 #include <vector>
@@ -17,8 +18,33 @@ threrror(const char *msg)
 // Split a path into the directory and filename components.
 std::pair<std::string,std::string> splitpath(const char *path);
 
-// Split a path into its path components.
-std::vector<std::string> path_components(const std::string &s);
+// The components of a path, as views into the path string (which
+// must outlive this object).  "." components are dropped, and ".."
+// cancels the component before it.  Paths with up to INLINE
+// components don't allocate any memory.
+class PathComponents {
+public:
+    explicit PathComponents(std::string_view path);
+    PathComponents(const PathComponents &) = delete;
+
+    const std::string_view *begin() const { return data(); }
+    const std::string_view *end() const { return data() + n_; }
+    size_t size() const { return n_; }
+    bool empty() const { return n_ == 0; }
+    std::string_view back() const { return data()[n_ - 1]; }
+    void pop_back() { --n_; }
+
+private:
+    static constexpr size_t INLINE = 16;
+    size_t n_ = 0;
+    std::string_view inline_[INLINE];
+    std::vector<std::string_view> spill_; // All components, if > INLINE
+
+    const std::string_view *data() const {
+        return spill_.empty() ? inline_ : spill_.data();
+    }
+    void push_back(std::string_view name);
+};
 
 // A file descriptor that closes itself on destruction
 struct unique_fd {
@@ -1,12 +1,16 @@
 
+#include <algorithm>
+#include <chrono>
 #include <cstring>
 #include <ctime>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <map>
 #include <sstream>
 #include <string>
 
+#include <dirent.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <sys/stat.h>
@@ -14,6 +18,7 @@
 #include <unistd.h>
 
 #include "blockpath.hh"
+#include "defrag.hh"
 #include "fsops.hh"
 
 using namespace std::string_literals;
@@ -30,17 +35,36 @@ fs_path()
     return "v6.img";
 }
 
+// External journal given with -J, if any
+static const char *journal_opt;
+
+static std::string
+fs_journal()
+{
+    return journal_opt ? journal_opt : journal_path(fs_path());
+}
+
+// Opened by the first command to use it, with that command's flags
+static std::unique_ptr<V6FS> fsp;
+static int fsp_flags;
+
 static V6FS &
 fs(int flags = V6FS::V6_NOLOG)
 {
-    flags |= V6FS::V6_NOLOG;
-    static std::unique_ptr<V6FS> fsp;
+    // Only commands that replay the journal get to use it
+    if (!(flags & V6FS::V6_REPLAY))
+        flags |= V6FS::V6_NOLOG;
+    // In a script, reopen if this command needs the journal or a
+    // clean file system when the open one doesn't, or vice versa.
+    // (A read-write file system does for read-only commands.)
+    if (fsp && ((flags ^ fsp_flags) & V6FS::V6_REPLAY ||
+                (fsp->readonly_ && !(flags & V6FS::V6_RDONLY)) ||
+                (flags & V6FS::V6_MUST_BE_CLEAN && fsp->unclean_)))
+        fsp.reset();
     if (!fsp) {
-        const char *target = getenv("V6IMG");
-        if (!target)
-            target = "v6.img";
-        fsp = std::make_unique<V6FS>(target, cache, flags);
-        return *fsp;
+        fsp = std::make_unique<V6FS>(fs_path(), cache, flags,
+                                     journal_opt ? journal_opt : "");
+        fsp_flags = flags;
     }
     return *fsp;
 }
@@ -318,32 +342,21 @@ cmd_iblock(int argc, char **argv)
     }
 }
 
-void
-cmd_put(int argc, char **argv)
+// Copy host file src to fname in dir, printing errors with the name
+// dst.  Returns false on failure.
+static bool
+put_file(const char *src, Ref<Inode> dir, std::string_view fname,
+         const std::string &dst)
 {
-    if (argc != 2) {
-        std::cerr << "usage: put FILE V6FILE" << std::endl;
-        return;
-    }
-
-    unique_fd in{ argv[0] == "-"s ? dup(0) : open(argv[0], O_RDONLY) };
+    unique_fd in{ src == "-"s ? dup(0) : open(src, O_RDONLY) };
     if (in == -1) {
-        std::cerr << argv[0] << ": " << strerror(errno) << std::endl;
-        return;
+        std::cerr << src << ": " << strerror(errno) << std::endl;
+        return false;
     }
     if (struct stat sb; fstat(in, &sb) == -1 ||
         (sb.st_mode&S_IFMT) == S_IFDIR) {
-        std::cerr << argv[0] << ": is a directory" << std::endl;
-        return;
-    }
-
-    auto [dname, fname] = splitpath(argv[1]);
-    if (fname == ".")
-        fname = splitpath(argv[0]).second;
-    Ref<Inode> dir = fs().namei(dname);
-    if (!dir) {
-        std::cerr << argv[1] << ": no such directory" << std::endl;
-        return;
+        std::cerr << src << ": is a directory" << std::endl;
+        return false;
     }
 
     Dirent de = dir->create(fname);
@@ -351,15 +364,15 @@ cmd_put(int argc, char **argv)
     if (de.inum()) {
         out = fs().iget(de.inum());
         if ((out->i_mode & IFMT) != IFREG) {
-            std::cerr << argv[1] << ": not a regular file" << std::endl;
-            return;
+            std::cerr << dst << ": not a regular file" << std::endl;
+            return false;
         }
         out->truncate();
     }
     else {
         if (out = fs().ialloc(); !out) {
             std::cerr << "out of inodes" << std::endl;
-            return;
+            return false;
         }
         out->i_mode = IALLOC|0644;
         out->i_nlink = 1;
@@ -374,14 +387,116 @@ cmd_put(int argc, char **argv)
         int n = read(in, buf, sizeof(buf));
         if (n <= 0) {
             if (n < 0)
-                std::cerr << argv[0] << ": " << strerror(errno) << std::endl;
+                std::cerr << src << ": " << strerror(errno) << std::endl;
             out->put();
-            return;
+            return n == 0;
         }
         c.write(buf, n);
     }
 }
 
+// Copy the contents of host directory src into dir, recursively.
+// Host entries are copied in name order, so images come out the same
+// every time.
+static void
+put_tree(const std::string &src, Ref<Inode> dir, const std::string &dst)
+{
+    std::vector<std::string> names;
+    if (DIR *d = opendir(src.c_str())) {
+        while (struct dirent *e = readdir(d))
+            if (e->d_name != "."s && e->d_name != ".."s)
+                names.push_back(e->d_name);
+        closedir(d);
+    }
+    else {
+        std::cerr << src << ": " << strerror(errno) << std::endl;
+        return;
+    }
+    std::sort(names.begin(), names.end());
+
+    for (const std::string &name : names) {
+        std::string from = src + "/" + name, to = dst + "/" + name;
+        struct stat sb;
+        if (lstat(from.c_str(), &sb) == -1) {
+            std::cerr << from << ": " << strerror(errno) << std::endl;
+            continue;
+        }
+        if (name.size() > sizeof(direntv6::d_name)) {
+            std::cerr << from << ": name too long" << std::endl;
+            continue;
+        }
+        if (S_ISREG(sb.st_mode))
+            put_file(from.c_str(), dir, name, to);
+        else if (S_ISDIR(sb.st_mode)) {
+            Dirent de;
+            int err = fs_named(&de, dir, name, ND_CREATE);
+            if (!err && !de.inum())
+                err = fs_mkdir(de, [&sb](inode *ip) {
+                    ip->i_mode |= sb.st_mode & 0777;
+                });
+            if (err) {
+                std::cerr << to << ": " << strerror(-err) << std::endl;
+                continue;
+            }
+            Ref<Inode> sub = fs().iget(de.inum());
+            if ((sub->i_mode & IFMT) != IFDIR)
+                std::cerr << to << ": not a directory" << std::endl;
+            else
+                put_tree(from, sub, to);
+        }
+        else
+            std::cerr << from << ": not a regular file or directory"
+                      << std::endl;
+    }
+}
+
+void
+cmd_put(int argc, char **argv)
+{
+    const bool recursive = argc > 0 && argv[0] == "-r"s;
+    if (recursive) {
+        --argc;
+        ++argv;
+    }
+    if (argc != 2) {
+        std::cerr << "usage: put FILE V6FILE\n"
+                  << "       put -r DIR V6DIR" << std::endl;
+        return;
+    }
+
+    auto [dname, fname] = splitpath(argv[1]);
+    if (fname == "." && !recursive)
+        fname = splitpath(argv[0]).second;
+    Ref<Inode> dir = fs().namei(dname);
+    if (!dir) {
+        std::cerr << argv[1] << ": no such directory" << std::endl;
+        return;
+    }
+    if (!recursive) {
+        put_file(argv[0], dir, fname, argv[1]);
+        return;
+    }
+
+    // V6DIR gets created if it doesn't exist
+    Ref<Inode> top = fs().namei(argv[1]);
+    if (!top) {
+        Dirent de;
+        int err = fs_named(&de, dir, fname, ND_CREATE);
+        if (!err)
+            err = fs_mkdir(de, [](inode *ip) { ip->i_mode |= 0755; });
+        if (err) {
+            std::cerr << argv[1] << ": " << strerror(-err) << std::endl;
+            return;
+        }
+        top = fs().iget(de.inum());
+    }
+    if ((top->i_mode & IFMT) != IFDIR) {
+        std::cerr << argv[1] << ": not a directory" << std::endl;
+        return;
+    }
+    put_tree(argv[0], top, argv[1]);
+}
+
 void
 cmd_unlink(int argc, char **argv)
 {
@@ -416,6 +531,9 @@ cmd_unlink(int argc, char **argv)
 void
 cmd_dump(int argc, char **argv)
 {
+    // Reads the disk directly, so write out earlier commands' changes
+    if (fsp)
+        fsp->sync();
     unique_fd fd(open(fs_path(), O_RDONLY));
     if (fd == -1) {
         perror(fs_path());
@@ -457,12 +575,22 @@ cmd_dump(int argc, char **argv)
     DUMP(s_uselog);
     DUMP(s_dirty);
 #undef DUMP
+    if (s.logid())
+        printf("%11s: 0x%x\n", "s_logid", s.logid());
     if (!s.s_uselog)
         return;
 
+    if (s.logid()) {
+        std::string journal = fs_journal();
+        fd.set(open(journal.c_str(), O_RDONLY));
+        if (fd == -1) {
+            perror(journal.c_str());
+            return;
+        }
+    }
     loghdr h;
     try {
-        read_loghdr(fd, &h, s.s_fsize);
+        read_loghdr(fd, &h, s);
     }
     catch (std::exception &e) {
         return;
@@ -475,6 +603,8 @@ cmd_dump(int argc, char **argv)
     DUMP(%d, l_mapsize);
     DUMP(%d, l_checkpoint);
     DUMP(%u, l_sequence);
+    if (h.l_logid)
+        DUMP(0x%x, l_logid);
 #undef DUMP
 }
 
@@ -540,6 +670,75 @@ cmd_deface(int argc, char **argv)
         }
 }
 
+// Add a journal to a file system that has none, as mountv6 -j does.
+void
+cmd_mklog(int argc, char **argv)
+{
+    if (argc > 1) {
+        std::cerr << "usage: mklog [#journal-blocks]" << std::endl;
+        return;
+    }
+    V6FS &f = fs(V6FS::V6_MUST_BE_CLEAN);
+    if (f.superblock().s_uselog) {
+        std::cerr << fs_path() << ": already has a journal" << std::endl;
+        return;
+    }
+    V6Log::create(f, argc ? atoi(argv[0]) : 0);
+}
+
+// Make files contiguous, moving their blocks through the journal.
+// With -n, only report fragmented files.
+void
+cmd_defrag(int argc, char **argv)
+{
+    const bool dry_run = argc > 0 && argv[0] == "-n"s;
+    if (dry_run) {
+        --argc;
+        ++argv;
+    }
+    V6FS &f = fs(dry_run ? V6FS::V6_RDONLY
+                 : V6FS::V6_MUST_BE_CLEAN|V6FS::V6_REPLAY);
+    if (!dry_run && !f.log_)
+        throw std::runtime_error(fs_path() + ": no journal"s +
+                                 " (create one with mklog)");
+
+    std::vector<std::pair<uint16_t, std::string>> files;
+    if (argc == 0) {
+        unsigned ninodes = f.superblock().s_isize * INODES_PER_BLOCK;
+        for (unsigned i = ROOT_INUMBER; i <= ninodes; ++i)
+            files.emplace_back(i, "#" + std::to_string(i));
+    }
+    for (int i = 0; i < argc; ++i)
+        if (Ref<Inode> ip = f.namei(argv[i]))
+            files.emplace_back(ip->inum(), argv[i]);
+        else
+            std::cerr << argv[i] << ": no such file or directory" << std::endl;
+
+    DefragStats st;
+    for (auto &[inum, name] : files) {
+        const DefragStats prev = st;
+        if (!dry_run)
+            defrag_inode(f, inum, &st);
+        else if (Ref<Inode> ip = f.iget(inum);
+                 (ip->i_mode & IALLOC) &&
+                 ((ip->i_mode & IFMT) == IFREG ||
+                  (ip->i_mode & IFMT) == IFDIR)) {
+            uint32_t n = file_extents(ip);
+            ++st.files;
+            st.fragmented += n > 1;
+            st.extents_before += n;
+            st.extents_after += n;
+        }
+        if (st.fragmented == prev.fragmented)
+            continue;
+        printf("%s: %u", name.c_str(),
+               st.extents_before - prev.extents_before);
+        if (!dry_run)
+            printf(" -> %u", st.extents_after - prev.extents_after);
+        printf(" extents\n");
+    }
+    fputs(st.summary().c_str(), stdout);
+}
 
 std::map<std::string, std::function<void(int,char **)>> commands {
     {"block", cmd_block},
@@ -554,6 +753,8 @@ std::map<std::string, std::function<void(int,char **)>> commands {
     {"usedblocks", cmd_usedblocks},
     {"usedinodes", cmd_usedinodes},
     {"deface", cmd_deface},
+    {"defrag", cmd_defrag},
+    {"mklog", cmd_mklog},
 };
 
 [[noreturn]] void
@@ -562,10 +763,107 @@ usage(int err = 1)
     auto &out = err ? std::cerr : std::cout;
     out << "usage:\n";
     for (auto [name, fn] : commands)
-        out << "  " << progname << " " << name << " [args...]\n";
+        out << "  " << progname << " [-J journal] " << name << " [args...]\n";
+    out << "  " << progname << " [-J journal] -b SCRIPT|-     "
+        << "(one command per line)\n";
     exit(err);
 }
 
+// Split a script line into words.  Words are separated by white
+// space, and can be quoted with ' or ".  A # starts a comment.
+static std::vector<std::string>
+split_words(const std::string &line)
+{
+    std::vector<std::string> words;
+    std::string w;
+    bool inword = false;
+    char quote = 0;
+    for (char c : line) {
+        if (quote) {
+            if (c == quote)
+                quote = 0;
+            else
+                w += c;
+        }
+        else if (c == '\'' || c == '"')
+            quote = c, inword = true;
+        else if (c == '#' && !inword)
+            break;
+        else if (isspace(static_cast<unsigned char>(c))) {
+            if (inword)
+                words.push_back(std::move(w));
+            w.clear();
+            inword = false;
+        }
+        else
+            w += c, inword = true;
+    }
+    if (inword)
+        words.push_back(std::move(w));
+    return words;
+}
+
+// Run one command per line of script (or standard input if "-")
+// against a single open file system, so the cache stays warm.  Each
+// command's run time goes to standard error.
+static int
+batch(const char *script)
+{
+    std::ifstream file;
+    if (script != "-"s) {
+        file.open(script);
+        if (!file) {
+            perror(script);
+            return 1;
+        }
+    }
+    std::istream &in = script == "-"s ? std::cin : file;
+
+    // Open read-write up front, so that read-only commands don't
+    // make the next command that writes reopen the file system.
+    try {
+        fs(V6FS::V6_NOLOG);
+    }
+    catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    int status = 0, lineno = 0;
+    for (std::string line; std::getline(in, line);) {
+        ++lineno;
+        std::vector<std::string> words = split_words(line);
+        if (words.empty())
+            continue;
+        auto cmd = commands.find(words[0]);
+        if (cmd == commands.end()) {
+            std::cerr << script << ":" << lineno << ": unknown command "
+                      << words[0] << std::endl;
+            status = 1;
+            continue;
+        }
+        std::vector<char *> argv;
+        for (size_t i = 1; i < words.size(); ++i)
+            argv.push_back(words[i].data());
+        argv.push_back(nullptr);
+
+        auto start = std::chrono::steady_clock::now();
+        try {
+            cmd->second(argv.size() - 1, argv.data());
+        }
+        catch (const std::exception &e) {
+            std::cerr << script << ":" << lineno << ": " << e.what()
+                      << std::endl;
+            status = 1;
+        }
+        std::cout.flush();
+        fflush(stdout);
+        std::chrono::duration<double, std::milli> ms =
+            std::chrono::steady_clock::now() - start;
+        fprintf(stderr, "%10.3f ms  %s\n", ms.count(), line.c_str());
+    }
+    return status;
+}
+
 int
 main(int argc, char **argv)
 {
@@ -576,10 +874,26 @@ main(int argc, char **argv)
     else
         progname = argv[0];
 
+    if (argc > 2 && argv[1] == "-J"s) {
+        journal_opt = argv[2];
+        argc -= 2;
+        argv += 2;
+    }
     if (argc < 2)
         usage();
+    if (argv[1] == "-b"s) {
+        if (argc != 3)
+            usage();
+        return batch(argv[2]);
+    }
     auto cmd = commands.find(argv[1]);
     if (cmd == commands.end())
         usage();
-    cmd->second(argc-2, argv+2);
+    try {
+        cmd->second(argc-2, argv+2);
+    }
+    catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
 }
@@ -0,0 +1,504 @@
+// Benchmark the file system library directly, without FUSE.  Each
+// workload runs on a freshly generated image, once with and once
+// without the journal, and prints one JSON object per run.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "fsops.hh"
+#include "mkfs.hh"
+
+const char *progname;
+
+[[noreturn]] static void
+usage()
+{
+    fprintf(stderr, "usage: %s [-n ops] [-w workload,...] [-j on|off|both]"
+            " [-s seed] [-c cache-blocks] [-p lru|2q] [-o out.json]"
+            " [scratch.img]\n"
+            "workloads: mknod mkdir write read truncate rename unlink"
+            " lookup scanmix\n",
+            progname);
+    exit(1);
+}
+
+// Files per directory, so no single directory gets huge
+constexpr unsigned DIR_FILES = 64;
+// Bytes per read or write operation
+constexpr unsigned IO_SIZE = 4096;
+// Bytes each file holds when a workload needs existing data
+constexpr unsigned FILE_SIZE = 2 * IO_SIZE;
+// Files whose lookups make up scanmix's hot working set
+constexpr unsigned HOT_FILES = 2 * DIR_FILES;
+
+// Heap allocations by any thread, counted by replacing operator new
+static std::atomic<uint64_t> allocations;
+
+void *
+operator new(size_t n)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = malloc(n ? n : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void
+operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void
+operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+struct Config {
+    unsigned nops = 2000;
+    unsigned seed = 1;
+    size_t cache_blocks = 16;
+    CachePolicy policy = CachePolicy::LRU;
+    std::string image = "v6bench.img";
+};
+
+// System-wide counters sampled before and after each run
+struct Sample {
+    std::chrono::steady_clock::time_point when;
+    uint64_t syscalls = 0;      // read-like plus write-like system calls
+    uint64_t log_bytes = 0;
+    uint64_t allocs = 0;
+
+    static Sample take(V6FS &fs) {
+        Sample s;
+        s.when = std::chrono::steady_clock::now();
+        // Read into a stack buffer, so as not to count our own
+        // allocations
+        char buf[1024];
+        ssize_t n = -1;
+        if (int fd = open("/proc/self/io", O_RDONLY); fd != -1) {
+            n = read(fd, buf, sizeof(buf) - 1);
+            close(fd);
+        }
+        buf[std::max<ssize_t>(n, 0)] = '\0';
+        for (const char *key : { "syscr: ", "syscw: " })
+            if (const char *p = strstr(buf, key))
+                s.syscalls += strtoull(p + strlen(key), nullptr, 10);
+        if (fs.log_)
+            s.log_bytes = fs.log_->bytes_logged_;
+        s.allocs = allocations.load();
+        return s;
+    }
+};
+
+class Bench {
+public:
+    Bench(const Config &conf, bool journal)
+        : conf_(conf), journal_(journal), cache_(conf.cache_blocks),
+          rnd_(conf.seed) {
+        unlink(conf_.image.c_str());
+        if (!make_fs(conf_.image.c_str(), 0xffff, 2 * conf_.nops + 100,
+                     journal ? 0 : -1))
+            exit(1);
+        cache_.set_policy(conf.policy);
+        fs_ = std::make_unique<V6FS>(conf_.image, cache_);
+    }
+    ~Bench() {
+        fs_ = nullptr;
+        unlink(conf_.image.c_str());
+    }
+
+    // Set up whatever state the workload needs, then time nops
+    // operations and return the result as a JSON object.
+    std::string run(const std::string &workload);
+
+private:
+    const Config &conf_;
+    const bool journal_;
+    FScache cache_;
+    std::unique_ptr<V6FS> fs_;
+    std::mt19937 rnd_;
+    std::vector<double> lat_;   // Latency of each operation in usec
+    std::vector<std::string> paths_; // Built ahead of time for lookup
+    std::vector<uint16_t> scan_inums_; // Files scanmix reads in turn
+    unsigned scan_next_ = 0;    // Position of scanmix's read, in IO_SIZEs
+
+    static std::string name(const char *prefix, unsigned i) {
+        return "/d" + std::to_string(i / DIR_FILES) + "/" + prefix
+            + std::to_string(i);
+    }
+    Ref<Inode> root() { return fs_->iget(ROOT_INUMBER); }
+    Dirent named(const std::string &path, int flags);
+    Ref<Inode> file(unsigned i) {
+        return fs_->iget(named(name("f", i), 0).inum());
+    }
+
+    void check(int err, const char *what) {
+        if (err)
+            throw std::runtime_error(std::string(what) + ": "
+                                     + strerror(-err));
+    }
+
+    void make_dirs(unsigned nfiles);
+    void op_mknod(unsigned i);
+    void op_mkdir(unsigned i);
+    void op_write(unsigned i);
+    void op_read(unsigned i);
+    void op_truncate(unsigned i);
+    void op_rename(unsigned i);
+    void op_unlink(unsigned i);
+    void op_lookup(unsigned i);
+    void op_scanmix(unsigned i);
+
+    // lat_ must already have room for nops latencies
+    template<typename F> void time_ops(F &&f) {
+        for (unsigned i = 0; i < conf_.nops; ++i) {
+            auto start = std::chrono::steady_clock::now();
+            f(i);
+            std::chrono::duration<double, std::micro> d =
+                std::chrono::steady_clock::now() - start;
+            lat_.push_back(d.count());
+        }
+    }
+};
+
+Dirent
+Bench::named(const std::string &path, int flags)
+{
+    Dirent de;
+    // Only creating a directory entry modifies the file system
+    Tx tx = flags & ND_CREATE ? fs_->begin() : Tx();
+    check(fs_named(&de, root(), path, flags), path.c_str());
+    return de;
+}
+
+void
+Bench::make_dirs(unsigned nfiles)
+{
+    for (unsigned d = 0; d * DIR_FILES < nfiles; ++d)
+        check(fs_mkdir(named("/d" + std::to_string(d),
+                             ND_CREATE|ND_EXCLUSIVE),
+                       [](inode *ip) { ip->i_mode |= 0755; }),
+              "mkdir");
+}
+
+void
+Bench::op_mknod(unsigned i)
+{
+    check(fs_mknod(named(name("f", i), ND_CREATE|ND_EXCLUSIVE),
+                   [](inode *ip) { ip->i_mode |= 0644; }),
+          "mknod");
+}
+
+void
+Bench::op_mkdir(unsigned i)
+{
+    check(fs_mkdir(named(name("m", i), ND_CREATE|ND_EXCLUSIVE),
+                   [](inode *ip) { ip->i_mode |= 0755; }),
+          "mkdir");
+}
+
+// Append IO_SIZE bytes to file i % nops, so the writes interleave
+// across files the way several writers would.
+void
+Bench::op_write(unsigned i)
+{
+    static const std::string buf(IO_SIZE, 'x');
+    Ref<Inode> ip = file(i % conf_.nops);
+    Tx tx = fs_->begin();
+    Cursor c(ip);
+    c.seek(ip->size());
+    if (c.write(buf.data(), IO_SIZE) != int(IO_SIZE))
+        throw std::runtime_error("write: short write");
+    ip->mtouch(DoLog::NOLOG);
+}
+
+void
+Bench::op_read(unsigned)
+{
+    char buf[IO_SIZE];
+    Ref<Inode> ip = file(rnd_() % conf_.nops);
+    Cursor c(ip);
+    c.seek(rnd_() % (FILE_SIZE / IO_SIZE) * IO_SIZE);
+    if (c.read(buf, IO_SIZE) != int(IO_SIZE))
+        throw std::runtime_error("read: short read");
+}
+
+void
+Bench::op_truncate(unsigned i)
+{
+    Ref<Inode> ip = file(i);
+    Tx tx = fs_->begin();
+    ip->truncate(rnd_() % ip->size());
+    ip->mtouch();
+}
+
+void
+Bench::op_rename(unsigned i)
+{
+    // Move to another directory half the time
+    unsigned j = rnd_() % 2 ? i : (i + DIR_FILES) % conf_.nops;
+    Dirent oldde = named(name("f", i), ND_DIRWRITE);
+    Tx tx = fs_->begin();
+    Dirent newde = named("/d" + std::to_string(j / DIR_FILES) + "/r"
+                         + std::to_string(i), ND_CREATE|ND_EXCLUSIVE);
+    check(fs_rename(oldde, newde), "rename");
+}
+
+void
+Bench::op_unlink(unsigned i)
+{
+    check(fs_unlink(named(name("f", i), ND_DIRWRITE)), "unlink");
+}
+
+// Resolve the path of an existing file the ways FUSE requests do
+void
+Bench::op_lookup(unsigned)
+{
+    const std::string &path = paths_[rnd_() % paths_.size()];
+    Dirent de;
+    check(fs_named(&de, root(), path, 0), path.c_str());
+    if (!fs_->namei(path))
+        throw std::runtime_error(path + ": namei failed");
+}
+
+// A hot lookup interleaved with the next IO_SIZE bytes of one long
+// sequential read through every file, the way a backup or fsck pass
+// competes with interactive use.  Tests how well the cache keeps the
+// hot directory blocks.
+void
+Bench::op_scanmix(unsigned i)
+{
+    op_lookup(i);
+    char buf[IO_SIZE];
+    const unsigned per_file = FILE_SIZE / IO_SIZE;
+    Cursor c(fs_->iget(scan_inums_[scan_next_ / per_file]));
+    c.seek(scan_next_ % per_file * IO_SIZE);
+    if (c.read(buf, IO_SIZE) != int(IO_SIZE))
+        throw std::runtime_error("scanmix: short read");
+    scan_next_ = (scan_next_ + 1) % (scan_inums_.size() * per_file);
+}
+
+std::string
+Bench::run(const std::string &workload)
+{
+    static const std::vector<std::string> needs_files = {
+        "write", "read", "truncate", "rename", "unlink", "lookup",
+        "scanmix",
+    };
+    static const std::vector<std::string> needs_data = {
+        "read", "truncate", "unlink", "scanmix",
+    };
+    auto in = [&workload](const std::vector<std::string> &v) {
+        return std::find(v.begin(), v.end(), workload) != v.end();
+    };
+
+    const unsigned n = conf_.nops;
+    make_dirs(n);
+    if (in(needs_files))
+        for (unsigned i = 0; i < n; ++i)
+            op_mknod(i);
+    if (in(needs_data))
+        for (unsigned i = 0; i < n * FILE_SIZE / IO_SIZE; ++i)
+            op_write(i);
+    if (workload == "lookup")
+        for (unsigned i = 0; i < n; ++i)
+            paths_.push_back(name("f", i));
+    if (workload == "scanmix")
+        for (unsigned i = 0; i < n; ++i) {
+            if (i < HOT_FILES)
+                paths_.push_back(name("f", i));
+            scan_inums_.push_back(named(name("f", i), 0).inum());
+        }
+    fs_->sync();
+
+    auto buffer = [](stats::CacheCounter c) {
+        return stats::get(stats::Counter(stats::BUFFER_CACHE + c));
+    };
+    // Anything that allocates goes before the first sample
+    const uint64_t hits = buffer(stats::HIT), misses = buffer(stats::MISS);
+    const uint64_t checkpoints = stats::get(stats::LOG_CHECKPOINTS);
+    lat_.clear();
+    lat_.reserve(n);
+    Sample before = Sample::take(*fs_);
+    if (workload == "mknod")
+        time_ops([this](unsigned i) { op_mknod(i); });
+    else if (workload == "mkdir")
+        time_ops([this](unsigned i) { op_mkdir(i); });
+    else if (workload == "write")
+        time_ops([this](unsigned i) { op_write(i); });
+    else if (workload == "read")
+        time_ops([this](unsigned i) { op_read(i); });
+    else if (workload == "truncate")
+        time_ops([this](unsigned i) { op_truncate(i); });
+    else if (workload == "rename")
+        time_ops([this](unsigned i) { op_rename(i); });
+    else if (workload == "unlink")
+        time_ops([this](unsigned i) { op_unlink(i); });
+    else if (workload == "lookup")
+        time_ops([this](unsigned i) { op_lookup(i); });
+    else if (workload == "scanmix")
+        time_ops([this](unsigned i) { op_scanmix(i); });
+    else
+        throw std::invalid_argument("unknown workload " + workload);
+    Sample ops_done = Sample::take(*fs_);
+    const uint64_t nhits = buffer(stats::HIT) - hits,
+        nmisses = buffer(stats::MISS) - misses;
+    const uint64_t ncheckpoints =
+        stats::get(stats::LOG_CHECKPOINTS) - checkpoints;
+    // Count the deferred writes too, or write-back caching looks free
+    fs_->sync();
+    Sample after = Sample::take(*fs_);
+
+    std::vector<double> lat = lat_;
+    std::sort(lat.begin(), lat.end());
+    auto pct = [&lat](double p) {
+        return lat[std::min(lat.size() - 1, size_t(p * lat.size()))];
+    };
+    std::chrono::duration<double> secs = ops_done.when - before.when;
+    std::chrono::duration<double> sync_secs = after.when - ops_done.when;
+
+    std::ostringstream os;
+    os.precision(6);
+    os << "{\"workload\": \"" << workload << "\""
+       << ", \"journal\": " << (journal_ ? "true" : "false")
+       << ", \"ops\": " << n
+       << ", \"seed\": " << conf_.seed
+       << ", \"cache_blocks\": " << conf_.cache_blocks
+       << ", \"policy\": \""
+       << (conf_.policy == CachePolicy::LRU ? "lru" : "2q") << "\""
+       << ", \"seconds\": " << secs.count()
+       << ", \"sync_seconds\": " << sync_secs.count()
+       << ", \"ops_per_sec\": " << n / secs.count()
+       << ", \"p50_us\": " << pct(.5)
+       << ", \"p90_us\": " << pct(.9)
+       << ", \"p99_us\": " << pct(.99)
+       << ", \"max_us\": " << lat.back()
+       << ", \"syscalls_per_op\": "
+       << double(after.syscalls - before.syscalls) / n
+       << ", \"log_bytes_per_op\": "
+       << double(after.log_bytes - before.log_bytes) / n
+       << ", \"allocs_per_op\": "
+       << double(ops_done.allocs - before.allocs) / n
+       << ", \"buffer_hit_rate\": "
+       << double(nhits) / std::max<uint64_t>(1, nhits + nmisses)
+       << ", \"checkpoints\": " << ncheckpoints
+       << "}";
+    return os.str();
+}
+
+static std::vector<std::string>
+split(const std::string &s)
+{
+    std::vector<std::string> res;
+    std::istringstream is(s);
+    for (std::string w; std::getline(is, w, ',');)
+        if (!w.empty())
+            res.push_back(w);
+    return res;
+}
+
+int
+main(int argc, char **argv)
+{
+    if (argc == 0)
+        progname = "v6bench";
+    else if ((progname = std::strrchr(argv[0], '/')))
+        ++progname;
+    else
+        progname = argv[0];
+
+    Config conf;
+    const std::vector<std::string> all =
+        split("mknod,mkdir,write,read,truncate,rename,unlink,lookup,"
+              "scanmix");
+    std::vector<std::string> workloads = all;
+    std::vector<bool> journal = { false, true };
+    std::string out;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:w:j:s:c:p:o:")) != -1)
+        switch (opt) {
+        case 'n':
+            conf.nops = atoi(optarg);
+            // FILE_SIZE bytes per file must fit in a 64K-block image
+            if (conf.nops < 1 || conf.nops > 3000)
+                usage();
+            break;
+        case 'w':
+            workloads = split(optarg);
+            for (const std::string &w : workloads)
+                if (std::find(all.begin(), all.end(), w) == all.end())
+                    usage();
+            break;
+        case 'j':
+            if (!strcmp(optarg, "on"))
+                journal = { true };
+            else if (!strcmp(optarg, "off"))
+                journal = { false };
+            else if (strcmp(optarg, "both"))
+                usage();
+            break;
+        case 's':
+            conf.seed = atoi(optarg);
+            break;
+        case 'c':
+            conf.cache_blocks = atoi(optarg);
+            if (conf.cache_blocks < 4)
+                usage();
+            break;
+        case 'p':
+            if (!strcmp(optarg, "lru"))
+                conf.policy = CachePolicy::LRU;
+            else if (!strcmp(optarg, "2q"))
+                conf.policy = CachePolicy::TWO_Q;
+            else
+                usage();
+            break;
+        case 'o':
+            out = optarg;
+            break;
+        default:
+            usage();
+        }
+    if (optind + 1 < argc)
+        usage();
+    if (optind < argc)
+        conf.image = argv[optind];
+
+    std::ofstream file;
+    if (!out.empty()) {
+        file.open(out, std::ios::app);
+        if (!file) {
+            perror(out.c_str());
+            exit(1);
+        }
+    }
+    std::ostream &os = out.empty() ? std::cout : file;
+
+    try {
+        for (const std::string &w : workloads)
+            for (bool j : journal) {
+                Bench b(conf, j);
+                os << b.run(w) << std::endl;
+            }
+    }
+    catch (const std::exception &e) {
+        fprintf(stderr, "%s: %s\n", progname, e.what());
+        unlink(conf.image.c_str());
+        exit(1);
+    }
+    return 0;
+}
@@ -4,14 +4,18 @@
 #include <unistd.h>
 #include <sys/stat.h>
 
+#include <atomic>
+
 #include "v6fs.hh"
 #include "util.hh"
 #include "replay.hh"
+#include "trace.hh"
 
 bool
 should_crash()
 {
-    static int crash_at = []() {
+    // Disk writes can come from the writeback thread too
+    static std::atomic<int> crash_at = []() {
         if (char *n = getenv("CRASH_AT"))
             return atoi(n);
         return 0;
@@ -26,10 +30,13 @@ crash()
     std::abort();
 }
 
-V6FS::V6FS(std::string path, FScache &cache, int flags)
+V6FS::V6FS(std::string path, FScache &cache, int flags, std::string logpath)
     : readonly_(flags & V6_RDONLY),
-      fd_(::open(path.c_str(), readonly_ ? O_RDONLY : O_RDWR)),
-      cache_(cache)
+      path_(std::move(path)),
+      fd_(::open(path_.c_str(), readonly_ ? O_RDONLY : O_RDWR)),
+      logpath_(std::move(logpath)),
+      cache_(cache),
+      wb_(*this)
 {
     if (fd_ == -1)
         threrror("open");
@@ -42,13 +49,27 @@ V6FS::V6FS(std::string path, FScache &cache, int flags)
         throw std::runtime_error("boot block missing magic number");
     unclean_ = superblock().s_dirty;
 
+    if (superblock().s_uselog && superblock().logid()) {
+        if (logpath_.empty())
+            logpath_ = journal_path(path_);
+        logfd_.set(::open(logpath_.c_str(), readonly_ ? O_RDONLY : O_RDWR));
+        // Even with V6_NOLOG: logfd() would otherwise fall back to
+        // the image, and the file system may need the missing log.
+        if (logfd_ == -1)
+            threrror(logpath_.c_str());
+    }
+
     // Legacy V6 file systems seem to have garbage at end of superblock
     if (superblock().s_uselog)
         try {
             loghdr hdr;
-            read_loghdr(fd_, &hdr, superblock().s_fsize);
+            read_loghdr(logfd(), &hdr, superblock());
         }
         catch (std::exception &e) {
+            // logid() checks s_logmagic, so this is not garbage; the
+            // journal is wrong
+            if (superblock().logid())
+                throw std::runtime_error(logpath_ + ": " + e.what());
             printf("invalid log header, clearing s_uselog in superblock\n");
             superblock().s_uselog = 0;
         }
@@ -69,7 +90,7 @@ V6FS::V6FS(std::string path, FScache &cache, int flags)
                 V6Replay r(*this);
                 r.replay();
             }
-            log_ = std::make_unique<V6Log>(*this);
+            log_ = std::make_unique<V6Log>(*this, flags);
         }
     }
     if (!readonly_) {
@@ -115,6 +136,26 @@ V6FS::sync()
             ok = false;
         }
 
+    try {
+        wb_.drain();
+    }
+    catch (const std::exception &e) {
+        report("sync", &e);
+        ok = false;
+    }
+    return ok;
+}
+
+bool
+V6FS::sync_async()
+{
+    async_writeback_ = true;
+    cleanup _c([this] { async_writeback_ = false; });
+    bool ok = true;
+    if (!cache_.i.flush_dev(this))
+        ok = false;
+    if (!cache_.b.flush_dev(this))
+        ok = false;
     return ok;
 }
 
@@ -140,6 +181,9 @@ V6FS::bread(uint16_t blockno)
 void
 V6FS::readblock(void *mem, uint32_t blockno)
 {
+    if (wb_.read(blockno, mem))
+        return;
+    TRACE_SPAN("disk", "read", "block", blockno);
     int n = pread(fd_, mem, SECTOR_SIZE, blockno * SECTOR_SIZE);
     if (n != SECTOR_SIZE) {
         if (n != -1)
@@ -150,14 +194,34 @@ V6FS::readblock(void *mem, uint32_t blockno)
 
 void
 V6FS::writeblock(const void *mem, uint32_t blockno)
+{
+    wb_.supersede(blockno);
+    diskwrite(mem, blockno);
+}
+
+void
+V6FS::diskwrite(const void *mem, uint32_t blockno)
 {
     if (should_crash())
         crash();
 
+    TRACE_SPAN("disk", "write", "block", blockno);
     if (pwrite(fd_, mem, SECTOR_SIZE, blockno * SECTOR_SIZE) != SECTOR_SIZE)
         threrror("pwrite");
 }
 
+void
+V6FS::writelogblock(const void *mem, uint32_t blockno)
+{
+    if (should_crash())
+        crash();
+
+    TRACE_SPAN("disk", "logwrite", "block", blockno);
+    if (pwrite(logfd(), mem, SECTOR_SIZE, blockno * SECTOR_SIZE) !=
+        SECTOR_SIZE)
+        threrror("pwrite");
+}
+
 uint16_t
 V6FS::iblock(uint16_t inum)
 {
@@ -175,6 +239,7 @@ V6FS::iget(uint16_t inum)
     Ref<Inode> ip = cache_.i(this, inum);
     if (!ip->initialized_) {
         Ref<Buffer> bp = bread(iblock(inum));
+        cache_.b.mark_metadata(bp.get());
         static_cast<inode&>(*ip) = bp->at<inode>(iindex(inum));
         ip->initialized_ = true;
     }
@@ -182,10 +247,10 @@ V6FS::iget(uint16_t inum)
 }
 
 Ref<Inode>
-V6FS::namei(std::string path, uint16_t start)
+V6FS::namei(std::string_view path, uint16_t start)
 {
     Ref<Inode> ip = iget(start);
-    for (std::string_view name : path_components(path)) {
+    for (std::string_view name : PathComponents(path)) {
         if (!ip || !(ip->i_mode & IFDIR))
             return nullptr;
         Dirent d = ip->lookup(name);
@@ -318,6 +383,7 @@ V6FS::ialloc()
     if (superblock().s_ninode == 0) {
         // Out of free inodes?  Just scan the whole disk from the
         // start until we get 100.  This is what V6 actually did.
+        TRACE_SPAN("inode", "scan");
         unsigned end = superblock().s_isize * INODES_PER_BLOCK;
         for (unsigned i = 1;
              i <= end &&
@@ -8,12 +8,14 @@
 #include "layout.hh"
 #include "cache.hh"
 #include "log.hh"
+#include "writeback.hh"
 
 struct V6FS;
 struct Inode;
 struct Dirent;
 
 struct Buffer : CacheEntryBase {
+    static constexpr stats::Counter cache_stats = stats::BUFFER_CACHE;
     alignas(uint32_t) char mem_[SECTOR_SIZE]; // Actual bytes in the buffer
 
     uint16_t blockno() const { return id_; }
@@ -21,7 +23,7 @@ struct Buffer : CacheEntryBase {
     void bdwrite() {            // Write buffer later (delayed write)
         initialized_ = dirty_ = true;
     }
-    void writeback() override { bwrite(); }
+    void writeback() override;
     template<typename T> T &at(size_t i) {
         if (i >= SECTOR_SIZE / sizeof(T))
             throw std::out_of_range("Buffer::at");
@@ -36,6 +38,7 @@ enum class DoLog : bool {
 
 // In-memory cache of an inode
 struct Inode : inode, CacheEntryBase {
+    static constexpr stats::Counter cache_stats = stats::INODE_CACHE;
     uint16_t inum() const { return id_; }
     void writeback() override { put(); }
     void put();
@@ -69,7 +72,7 @@ struct Dirent {
 
     Dirent() = default;
     Dirent(Ref<Inode> dir, Ref<Buffer> bp, direntv6 *de)
-        : dir_(dir), bp_(std::move(bp)), de_(de) {}
+        : dir_(std::move(dir)), bp_(std::move(bp)), de_(de) {}
     explicit operator bool() const { return de_; }
     V6FS &fs() const { return dir_->fs(); }
 
@@ -123,13 +126,18 @@ struct FScache {
     Cache<Inode> i;
     explicit FScache(size_t bsize = 16, size_t isize = 100)
         : b(bsize), i(isize) {}
+    void set_policy(CachePolicy p) { b.set_policy(p); i.set_policy(p); }
 };
 
 struct V6FS {
     const bool readonly_;
     bool unclean_;
+    const std::string path_;
     const unique_fd fd_;
+    std::string logpath_;       // External journal, if any
+    unique_fd logfd_;           // Open external journal, or -1
     FScache &cache_;
+    Writeback wb_;              // Background writes for checkpoints
     std::unique_ptr<V6Log> log_;
     filsys superblock_;
 
@@ -138,11 +146,20 @@ struct V6FS {
     static constexpr unsigned V6_NOLOG         = 0x4;
     static constexpr unsigned V6_MKLOG         = 0x8;
     static constexpr unsigned V6_REPLAY        = 0x10;
-    V6FS(std::string path, FScache &cache, int flags = 0);
+    static constexpr unsigned V6_LOGSYNC       = 0x20; // O_DSYNC log writes
+    static constexpr unsigned V6_LOGDIRECT     = 0x40; // O_DIRECT log writes
+    // logpath names the external journal to use, or to create with
+    // V6_MKLOG.  If empty, an existing external journal is looked
+    // for at journal_path(path).
+    V6FS(std::string path, FScache &cache, int flags = 0,
+         std::string logpath = {});
     V6FS(const V6FS &) = delete;
     ~V6FS();
 
     bool sync();       // Write all dirty buffers.
+    // Like sync(), but dirty buffers are copied and written by wb_ in
+    // the background.  Errors surface from wb_.drain() or a barrier.
+    bool sync_async();
     void invalidate(); // Invalidate all buffers and re-read superblock.
 
     Ref<Buffer> bread(uint16_t blockno); // Read block from disk
@@ -161,7 +178,8 @@ struct V6FS {
     static uint16_t iindex(uint16_t inum) {
         return (inum - ROOT_INUMBER) % INODES_PER_BLOCK;
     }
-    Ref<Inode> namei(std::string path, uint16_t start = ROOT_INUMBER);
+    Ref<Inode> namei(std::string_view path,
+                     uint16_t start = ROOT_INUMBER);
 
     bool badblock(uint16_t blockno) const {
         return blockno < superblock().datastart() ||
@@ -184,6 +202,14 @@ struct V6FS {
 
     void readblock(void *mem, uint32_t blockno);
     void writeblock(const void *mem, uint32_t blockno);
+    // Like writeblock, but to the device holding the log
+    void writelogblock(const void *mem, uint32_t blockno);
+
+    // File descriptor and header block of the log
+    int logfd() const { return logfd_ == -1 ? int(fd_) : int(logfd_); }
+    uint32_t loghdrblock() const {
+        return superblock().logid() ? 0 : superblock().s_fsize;
+    }
 
     struct CacheInfo {
         uint32_t offset;        // Location on disk of bytes
@@ -207,6 +233,11 @@ struct V6FS {
     void log_patch(void *bytes, size_t len);
 
 private:
+    friend Buffer;
+    friend Writeback;
+    bool async_writeback_ = false; // Buffer::writeback() goes to wb_
+    void diskwrite(const void *mem, uint32_t blockno);
+
     // Block allocation using the original V6 free list mechanism
     uint16_t balloc_freelist();
     void bfree_freelist(uint16_t blockno);
@@ -0,0 +1,144 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+#include "log.hh"
+#include "warm.hh"
+
+namespace {
+
+constexpr char WARM_MAGIC[8] = "v6warm1";
+// Most blocks to prefetch while holding the lock
+constexpr unsigned BATCH_BLOCKS = 4;
+
+struct WarmHeader {
+    char magic[8];
+    uint32_t fingerprint;
+    uint16_t nblocks;
+    uint16_t ninodes;
+};
+
+} // anonymous namespace
+
+WarmHints
+warm_capture(V6FS &fs)
+{
+    return { fs.cache_.b.lru_ids(&fs), fs.cache_.i.lru_ids(&fs) };
+}
+
+uint32_t
+warm_fingerprint(const std::string &image, const std::string &journal)
+{
+    unique_fd fd(open(image.c_str(), O_RDONLY));
+    if (fd == -1)
+        threrror(image.c_str());
+    filsys sb;
+    if (pread(fd, &sb, sizeof(sb), SUPERBLOCK_SECTOR * SECTOR_SIZE) !=
+        sizeof(sb))
+        threrror("pread");
+    uint32_t crc = crc32(&sb, sizeof(sb), 0);
+    if (!sb.s_uselog)
+        return crc;
+
+    if (sb.logid()) {
+        std::string path = journal.empty() ? journal_path(image) : journal;
+        fd.set(open(path.c_str(), O_RDONLY));
+        if (fd == -1)
+            threrror(path.c_str());
+    }
+    loghdr lh;
+    read_loghdr(fd, &lh, sb);
+    return crc32(&lh, sizeof(lh), crc);
+}
+
+bool
+warm_save(const std::string &path, const WarmHints &h, uint32_t fingerprint)
+{
+    WarmHeader hdr;
+    memcpy(hdr.magic, WARM_MAGIC, sizeof(hdr.magic));
+    hdr.fingerprint = fingerprint;
+    hdr.nblocks = h.blocks.size();
+    hdr.ninodes = h.inodes.size();
+
+    std::string tmp = path + ".tmp";
+    unique_fd fd(open(tmp.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0666));
+    if (fd == -1)
+        return false;
+    const ssize_t bn = hdr.nblocks * sizeof(uint16_t),
+        in = hdr.ninodes * sizeof(uint16_t);
+    if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+        write(fd, h.blocks.data(), bn) != bn ||
+        write(fd, h.inodes.data(), in) != in ||
+        rename(tmp.c_str(), path.c_str()) == -1) {
+        int err = errno;
+        unlink(tmp.c_str());
+        errno = err;
+        return false;
+    }
+    return true;
+}
+
+std::optional<WarmHints>
+warm_load(const std::string &path, uint32_t fingerprint)
+{
+    unique_fd fd(open(path.c_str(), O_RDONLY));
+    if (fd == -1)
+        return std::nullopt;
+    WarmHeader hdr;
+    if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+        memcmp(hdr.magic, WARM_MAGIC, sizeof(hdr.magic)) ||
+        hdr.fingerprint != fingerprint)
+        return std::nullopt;
+
+    WarmHints h;
+    h.blocks.resize(hdr.nblocks);
+    h.inodes.resize(hdr.ninodes);
+    const ssize_t bn = hdr.nblocks * sizeof(uint16_t),
+        in = hdr.ninodes * sizeof(uint16_t);
+    if (read(fd, h.blocks.data(), bn) != bn ||
+        read(fd, h.inodes.data(), in) != in)
+        return std::nullopt;
+    return h;
+}
+
+unsigned
+warm_prefetch(V6FS &fs, const WarmHints &h, std::mutex &mu,
+              const std::atomic<bool> &stop)
+{
+    // (block, inum) pairs, where inum is 0 for a plain block, sorted
+    // so each inode follows the block holding it.
+    std::vector<std::pair<uint16_t, uint16_t>> todo;
+    {
+        std::lock_guard lk(mu);
+        const filsys &sb = fs.superblock();
+        const unsigned ninodes = sb.s_isize * INODES_PER_BLOCK;
+        for (uint16_t bn : h.blocks)
+            if (bn > SUPERBLOCK_SECTOR && bn < sb.s_fsize)
+                todo.emplace_back(bn, 0);
+        for (uint16_t inum : h.inodes)
+            if (inum >= ROOT_INUMBER && inum <= ninodes)
+                todo.emplace_back(fs.iblock(inum), inum);
+    }
+    std::sort(todo.begin(), todo.end());
+    todo.erase(std::unique(todo.begin(), todo.end()), todo.end());
+
+    unsigned nread = 0;
+    for (auto i = todo.begin(); i != todo.end() && !stop;) {
+        {
+            std::lock_guard lk(mu);
+            for (unsigned n = 0; i != todo.end() && n < BATCH_BLOCKS; ++n) {
+                const uint16_t bn = i->first;
+                Ref<Buffer> bp = fs.bread(bn);
+                ++nread;
+                for (; i != todo.end() && i->first == bn; ++i)
+                    if (i->second)
+                        fs.iget(i->second);
+            }
+        }
+        std::this_thread::yield();
+    }
+    return nread;
+}
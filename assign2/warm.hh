@@ -0,0 +1,47 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "v6fs.hh"
+
+// Warm-start hints let a remount prefetch the blocks and inodes that
+// were cached when the file system was last cleanly unmounted.  The
+// hint file stores a fingerprint of the image's superblock and log
+// header as they were left on disk, so hints for an image that has
+// since been changed by anything else are ignored.  Hints never
+// affect correctness: prefetching just reads the current contents.
+
+struct WarmHints {
+    std::vector<uint16_t> blocks; // Least recently used first
+    std::vector<uint16_t> inodes; // Least recently used first
+};
+
+// The ids fs currently has in the cache.
+WarmHints warm_capture(V6FS &fs);
+
+// Fingerprint of the on-disk state of image (and journal, if the log
+// is external and journal is non-empty or at the default location).
+// Call only while the image is not mounted.
+uint32_t warm_fingerprint(const std::string &image,
+                          const std::string &journal = {});
+
+// Write hints to path, tagged with fingerprint.  Returns false and
+// sets errno on failure.
+bool warm_save(const std::string &path, const WarmHints &h,
+               uint32_t fingerprint);
+
+// Read the hints in path, if it exists, is well formed, and was saved
+// with this fingerprint.
+std::optional<WarmHints> warm_load(const std::string &path,
+                                   uint32_t fingerprint);
+
+// Read the hinted blocks and inodes into fs's cache in block order.
+// Holds mu around small batches, so requests can run in between, and
+// gives up early if stop becomes true.  Returns the number of blocks
+// read.
+unsigned warm_prefetch(V6FS &fs, const WarmHints &h, std::mutex &mu,
+                       const std::atomic<bool> &stop);
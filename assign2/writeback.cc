@@ -0,0 +1,144 @@
+#include <cstring>
+
+#include "trace.hh"
+#include "v6fs.hh"
+#include "writeback.hh"
+
+Writeback::~Writeback()
+{
+    if (!thread_.joinable())
+        return;
+    try {
+        drain();
+    }
+    catch (const std::exception &e) {
+        report("writeback", &e);
+    }
+    {
+        std::lock_guard lk(mu_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    thread_.join();
+}
+
+void
+Writeback::submit(uint16_t blockno, const void *mem)
+{
+    auto img = std::make_shared<Image>();
+    memcpy(img->data(), mem, SECTOR_SIZE);
+    {
+        std::lock_guard lk(mu_);
+        if (!thread_.joinable())
+            thread_ = std::thread([this] { run(); });
+        if (batches_.empty() || batches_.back().closed_)
+            batches_.emplace_back();
+        batches_.back().blocks_[blockno] = std::move(img);
+    }
+    // The thread waits for the barrier, so it doesn't compete with a
+    // flush for the lock one block at a time.
+}
+
+std::shared_future<void>
+Writeback::barrier(std::function<void()> f)
+{
+    std::shared_future<void> done;
+    {
+        std::lock_guard lk(mu_);
+        if (!thread_.joinable()) {
+            // Nothing was ever submitted, so nothing to wait for
+            std::promise<void> p;
+            try {
+                if (f)
+                    f();
+                p.set_value();
+            }
+            catch (...) {
+                p.set_exception(std::current_exception());
+            }
+            return p.get_future().share();
+        }
+        if (batches_.empty() || batches_.back().closed_)
+            batches_.emplace_back();
+        Batch &b = batches_.back();
+        b.closed_ = true;
+        b.then_ = std::move(f);
+        done = b.done_.get_future().share();
+    }
+    cv_.notify_all();
+    return done;
+}
+
+bool
+Writeback::read(uint16_t blockno, void *mem)
+{
+    std::lock_guard lk(mu_);
+    for (auto b = batches_.rbegin(); b != batches_.rend(); ++b)
+        if (auto i = b->blocks_.find(blockno); i != b->blocks_.end()) {
+            memcpy(mem, i->second->data(), SECTOR_SIZE);
+            return true;
+        }
+    return false;
+}
+
+void
+Writeback::supersede(uint16_t blockno)
+{
+    std::unique_lock lk(mu_);
+    for (Batch &b : batches_)
+        b.blocks_.erase(blockno);
+    cv_.wait(lk, [this, blockno] { return writing_ != blockno; });
+}
+
+void
+Writeback::run()
+{
+    TRACE_THREAD("Writeback");
+    std::unique_lock lk(mu_);
+    for (;;) {
+        cv_.wait(lk, [this] {
+            return stop_ || (!batches_.empty() && batches_.front().closed_);
+        });
+        if (stop_ && batches_.empty())
+            return;
+        Batch &b = batches_.front();
+
+        // Write the lowest block.  It stays visible to read() until
+        // written, and supersede() waits for it.
+        while (!b.blocks_.empty()) {
+            auto [bn, img] = *b.blocks_.begin();
+            writing_ = bn;
+            lk.unlock();
+            try {
+                fs_.diskwrite(img->data(), bn);
+            }
+            catch (...) {
+                if (!b.err_)
+                    b.err_ = std::current_exception();
+            }
+            lk.lock();
+            writing_ = 0;
+            // Unless superseded meanwhile
+            if (auto i = b.blocks_.find(bn);
+                i != b.blocks_.end() && i->second == img)
+                b.blocks_.erase(i);
+            cv_.notify_all();
+        }
+        auto then = std::move(b.then_);
+        std::exception_ptr err = b.err_;
+        lk.unlock();
+        if (!err && then)
+            try {
+                then();
+            }
+            catch (...) {
+                err = std::current_exception();
+            }
+        lk.lock();
+        if (err)
+            b.done_.set_exception(err);
+        else
+            b.done_.set_value();
+        batches_.pop_front();
+    }
+}
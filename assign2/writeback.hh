@@ -0,0 +1,71 @@
+#pragma once
+
+#include <array>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "layout.hh"
+
+struct V6FS;
+
+// Writes copies of dirty buffers on a background thread, so that a
+// checkpoint doesn't make the request that triggered it wait for the
+// disk.  Because each block is copied when submitted, the buffer can
+// be changed (or evicted) right away.  Until the copy is written,
+// reads of the block see it, and an in-place write of the block
+// replaces it, so nothing ever goes backwards.
+//
+// Work is done in batches, each ended by a barrier.  The blocks of a
+// batch are written in block order, then its barrier function runs,
+// before the next batch starts.  The thread starts on first use.
+class Writeback {
+public:
+    explicit Writeback(V6FS &fs) : fs_(fs) {}
+    Writeback(const Writeback &) = delete;
+    ~Writeback();               // Waits for everything to be written
+
+    // Queue a copy of mem to be written to blockno.
+    void submit(uint16_t blockno, const void *mem);
+
+    // End the current batch.  The future is ready after f has run,
+    // and rethrows any error writing the batch or running f.
+    std::shared_future<void> barrier(std::function<void()> f = nullptr);
+
+    // Wait for everything submitted so far, rethrowing the first
+    // error.
+    void drain() { barrier().get(); }
+
+    // If blockno has a copy waiting to be written, store it in mem
+    // and return true.
+    bool read(uint16_t blockno, void *mem);
+
+    // Call before writing blockno in place, so no older copy of it
+    // can be written afterwards.
+    void supersede(uint16_t blockno);
+
+private:
+    using Image = std::array<char, SECTOR_SIZE>;
+    struct Batch {
+        std::map<uint16_t, std::shared_ptr<const Image>> blocks_;
+        bool closed_ = false;
+        std::function<void()> then_;
+        std::promise<void> done_;
+        std::exception_ptr err_; // First failed write
+    };
+
+    V6FS &fs_;
+    std::mutex mu_;
+    std::condition_variable cv_;
+    std::deque<Batch> batches_; // Oldest first
+    uint16_t writing_ = 0;      // Block being written now, or 0
+    bool stop_ = false;
+    std::thread thread_;
+
+    void run();
+};